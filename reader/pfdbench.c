@@ -0,0 +1,892 @@
+/*
+ * pfdbench.c
+ *
+ * Read benchmark for prefetchd. Replaces the old reader, step_reader
+ * and interleave-reader programs with one tool that covers their
+ * sequential, backward, stride and interleaved patterns plus random
+ * and mixed ones, with a choice of block size, queue depth, I/O engine
+ * and thread count.
+ *
+ * Reports throughput and latency percentiles and, given the cache
+ * name, the change in the module's procfs counters over the run.
+ * -j prints all of it as one JSON object for regression checks.
+ *
+ * libaio and liburing are not needed, both engines are driven through
+ * their system calls directly.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/aio_abi.h>
+#include <linux/io_uring.h>
+
+#define MAX_THREADS	256
+#define MAX_DEPTH	1024
+#define MAX_STATS	128
+#define BUF_ALIGN	4096
+
+/* Latency histogram: 32 linear buckets per power of two of ns */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+enum pattern {
+	PAT_SEQ,
+	PAT_BACK,
+	PAT_STRIDE,
+	PAT_BACK_STRIDE,
+	PAT_INTERLEAVE,
+	PAT_RANDOM,
+	PAT_MIX,
+};
+
+static const char *pattern_names[] = {
+	[PAT_SEQ]		= "seq",
+	[PAT_BACK]		= "back",
+	[PAT_STRIDE]		= "stride",
+	[PAT_BACK_STRIDE]	= "back-stride",
+	[PAT_INTERLEAVE]	= "interleave",
+	[PAT_RANDOM]		= "random",
+	[PAT_MIX]		= "mix",
+};
+
+enum engine {
+	ENG_SYNC,
+	ENG_AIO,
+	ENG_URING,
+};
+
+static const char *engine_names[] = {
+	[ENG_SYNC]	= "sync",
+	[ENG_AIO]	= "aio",
+	[ENG_URING]	= "uring",
+};
+
+static struct {
+	const char *path;
+	const char *cachename;
+	enum pattern pattern;
+	enum engine engine;
+	size_t bs;
+	size_t stride;
+	int depth;
+	int threads;
+	int direct;
+	int json;
+	int mix_pct;
+	double duration;
+	unsigned long count;
+	off_t offset;
+	off_t region;
+} opt = {
+	.pattern	= PAT_SEQ,
+	.engine		= ENG_SYNC,
+	.bs		= 4096,
+	.depth		= 1,
+	.mix_pct	= 50,
+	.count		= 200000,
+};
+
+struct thread {
+	pthread_t tid;
+	int id;
+	int fd;
+	off_t base;
+	unsigned long nblocks;		/* Blocks of bs + stride in the region */
+	unsigned long pos;
+	unsigned long issued;
+	unsigned int seed;
+
+	/* Results */
+	unsigned long ops;
+	unsigned long long bytes;
+	unsigned long errors;
+	unsigned long long lat_sum;
+	unsigned long long lat_max;
+	unsigned long hist[HIST_BUCKETS];
+};
+
+static struct thread threads[MAX_THREADS];
+static volatile int stop;
+static struct timespec start_ts;
+
+/* Turn taking for the interleave pattern */
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static int turn;
+static unsigned int turn_live;	/* Threads still reading */
+
+struct stats {
+	int nr;
+	char key[MAX_STATS][48];
+	long long val[MAX_STATS];
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"Usage: pfdbench [options] <file or device>\n"
+"  -p pattern   seq, back, stride, back-stride, interleave, random, mix (seq)\n"
+"  -b bytes     block size (4096)\n"
+"  -s bytes     gap between blocks for the stride patterns (block size)\n"
+"  -m pct       share of random reads in the mix pattern (50)\n"
+"  -e engine    sync, aio or uring (sync)\n"
+"  -q depth     reads in flight per thread with aio and uring (1)\n"
+"  -t threads   threads, each reading its own region (1, 4 for interleave)\n"
+"  -d           open with O_DIRECT\n"
+"  -T seconds   run for this long, wrapping around the region\n"
+"  -n count     reads per thread when -T is not given (200000)\n"
+"  -o bytes     offset of the first region (0)\n"
+"  -S bytes     region size per thread (size of the target / threads)\n"
+"  -c cache     cache name under /proc/flashcache, e.g. sdb+sdc\n"
+"  -j           print the results as JSON\n");
+	exit(1);
+}
+
+static unsigned long long
+parse_size(const char *s)
+{
+	char *end;
+	unsigned long long v;
+
+	v = strtoull(s, &end, 0);
+	switch (*end) {
+	case 'k': case 'K':
+		v <<= 10;
+		break;
+	case 'm': case 'M':
+		v <<= 20;
+		break;
+	case 'g': case 'G':
+		v <<= 30;
+		break;
+	case '\0':
+		break;
+	default:
+		fprintf(stderr, "pfdbench: bad size %s\n", s);
+		exit(1);
+	}
+	return v;
+}
+
+static int
+lookup(const char *s, const char **names, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (strcmp(s, names[i]) == 0)
+			return i;
+	fprintf(stderr, "pfdbench: unknown choice %s\n", s);
+	exit(1);
+}
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double
+elapsed_since(struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) + (now.tv_nsec - ts->tv_nsec) / 1e9;
+}
+
+static int
+hist_bucket(unsigned long long v)
+{
+	int e;
+
+	if (v < HIST_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+		((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Lower bound of a bucket, the inverse of hist_bucket() */
+static unsigned long long
+hist_value(int b)
+{
+	int e;
+
+	if (b < HIST_SUB)
+		return b;
+	e = b / HIST_SUB + HIST_SUB_BITS - 1;
+	return (1ULL << e) + ((unsigned long long)(b % HIST_SUB) << (e - HIST_SUB_BITS));
+}
+
+static unsigned long long
+hist_percentile(unsigned long *hist, unsigned long total, double pct)
+{
+	unsigned long want, seen = 0;
+	int b;
+
+	if (total == 0)
+		return 0;
+	want = (unsigned long)(total * pct / 100.0);
+	if (want >= total)
+		want = total - 1;
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return hist_value(b);
+	}
+	return 0;
+}
+
+/* Offset of the next read of a thread */
+static off_t
+next_offset(struct thread *t)
+{
+	unsigned long n = t->nblocks;
+	unsigned long i, blk;
+	size_t step = opt.bs + opt.stride;
+
+	i = t->pos++ % n;
+	switch (opt.pattern) {
+	case PAT_BACK:
+	case PAT_BACK_STRIDE:
+		blk = n - 1 - i;
+		break;
+	case PAT_RANDOM:
+		blk = ((unsigned long)rand_r(&t->seed) << 16 ^ rand_r(&t->seed)) % n;
+		break;
+	case PAT_MIX:
+		if ((unsigned)(rand_r(&t->seed) % 100) < (unsigned)opt.mix_pct) {
+			blk = ((unsigned long)rand_r(&t->seed) << 16 ^ rand_r(&t->seed)) % n;
+			/* Carry on sequentially from the random block */
+			t->pos = blk + 1;
+		} else
+			blk = i;
+		break;
+	default:
+		blk = i;
+		break;
+	}
+	return t->base + (off_t)blk * step;
+}
+
+static int
+done(struct thread *t)
+{
+	if (stop)
+		return 1;
+	if (opt.duration > 0) {
+		/* Checking the clock on every read costs little next to the I/O */
+		if (elapsed_since(&start_ts) >= opt.duration) {
+			stop = 1;
+			return 1;
+		}
+		return 0;
+	}
+	return t->issued >= opt.count;
+}
+
+static void
+account(struct thread *t, unsigned long long lat, long res)
+{
+	if (res < 0) {
+		t->errors++;
+		return;
+	}
+	t->ops++;
+	t->bytes += res;
+	t->lat_sum += lat;
+	if (lat > t->lat_max)
+		t->lat_max = lat;
+	t->hist[hist_bucket(lat)]++;
+}
+
+static void
+turn_wait(struct thread *t)
+{
+	pthread_mutex_lock(&turn_lock);
+	while (turn != t->id)
+		pthread_cond_wait(&turn_cond, &turn_lock);
+	pthread_mutex_unlock(&turn_lock);
+}
+
+/* Hand the turn to the next thread that is still reading */
+static void
+turn_pass(struct thread *t, int leaving)
+{
+	int i;
+
+	pthread_mutex_lock(&turn_lock);
+	if (leaving)
+		turn_live &= ~(1U << t->id);
+	for (i = 1; i <= opt.threads; i++) {
+		int next = (t->id + i) % opt.threads;
+
+		if (turn_live & (1U << next)) {
+			turn = next;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&turn_cond);
+	pthread_mutex_unlock(&turn_lock);
+}
+
+static void
+run_sync(struct thread *t, char *buf)
+{
+	int interleave = (opt.pattern == PAT_INTERLEAVE);
+	unsigned long long t0;
+	off_t off;
+	ssize_t res;
+
+	while (!done(t)) {
+		if (interleave)
+			turn_wait(t);
+		off = next_offset(t);
+		t0 = now_ns();
+		res = pread(t->fd, buf, opt.bs, off);
+		account(t, now_ns() - t0, res < 0 ? -errno : res);
+		t->issued++;
+		if (interleave)
+			turn_pass(t, 0);
+	}
+	if (interleave)
+		turn_pass(t, 1);
+}
+
+static int
+run_aio(struct thread *t, char **bufs)
+{
+	aio_context_t ctx = 0;
+	struct iocb iocbs[MAX_DEPTH], *batch[MAX_DEPTH];
+	struct io_event events[MAX_DEPTH];
+	unsigned long long started[MAX_DEPTH];
+	int free_slots[MAX_DEPTH], nr_free = opt.depth;
+	int inflight = 0;
+	int i, n, queued;
+
+	if (syscall(SYS_io_setup, opt.depth, &ctx) < 0) {
+		perror("io_setup");
+		return -1;
+	}
+	memset(iocbs, 0, sizeof(iocbs));
+	for (i = 0; i < opt.depth; i++) {
+		iocbs[i].aio_fildes = t->fd;
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_buf = (uintptr_t)bufs[i];
+		iocbs[i].aio_nbytes = opt.bs;
+		iocbs[i].aio_data = i;
+		free_slots[i] = i;
+	}
+	for (;;) {
+		queued = 0;
+		while (nr_free > 0 && !done(t)) {
+			i = free_slots[--nr_free];
+			iocbs[i].aio_offset = next_offset(t);
+			started[i] = now_ns();
+			batch[queued++] = &iocbs[i];
+			t->issued++;
+		}
+		if (queued) {
+			n = syscall(SYS_io_submit, ctx, queued, batch);
+			if (n < 0)
+				n = 0;
+			if (n < queued) {
+				perror("io_submit");
+				for (i = n; i < queued; i++)
+					free_slots[nr_free++] = batch[i]->aio_data;
+				stop = 1;
+			}
+			inflight += n;
+		}
+		if (inflight == 0)
+			break;
+		n = syscall(SYS_io_getevents, ctx, 1, opt.depth, events, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_getevents");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			int slot = events[i].data;
+
+			account(t, now_ns() - started[slot], events[i].res);
+			free_slots[nr_free++] = slot;
+			inflight--;
+		}
+	}
+	syscall(SYS_io_destroy, ctx);
+	return 0;
+}
+
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+static int
+uring_setup(struct uring *r, int depth)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (r->fd < 0) {
+		perror("io_uring_setup");
+		return -1;
+	}
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_ring = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED ||
+	    r->sqes == MAP_FAILED) {
+		perror("io_uring mmap");
+		close(r->fd);
+		return -1;
+	}
+	r->sq_head = r->sq_ring + p.sq_off.head;
+	r->sq_tail = r->sq_ring + p.sq_off.tail;
+	r->sq_mask = r->sq_ring + p.sq_off.ring_mask;
+	r->sq_array = r->sq_ring + p.sq_off.array;
+	r->cq_head = r->cq_ring + p.cq_off.head;
+	r->cq_tail = r->cq_ring + p.cq_off.tail;
+	r->cq_mask = r->cq_ring + p.cq_off.ring_mask;
+	r->cqes = r->cq_ring + p.cq_off.cqes;
+	return 0;
+}
+
+static void
+uring_teardown(struct uring *r)
+{
+	munmap(r->sqes, r->sqes_len);
+	munmap(r->cq_ring, r->cq_len);
+	munmap(r->sq_ring, r->sq_len);
+	close(r->fd);
+}
+
+static int
+run_uring(struct thread *t, char **bufs)
+{
+	struct uring r;
+	struct iovec iov[MAX_DEPTH];
+	unsigned long long started[MAX_DEPTH];
+	int free_slots[MAX_DEPTH], nr_free = opt.depth;
+	int inflight = 0;
+	int i;
+
+	if (uring_setup(&r, opt.depth) < 0)
+		return -1;
+	for (i = 0; i < opt.depth; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = opt.bs;
+		free_slots[i] = i;
+	}
+	for (;;) {
+		unsigned tail = *r.sq_tail;
+		int queued = 0;
+		unsigned head;
+
+		while (nr_free > 0 && !done(t)) {
+			struct io_uring_sqe *sqe;
+			unsigned idx = tail & *r.sq_mask;
+
+			i = free_slots[--nr_free];
+			sqe = &r.sqes[idx];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = t->fd;
+			sqe->addr = (uintptr_t)&iov[i];
+			sqe->len = 1;
+			sqe->off = next_offset(t);
+			sqe->user_data = i;
+			r.sq_array[idx] = idx;
+			started[i] = now_ns();
+			tail++;
+			queued++;
+			t->issued++;
+		}
+		if (queued)
+			__atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+		inflight += queued;
+		if (inflight == 0)
+			break;
+		if (syscall(__NR_io_uring_enter, r.fd, queued, 1,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter");
+			break;
+		}
+		head = *r.cq_head;
+		while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+			int slot = cqe->user_data;
+
+			account(t, now_ns() - started[slot], cqe->res);
+			free_slots[nr_free++] = slot;
+			inflight--;
+			head++;
+		}
+		__atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+	}
+	uring_teardown(&r);
+	return 0;
+}
+
+static void *
+thread_main(void *arg)
+{
+	struct thread *t = arg;
+	char *bufs[MAX_DEPTH];
+	int i;
+
+	for (i = 0; i < opt.depth; i++) {
+		if (posix_memalign((void **)&bufs[i], BUF_ALIGN, opt.bs)) {
+			fprintf(stderr, "pfdbench: out of memory\n");
+			stop = 1;
+			return NULL;
+		}
+	}
+	switch (opt.engine) {
+	case ENG_SYNC:
+		run_sync(t, bufs[0]);
+		break;
+	case ENG_AIO:
+		if (run_aio(t, bufs) < 0)
+			stop = 1;
+		break;
+	case ENG_URING:
+		if (run_uring(t, bufs) < 0)
+			stop = 1;
+		break;
+	}
+	for (i = 0; i < opt.depth; i++)
+		free(bufs[i]);
+	return NULL;
+}
+
+/* Read the key=value pairs of a procfs file of the cache */
+static int
+read_stats(const char *file, struct stats *s)
+{
+	char path[512], tok[128];
+	FILE *fp;
+	char *eq;
+
+	s->nr = 0;
+	snprintf(path, sizeof(path), "/proc/flashcache/%s/%s",
+		 opt.cachename, file);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "pfdbench: can't open %s\n", path);
+		return -1;
+	}
+	while (s->nr < MAX_STATS && fscanf(fp, "%127s", tok) == 1) {
+		eq = strchr(tok, '=');
+		if (eq == NULL || eq - tok >= (int)sizeof(s->key[0]))
+			continue;
+		*eq = '\0';
+		strcpy(s->key[s->nr], tok);
+		s->val[s->nr] = strtoll(eq + 1, NULL, 10);
+		s->nr++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static long long
+stat_delta(struct stats *before, struct stats *after, const char *key)
+{
+	int i, j;
+
+	for (i = 0; i < after->nr; i++) {
+		if (strcmp(after->key[i], key) != 0)
+			continue;
+		for (j = 0; j < before->nr; j++)
+			if (strcmp(before->key[j], key) == 0)
+				return after->val[i] - before->val[j];
+		return after->val[i];
+	}
+	return 0;
+}
+
+static double
+pct(long long part, long long whole)
+{
+	return whole > 0 ? part * 100.0 / whole : 0.0;
+}
+
+static off_t
+target_size(int fd)
+{
+	struct stat st;
+	unsigned long long bytes;
+
+	if (fstat(fd, &st) < 0)
+		return 0;
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &bytes) < 0)
+			return 0;
+		return bytes;
+	}
+	return st.st_size;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stats pfd_before, pfd_after, fc_before, fc_after;
+	unsigned long hist[HIST_BUCKETS];
+	unsigned long ops = 0, errors = 0;
+	unsigned long long bytes = 0, lat_sum = 0, lat_max = 0;
+	unsigned long long p50, p99, p999;
+	long long lookups, hits, partial, misses;
+	int have_stats = 0;
+	int flags = O_RDONLY;
+	off_t size;
+	double secs;
+	int c, i, b;
+
+	while ((c = getopt(argc, argv, "p:b:s:m:e:q:t:dT:n:o:S:c:j")) != -1) {
+		switch (c) {
+		case 'p':
+			opt.pattern = lookup(optarg, pattern_names, PAT_MIX + 1);
+			break;
+		case 'b':
+			opt.bs = parse_size(optarg);
+			break;
+		case 's':
+			opt.stride = parse_size(optarg);
+			break;
+		case 'm':
+			opt.mix_pct = atoi(optarg);
+			break;
+		case 'e':
+			opt.engine = lookup(optarg, engine_names, ENG_URING + 1);
+			break;
+		case 'q':
+			opt.depth = atoi(optarg);
+			break;
+		case 't':
+			opt.threads = atoi(optarg);
+			break;
+		case 'd':
+			opt.direct = 1;
+			break;
+		case 'T':
+			opt.duration = atof(optarg);
+			break;
+		case 'n':
+			opt.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			opt.offset = parse_size(optarg);
+			break;
+		case 'S':
+			opt.region = parse_size(optarg);
+			break;
+		case 'c':
+			opt.cachename = optarg;
+			break;
+		case 'j':
+			opt.json = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	opt.path = argv[optind];
+
+	if (opt.threads == 0)
+		opt.threads = (opt.pattern == PAT_INTERLEAVE) ? 4 : 1;
+	if (opt.stride == 0 &&
+	    (opt.pattern == PAT_STRIDE || opt.pattern == PAT_BACK_STRIDE))
+		opt.stride = opt.bs;
+	if (opt.bs == 0 || opt.depth < 1 || opt.depth > MAX_DEPTH ||
+	    opt.threads < 1 || opt.threads > MAX_THREADS ||
+	    opt.mix_pct < 0 || opt.mix_pct > 100) {
+		fprintf(stderr, "pfdbench: bad option value\n");
+		usage();
+	}
+	if (opt.engine == ENG_SYNC)
+		opt.depth = 1;
+	if (opt.pattern == PAT_INTERLEAVE) {
+		/* Strict turns only make sense one read at a time */
+		if (opt.engine != ENG_SYNC || opt.threads > 32) {
+			fprintf(stderr, "pfdbench: interleave needs -e sync and at most 32 threads\n");
+			exit(1);
+		}
+		turn_live = (opt.threads == 32) ? ~0U : (1U << opt.threads) - 1;
+	}
+	if (opt.direct)
+		flags |= O_DIRECT;
+
+	for (i = 0; i < opt.threads; i++) {
+		threads[i].fd = open(opt.path, flags);
+		if (threads[i].fd < 0) {
+			fprintf(stderr, "pfdbench: can't open %s: %s\n",
+				opt.path, strerror(errno));
+			exit(1);
+		}
+	}
+	size = target_size(threads[0].fd);
+	if (opt.region == 0) {
+		if (size <= opt.offset) {
+			fprintf(stderr, "pfdbench: can't size %s, give -S\n", opt.path);
+			exit(1);
+		}
+		opt.region = (size - opt.offset) / opt.threads;
+	}
+	if ((size_t)opt.region < opt.bs + opt.stride) {
+		fprintf(stderr, "pfdbench: region smaller than one block\n");
+		exit(1);
+	}
+
+	if (opt.cachename) {
+		if (read_stats("prefetch_stats", &pfd_before) < 0 ||
+		    read_stats("flashcache_stats", &fc_before) < 0)
+			exit(1);
+		have_stats = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	for (i = 0; i < opt.threads; i++) {
+		struct thread *t = &threads[i];
+
+		t->id = i;
+		t->base = opt.offset + (off_t)i * opt.region;
+		t->nblocks = opt.region / (opt.bs + opt.stride);
+		t->seed = getpid() ^ (i * 2654435761U);
+		if (pthread_create(&t->tid, NULL, thread_main, t)) {
+			fprintf(stderr, "pfdbench: can't start thread %d\n", i);
+			exit(1);
+		}
+	}
+	for (i = 0; i < opt.threads; i++)
+		pthread_join(threads[i].tid, NULL);
+	secs = elapsed_since(&start_ts);
+
+	if (have_stats &&
+	    (read_stats("prefetch_stats", &pfd_after) < 0 ||
+	     read_stats("flashcache_stats", &fc_after) < 0))
+		have_stats = 0;
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < opt.threads; i++) {
+		struct thread *t = &threads[i];
+
+		close(t->fd);
+		ops += t->ops;
+		bytes += t->bytes;
+		errors += t->errors;
+		lat_sum += t->lat_sum;
+		if (t->lat_max > lat_max)
+			lat_max = t->lat_max;
+		for (b = 0; b < HIST_BUCKETS; b++)
+			hist[b] += t->hist[b];
+	}
+	p50 = hist_percentile(hist, ops, 50.0);
+	p99 = hist_percentile(hist, ops, 99.0);
+	p999 = hist_percentile(hist, ops, 99.9);
+
+	if (have_stats) {
+		hits = stat_delta(&pfd_before, &pfd_after, "hits");
+		partial = stat_delta(&pfd_before, &pfd_after, "partial_hits");
+		misses = stat_delta(&pfd_before, &pfd_after, "misses");
+		lookups = hits + partial + misses;
+	}
+
+	if (opt.json) {
+		printf("{\"pattern\": \"%s\", \"engine\": \"%s\", "
+		       "\"block_size\": %zu, \"stride\": %zu, \"queue_depth\": %d, "
+		       "\"threads\": %d, \"direct\": %s, ",
+		       pattern_names[opt.pattern], engine_names[opt.engine],
+		       opt.bs, opt.stride, opt.depth, opt.threads,
+		       opt.direct ? "true" : "false");
+		printf("\"seconds\": %.3f, \"reads\": %lu, \"errors\": %lu, "
+		       "\"bytes\": %llu, \"mb_per_sec\": %.2f, \"iops\": %.0f, ",
+		       secs, ops, errors, bytes, bytes / secs / 1048576.0,
+		       ops / secs);
+		printf("\"lat_avg_us\": %.1f, \"lat_p50_us\": %.1f, "
+		       "\"lat_p99_us\": %.1f, \"lat_p999_us\": %.1f, "
+		       "\"lat_max_us\": %.1f",
+		       ops ? lat_sum / 1e3 / ops : 0.0, p50 / 1e3, p99 / 1e3,
+		       p999 / 1e3, lat_max / 1e3);
+		if (have_stats) {
+			printf(", \"prefetch\": {\"hits\": %lld, \"partial_hits\": %lld, "
+			       "\"misses\": %lld, \"hit_percent\": %.2f, "
+			       "\"bytes_served\": %lld, \"issued\": %lld, "
+			       "\"evicted_unused\": %lld}",
+			       hits, partial, misses, pct(hits + partial, lookups),
+			       stat_delta(&pfd_before, &pfd_after, "bytes_served"),
+			       stat_delta(&pfd_before, &pfd_after, "issued"),
+			       stat_delta(&pfd_before, &pfd_after, "evicted_unused"));
+			printf(", \"cache\": {\"reads\": %lld, \"read_hits\": %lld, "
+			       "\"read_hit_percent\": %.2f}",
+			       stat_delta(&fc_before, &fc_after, "reads"),
+			       stat_delta(&fc_before, &fc_after, "read_hits"),
+			       pct(stat_delta(&fc_before, &fc_after, "read_hits"),
+				   stat_delta(&fc_before, &fc_after, "reads")));
+		}
+		printf("}\n");
+		return errors ? 1 : 0;
+	}
+
+	printf("%s %s bs=%zu stride=%zu qd=%d threads=%d%s\n",
+	       pattern_names[opt.pattern], engine_names[opt.engine], opt.bs,
+	       opt.stride, opt.depth, opt.threads, opt.direct ? " direct" : "");
+	printf("%lu reads in %.3fs, %.2f MB/s, %.0f IOPS, %lu errors\n",
+	       ops, secs, bytes / secs / 1048576.0, ops / secs, errors);
+	printf("latency us: avg=%.1f p50=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+	       ops ? lat_sum / 1e3 / ops : 0.0, p50 / 1e3, p99 / 1e3,
+	       p999 / 1e3, lat_max / 1e3);
+	if (have_stats) {
+		printf("prefetch: hits=%lld partial_hits=%lld misses=%lld "
+		       "hit_percent=%.2f bytes_served=%lld issued=%lld "
+		       "evicted_unused=%lld\n",
+		       hits, partial, misses, pct(hits + partial, lookups),
+		       stat_delta(&pfd_before, &pfd_after, "bytes_served"),
+		       stat_delta(&pfd_before, &pfd_after, "issued"),
+		       stat_delta(&pfd_before, &pfd_after, "evicted_unused"));
+		printf("cache: reads=%lld read_hits=%lld read_hit_percent=%.2f\n",
+		       stat_delta(&fc_before, &fc_after, "reads"),
+		       stat_delta(&fc_before, &fc_after, "read_hits"),
+		       pct(stat_delta(&fc_before, &fc_after, "read_hits"),
+			   stat_delta(&fc_before, &fc_after, "reads")));
+	}
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,616 @@
+/*
+ * pfdsim.c
+ *
+ * Replays a block trace through the flashcache and prefetchd sources
+ * built against the shims in this directory, on a modelled HDD and SSD,
+ * and reports the hit rate, prefetch accuracy and demand read latency
+ * the policies would give. See "Prefetchd simulator" in
+ * doc/flashcache-sa-guide.txt.
+ */
+#include <linux/types.h>
+#include <linux/bio.h>
+#include <linux/device-mapper.h>
+#include <unistd.h>
+#include <strings.h>
+#include <getopt.h>
+#include <time.h>
+#include "flashcache.h"
+#include "flashcache_ioctl.h"
+#include "pfd_stat.h"
+#include "pfd_cache.h"
+#include "sim.h"
+
+struct sim_req {
+	u64 time;		/* ns from the start of the trace */
+	pid_t pid, tgid;
+	int op;
+	sector_t sector;
+	unsigned int sectors;
+	/* Index of the next request of the same pid, -1 for none */
+	int next;
+	/* While in flight */
+	int bios;
+	u64 issued;
+};
+
+struct sim_proc {
+	struct task_struct task;
+	int first, last;
+};
+
+static struct sim_req *reqs;
+static int nr_reqs, reqs_size;
+static struct sim_proc *procs;
+static int nr_procs, procs_size;
+
+static struct dm_target target;
+static struct dm_dev disk_dm_dev, cache_dm_dev;
+static struct inode disk_inode, cache_inode;
+static struct hd_struct disk_part, cache_part;
+static struct cache_c *dmc;
+
+/* Every demand bio points at the same page, the data is never looked at */
+static struct page *scratch;
+
+static int open_loop;
+static u64 *latencies;
+static int nr_latencies;
+static unsigned long read_kb, write_kb;
+static unsigned long events;
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] trace\n"
+		"  trace is CSV (time_s,pid,R|W,sector,bytes[,tgid]) or blkparse\n"
+		"  text output, - for stdin\n"
+		"  -b sectors    cache block size (8)\n"
+		"  -c MB         SSD cache size (1024)\n"
+		"  -a assoc      cache associativity (512)\n"
+		"  -m thru|around  cache mode (thru)\n"
+		"  -r fifo|lru   reclaim policy (fifo)\n"
+		"  -p blocks     prefetch buffer blocks, 0 to disable (%d)\n"
+		"  -s streams    streams tracked (%d)\n"
+		"  -k pid|tgid|region  prefetch_stream_key (pid)\n"
+		"  -d            enable prefetch_delta\n"
+		"  -A pct        prefetch_admit_pct (0)\n"
+		"  -i blocks     prefetch_max_inflight (%d)\n"
+		"  -R KB/s       prefetch_max_rate (0)\n"
+		"  -g blocks     pfd_global_inflight (%d)\n"
+		"  -H us,MB/s    HDD seek time and transfer rate (8000,150)\n"
+		"  -S us,MB/s,n  SSD latency, transfer rate and channels (100,500,8)\n"
+		"  -o            open loop: issue at trace times, not when the\n"
+		"                previous request of the pid completes\n"
+		"  -v            print the stream table at the end\n",
+		prog, PFD_CACHE_DEFAULT_BLOCKS, PFD_STAT_DEFAULT_STREAMS,
+		PFD_CACHE_DEFAULT_INFLIGHT, PFD_CACHE_GLOBAL_INFLIGHT);
+	exit(1);
+}
+
+static struct sim_proc *
+find_proc(pid_t pid, pid_t tgid)
+{
+	int i;
+
+	/* Traces have few pids, and they tend to repeat */
+	for (i = nr_procs - 1; i >= 0; i--)
+		if (procs[i].task.pid == pid)
+			return &procs[i];
+	if (nr_procs == procs_size) {
+		procs_size = procs_size ? procs_size * 2 : 64;
+		procs = realloc(procs, procs_size * sizeof(*procs));
+		if (procs == NULL)
+			panic("pfdsim: out of memory\n");
+	}
+	procs[nr_procs].task.pid = pid;
+	procs[nr_procs].task.tgid = tgid;
+	procs[nr_procs].first = -1;
+	procs[nr_procs].last = -1;
+	return &procs[nr_procs++];
+}
+
+static void
+add_req(double time, pid_t pid, pid_t tgid, int op, sector_t sector,
+	unsigned long bytes)
+{
+	struct sim_proc *proc;
+	struct sim_req *req;
+
+	if (bytes == 0)
+		return;
+	if (nr_reqs == reqs_size) {
+		reqs_size = reqs_size ? reqs_size * 2 : 65536;
+		reqs = realloc(reqs, reqs_size * sizeof(*reqs));
+		if (reqs == NULL)
+			panic("pfdsim: out of memory\n");
+	}
+	req = &reqs[nr_reqs];
+	req->time = time * 1e9;
+	req->pid = pid;
+	req->tgid = tgid;
+	req->op = op;
+	req->sector = sector;
+	req->sectors = DIV_ROUND_UP(bytes, 512);
+	req->next = -1;
+
+	proc = find_proc(pid, tgid);
+	if (proc->last >= 0)
+		reqs[proc->last].next = nr_reqs;
+	else
+		proc->first = nr_reqs;
+	proc->last = nr_reqs;
+	nr_reqs++;
+}
+
+/*
+ * blkparse default output:
+ *   8,0    3        1     0.000000000  4162  Q   R 1234 + 8 [proc]
+ * Only queue events are taken, they are the requests as issued.
+ */
+static bool
+parse_blkparse(const char *line)
+{
+	char dev[32], action[8], rwbs[8];
+	int cpu, pid;
+	unsigned long seq, sector, nr;
+	double time;
+
+	if (sscanf(line, "%31s %d %lu %lf %d %7s %7s %lu + %lu",
+		   dev, &cpu, &seq, &time, &pid, action, rwbs,
+		   &sector, &nr) != 9)
+		return false;
+	if (strcmp(action, "Q") != 0)
+		return true;
+	if (strchr(rwbs, 'D'))
+		return true;
+	if (strchr(rwbs, 'W'))
+		add_req(time, pid, pid, WRITE, sector, nr * 512);
+	else if (strchr(rwbs, 'R'))
+		add_req(time, pid, pid, READ, sector, nr * 512);
+	return true;
+}
+
+static bool
+parse_csv(const char *line)
+{
+	double time;
+	int pid, tgid;
+	char op;
+	unsigned long sector, bytes;
+	int n;
+
+	n = sscanf(line, "%lf,%d,%c,%lu,%lu,%d",
+		   &time, &pid, &op, &sector, &bytes, &tgid);
+	if (n < 5)
+		return false;
+	if (n < 6)
+		tgid = pid;
+	add_req(time, pid, tgid,
+		(op == 'W' || op == 'w') ? WRITE : READ, sector, bytes);
+	return true;
+}
+
+static void
+load_trace(const char *path)
+{
+	FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char line[512];
+	int lineno = 0;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (strchr(line, ',') && !strchr(line, '[') ?
+		    parse_csv(line) : parse_blkparse(line))
+			continue;
+		/* blkparse ends with a summary, and CSV may have a header */
+		if (lineno > 1 && !strchr(line, ','))
+			break;
+	}
+	if (fp != stdin)
+		fclose(fp);
+}
+
+static void
+parse_model(const char *arg, struct sim_dev *dev, bool channels)
+{
+	unsigned long us, mbps;
+	int n = 1;
+
+	if (sscanf(arg, channels ? "%lu,%lu,%d" : "%lu,%lu",
+		   &us, &mbps, &n) < 2 || mbps == 0 || n < 1 ||
+	    n > (int)ARRAY_SIZE(dev->free_at)) {
+		fprintf(stderr, "pfdsim: bad device model %s\n", arg);
+		exit(1);
+	}
+	dev->seek_ns = us * 1000;
+	dev->ns_per_kb = 1000000000ULL / (mbps * 1024);
+	dev->channels = n;
+}
+
+/* As flashcache_ctr() and flashcache_writethrough_create() do it */
+static void
+create_cache(int mode, unsigned int block_size, unsigned long cache_mb,
+	     unsigned int assoc, int reclaim)
+{
+	sector_t i;
+
+	dmc = calloc(1, sizeof(*dmc));
+	if (dmc == NULL)
+		panic("pfdsim: out of memory\n");
+	dmc->tgt = &target;
+	dmc->disk_dev = &disk_dm_dev;
+	dmc->cache_dev = &cache_dm_dev;
+	strcpy(dmc->disk_devname, "hdd");
+	strcpy(dmc->cache_devname, "ssd");
+	strcpy(dmc->dm_vdevname, "pfdsim");
+	init_waitqueue_head(&dmc->destroyq);
+	if (flashcache_job_queues_init(dmc))
+		panic("pfdsim: out of memory\n");
+	dmc->cache_mode = mode;
+	dmc->block_size = block_size;
+	dmc->block_shift = ffs(dmc->block_size) - 1;
+	dmc->block_mask = dmc->block_size - 1;
+	dmc->assoc = assoc;
+	dmc->assoc_shift = ffs(dmc->assoc) - 1;
+
+	dmc->size = (cache_mb << 20) >> SECTOR_SHIFT;
+	dmc->size /= dmc->block_size;
+	dmc->size = (dmc->size / dmc->assoc) * dmc->assoc;
+	if (dmc->size == 0) {
+		fprintf(stderr, "pfdsim: cache smaller than one set\n");
+		exit(1);
+	}
+	dmc->cache = vzalloc(dmc->size * sizeof(struct cacheblock));
+	dmc->cache_cold = vzalloc(dmc->size * sizeof(struct cacheblock_cold));
+	for (i = 0; i < dmc->size; i++) {
+		dmc->cache[i].cache_state = INVALID;
+		dmc->cache[i].hash_next = FLASHCACHE_NULL;
+	}
+	dmc->md_blocks = 0;
+
+	dmc->num_sets = dmc->size >> dmc->assoc_shift;
+	dmc->cache_sets = vzalloc(dmc->num_sets * sizeof(struct cache_set));
+	dmc->dirty_map = vzalloc(BITS_TO_LONGS(dmc->size) * sizeof(unsigned long));
+	dmc->fallow_map = vzalloc(BITS_TO_LONGS(dmc->size) * sizeof(unsigned long));
+	for (i = 0; i < dmc->num_sets; i++) {
+		dmc->cache_sets[i].set_fifo_next = i * dmc->assoc;
+		dmc->cache_sets[i].set_clean_next = i * dmc->assoc;
+		dmc->cache_sets[i].fallow_tstamp = jiffies;
+		dmc->cache_sets[i].fallow_next_cleaning = jiffies;
+		dmc->cache_sets[i].hotlist_lru_tail = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].hotlist_lru_head = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].warmlist_lru_tail = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].warmlist_lru_head = FLASHCACHE_LRU_NULL;
+		spin_lock_init(&dmc->cache_sets[i].set_spin_lock);
+	}
+	atomic_set(&dmc->hot_list_pct, FLASHCACHE_LRU_HOT_PCT_DEFAULT);
+	flashcache_reclaim_init_lru_lists(dmc);
+	flashcache_hash_init(dmc);
+	if (flashcache_diskclean_init(dmc))
+		panic("pfdsim: out of memory\n");
+	spin_lock_init(&dmc->ioctl_lock);
+	spin_lock_init(&dmc->cache_pending_q_spinlock);
+	target.private = dmc;
+
+	dmc->sysctl_dirty_thresh = DIRTY_THRESH_DEF;
+	dmc->dirty_thresh_set = (dmc->assoc * dmc->sysctl_dirty_thresh) / 100;
+	dmc->max_clean_ios_total = MAX_CLEAN_IOS_TOTAL;
+	dmc->max_clean_ios_set = MAX_CLEAN_IOS_SET;
+	dmc->sysctl_max_pids = MAX_PIDS;
+	dmc->sysctl_pid_expiry_secs = PID_EXPIRY_SECS;
+	dmc->sysctl_reclaim_policy = reclaim;
+	dmc->sysctl_cache_all = 1;
+	dmc->sysctl_fallow_clean_speed = FALLOW_CLEAN_SPEED;
+	dmc->sysctl_fallow_delay = FALLOW_DELAY;
+	dmc->sysctl_skip_seq_thresh_kb = SKIP_SEQUENTIAL_THRESHOLD;
+	dmc->sysctl_lru_hot_pct = 75;
+	dmc->sysctl_lru_promote_thresh = 2;
+	for (i = 0; i < SEQUENTIAL_TRACKER_QUEUE_DEPTH; i++)
+		seq_io_move_to_lruhead(dmc, &dmc->seq_recent_ios[i]);
+	dmc->seq_io_tail = &dmc->seq_recent_ios[0];
+
+	for (i = 0; i < dmc->size; i++)
+		flashcache_invalid_insert(dmc, i);
+
+	pfd_stat_add(dmc);
+	pfd_cache_add(dmc);
+}
+
+static void issue(void *arg);
+
+static void
+req_put(struct sim_req *req)
+{
+	if (--req->bios > 0)
+		return;
+	if (req->op == READ)
+		latencies[nr_latencies++] = sim_now - req->issued;
+	if (!open_loop && req->next >= 0)
+		sim_at(sim_now, issue, &reqs[req->next]);
+}
+
+static void
+req_done(struct bio *bio)
+{
+	struct sim_req *req = bio->bi_private;
+
+	bio_put(bio);
+	req_put(req);
+}
+
+/* Split as dm does for a target with max_io_len of one cache block */
+static void
+issue(void *arg)
+{
+	struct sim_req *req = arg;
+	struct sim_proc *proc = find_proc(req->pid, req->tgid);
+	sector_t sector = req->sector;
+	sector_t end = req->sector + req->sectors;
+	struct task_struct *task = sim_current;
+
+	sim_current = &proc->task;
+	req->issued = sim_now;
+	/* Held until all the bios are issued */
+	req->bios = 1;
+	if (req->op == READ)
+		read_kb += req->sectors / 2;
+	else
+		write_kb += req->sectors / 2;
+	while (sector < end) {
+		sector_t next = min(end, (sector | dmc->block_mask) + 1);
+		unsigned int bytes = to_bytes(next - sector);
+		unsigned int nr_vecs = DIV_ROUND_UP(bytes, PAGE_SIZE);
+		struct bio *bio = bio_alloc(GFP_NOIO, nr_vecs);
+		unsigned int i;
+
+		for (i = 0; i < nr_vecs; i++) {
+			bio->bi_io_vec[i].bv_page = scratch;
+			bio->bi_io_vec[i].bv_offset = 0;
+			bio->bi_io_vec[i].bv_len = min(bytes - i * (unsigned int)PAGE_SIZE,
+						       (unsigned int)PAGE_SIZE);
+		}
+		bio->bi_vcnt = nr_vecs;
+		bio->bi_iter.bi_sector = sector;
+		bio->bi_iter.bi_size = bytes;
+		bio->bi_opf = req->op == WRITE ? REQ_OP_WRITE : REQ_OP_READ;
+		bio->bi_end_io = req_done;
+		bio->bi_private = req;
+		req->bios++;
+		flashcache_map(&target, bio);
+		sector = next;
+	}
+	sim_current = task;
+	/* Buffer hits may have completed already */
+	req_put(req);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+pct(unsigned long part, unsigned long whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+static void
+report(double wall, bool verbose)
+{
+	struct flashcache_stats *fs = &dmc->flashcache_stats;
+	struct pfd_cache_stats *ps = &dmc->pfd_cache_stats;
+	unsigned long block_kb = dmc->block_size / 2;
+	unsigned long ssd_kb = fs->read_hits * block_kb;
+	unsigned long buf_kb = ps->bytes_served >> 10;
+	unsigned long useful = ps->completed - min(ps->evicted_unused, ps->completed);
+	struct sim_dev *hdd = &sim_devs[SIM_HDD], *ssd = &sim_devs[SIM_SSD];
+	u64 sum = 0;
+	int i, seq, stride, delta, random;
+
+	printf("trace: %d requests from %d pids, %lu KB read, %lu KB written, %s loop\n",
+	       nr_reqs, nr_procs, read_kb, write_kb, open_loop ? "open" : "closed");
+	printf("replay: %.3f s simulated in %.3f s, %.0f events/s\n",
+	       sim_now / 1e9, wall, wall > 0 ? events / wall : 0);
+	printf("reads: ssd %lu KB (%.1f%%), buffer %lu KB (%.1f%%), hit rate %.1f%%\n",
+	       ssd_kb, pct(ssd_kb, read_kb), buf_kb, pct(buf_kb, read_kb),
+	       pct(ssd_kb + buf_kb, read_kb));
+	printf("buffer: hits %lu, partial hits %lu, misses %lu, parked %lu\n",
+	       ps->hits, ps->partial_hits, ps->misses, ps->parked);
+	printf("prefetch: issued %lu (delta %lu), completed %lu, failed %lu, cancelled %lu, throttled %lu\n",
+	       ps->issued, ps->delta_issued, ps->completed, ps->failed,
+	       ps->cancelled, ps->throttled);
+	printf("accuracy: %.1f%% useful, wasted %lu KB evicted unread, admitted %lu\n",
+	       pct(useful, ps->completed), ps->evicted_unused * block_kb,
+	       ps->admitted);
+	pfd_stat_count_streams(dmc, &seq, &stride, &delta, &random);
+	printf("streams: seq %d, stride %d, delta %d, random %d\n",
+	       seq, stride, delta, random);
+	if (nr_latencies > 0) {
+		qsort(latencies, nr_latencies, sizeof(*latencies), cmp_u64);
+		for (i = 0; i < nr_latencies; i++)
+			sum += latencies[i];
+		printf("read latency: mean %.0f us, p50 %.0f us, p99 %.0f us, max %.0f us\n",
+		       sum / 1e3 / nr_latencies,
+		       latencies[nr_latencies / 2] / 1e3,
+		       latencies[(int)(nr_latencies * 0.99)] / 1e3,
+		       latencies[nr_latencies - 1] / 1e3);
+	}
+	printf("hdd: %lu reads %lu KB (readahead %lu KB), %lu writes %lu KB, %.1f%% busy\n",
+	       hdd->reads, hdd->read_kb, hdd->readahead_kb, hdd->writes,
+	       hdd->write_kb, pct(hdd->busy_ns, sim_now));
+	printf("ssd: %lu reads %lu KB, %lu writes %lu KB\n",
+	       ssd->reads, ssd->read_kb, ssd->writes, ssd->write_kb);
+	if (verbose) {
+		struct seq_file seq_file = { stdout };
+
+		pfd_stat_show_streams(dmc, &seq_file);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int block_size = DEFAULT_BLOCK_SIZE, assoc = DEFAULT_CACHE_ASSOC;
+	unsigned long cache_mb = 1024;
+	int mode = FLASHCACHE_WRITE_THROUGH, reclaim = FLASHCACHE_FIFO;
+	int stream_key = PFD_STAT_KEY_PID, delta = 0, admit_pct = 0;
+	int max_inflight = PFD_CACHE_DEFAULT_INFLIGHT, max_rate = 0;
+	bool verbose = false;
+	struct timespec start, end;
+	sector_t disk_sects = 0;
+	int i, opt;
+
+	sim_devs[SIM_HDD].rotational = true;
+	parse_model("8000,150", &sim_devs[SIM_HDD], false);
+	parse_model("100,500,8", &sim_devs[SIM_SSD], true);
+
+	while ((opt = getopt(argc, argv, "b:c:a:m:r:p:s:k:dA:i:R:g:H:S:ov")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_size = atoi(optarg);
+			break;
+		case 'c':
+			cache_mb = atol(optarg);
+			break;
+		case 'a':
+			assoc = atoi(optarg);
+			break;
+		case 'm':
+			if (strcmp(optarg, "thru") == 0)
+				mode = FLASHCACHE_WRITE_THROUGH;
+			else if (strcmp(optarg, "around") == 0)
+				mode = FLASHCACHE_WRITE_AROUND;
+			else
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (strcmp(optarg, "fifo") == 0)
+				reclaim = FLASHCACHE_FIFO;
+			else if (strcmp(optarg, "lru") == 0)
+				reclaim = FLASHCACHE_LRU;
+			else
+				usage(argv[0]);
+			break;
+		case 'p':
+			sim_set_pfd_cache_blocks(atoi(optarg));
+			break;
+		case 's':
+			sim_set_pfd_stat_streams(atoi(optarg));
+			break;
+		case 'k':
+			if (strcmp(optarg, "pid") == 0)
+				stream_key = PFD_STAT_KEY_PID;
+			else if (strcmp(optarg, "tgid") == 0)
+				stream_key = PFD_STAT_KEY_TGID;
+			else if (strcmp(optarg, "region") == 0)
+				stream_key = PFD_STAT_KEY_REGION;
+			else
+				usage(argv[0]);
+			break;
+		case 'd':
+			delta = 1;
+			break;
+		case 'A':
+			admit_pct = atoi(optarg);
+			break;
+		case 'i':
+			max_inflight = atoi(optarg);
+			break;
+		case 'R':
+			max_rate = atoi(optarg);
+			break;
+		case 'g':
+			sim_set_pfd_global_inflight(atoi(optarg));
+			break;
+		case 'H':
+			parse_model(optarg, &sim_devs[SIM_HDD], false);
+			break;
+		case 'S':
+			parse_model(optarg, &sim_devs[SIM_SSD], true);
+			break;
+		case 'o':
+			open_loop = 1;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (!block_size || (block_size & (block_size - 1)) ||
+	    !assoc || (assoc & (assoc - 1)) ||
+	    assoc < FLASHCACHE_MIN_ASSOC || assoc > FLASHCACHE_MAX_ASSOC) {
+		fprintf(stderr, "pfdsim: block size and associativity must be powers of 2, "
+			"associativity %d to %d\n", FLASHCACHE_MIN_ASSOC, FLASHCACHE_MAX_ASSOC);
+		exit(1);
+	}
+
+	load_trace(argv[optind]);
+	if (nr_reqs == 0) {
+		fprintf(stderr, "pfdsim: no requests in %s\n", argv[optind]);
+		exit(1);
+	}
+	latencies = malloc(nr_reqs * sizeof(*latencies));
+	scratch = alloc_page(GFP_KERNEL);
+	if (latencies == NULL || scratch == NULL)
+		panic("pfdsim: out of memory\n");
+	for (i = 0; i < nr_reqs; i++)
+		disk_sects = max(disk_sects, reqs[i].sector + reqs[i].sectors);
+
+	sim_init();
+	disk_part.nr_sects = disk_sects;
+	disk_inode.i_size = to_bytes((loff_t)disk_sects);
+	sim_bdevs[SIM_HDD].bd_part = &disk_part;
+	sim_bdevs[SIM_HDD].bd_inode = &disk_inode;
+	disk_dm_dev.bdev = &sim_bdevs[SIM_HDD];
+	cache_part.nr_sects = (cache_mb << 20) >> SECTOR_SHIFT;
+	cache_inode.i_size = cache_mb << 20;
+	sim_bdevs[SIM_SSD].bd_part = &cache_part;
+	sim_bdevs[SIM_SSD].bd_inode = &cache_inode;
+	cache_dm_dev.bdev = &sim_bdevs[SIM_SSD];
+	target.len = disk_sects;
+
+	pfd_stat_init();
+	if (pfd_cache_init())
+		panic("pfdsim: pfd_cache_init failed\n");
+	create_cache(mode, block_size, cache_mb, assoc, reclaim);
+	/* As the sysctl handlers in flashcache_procfs.c would set them */
+	dmc->sysctl_pfd_stream_key = stream_key;
+	dmc->sysctl_pfd_delta = delta;
+	dmc->sysctl_pfd_admit_pct = min(max(admit_pct, 0), PFD_CACHE_ADMIT_PCT_MAX);
+	dmc->pfd_admit_set = (dmc->assoc * dmc->sysctl_pfd_admit_pct) / 100;
+	dmc->sysctl_pfd_max_inflight = min(max(max_inflight, 1), PFD_CACHE_MAX_INFLIGHT);
+	dmc->sysctl_pfd_max_rate = max(max_rate, 0);
+
+	if (open_loop) {
+		for (i = 0; i < nr_reqs; i++)
+			sim_at(reqs[i].time, issue, &reqs[i]);
+	} else {
+		for (i = 0; i < nr_procs; i++)
+			sim_at(reqs[procs[i].first].time, issue,
+			       &reqs[procs[i].first]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (sim_step())
+		events++;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	report((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+	       verbose);
+	return 0;
+}
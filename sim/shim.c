@@ -0,0 +1,506 @@
+/*
+ * shim.c
+ *
+ * Kernel services for the simulator: the event loop and its clock, the
+ * device models behind dm_io, work queues, bios, pages and the globals
+ * flashcache_conf.c and flashcache_kcopy.c provide in the module.
+ */
+#include <linux/types.h>
+#include <linux/bio.h>
+#include <linux/device-mapper.h>
+#include <linux/dm-kcopyd.h>
+#include <stdarg.h>
+#include "flashcache.h"
+#include "sim.h"
+
+u64 sim_now;
+unsigned long jiffies;
+int sim_in_interrupt;
+
+static struct task_struct kworker = { 0, 0 };
+struct task_struct *sim_current = &kworker;
+
+struct sim_dev sim_devs[SIM_NR_DEVS];
+struct block_device sim_bdevs[SIM_NR_DEVS];
+
+/* From flashcache_conf.c */
+u_int64_t size_hist[33];
+static mempool_t job_pool = { sizeof(struct kcached_job) };
+static mempool_t pending_job_pool = { sizeof(struct pending_job) };
+mempool_t *_job_pool = &job_pool;
+mempool_t *_pending_job_pool = &pending_job_pool;
+atomic_t nr_cache_jobs;
+atomic_t nr_pending_jobs;
+struct dm_io_client *flashcache_io_client;
+struct dm_kcopyd_client *flashcache_kcp_client;
+
+/*
+ * Events, a binary heap ordered by time and then by insertion so that
+ * events due at the same time run in the order they were scheduled.
+ */
+struct sim_event {
+	u64 when;
+	u64 seq;
+	sim_event_fn fn;
+	void *arg;
+};
+
+static struct sim_event *heap;
+static int heap_len, heap_size;
+static u64 heap_seq;
+
+static bool
+event_before(struct sim_event *a, struct sim_event *b)
+{
+	if (a->when != b->when)
+		return a->when < b->when;
+	return a->seq < b->seq;
+}
+
+void
+sim_at(u64 when, sim_event_fn fn, void *arg)
+{
+	struct sim_event ev = { when, heap_seq++, fn, arg };
+	int i;
+
+	if (heap_len == heap_size) {
+		heap_size = heap_size ? heap_size * 2 : 1024;
+		heap = realloc(heap, heap_size * sizeof(*heap));
+		if (heap == NULL)
+			panic("sim: out of memory for events\n");
+	}
+	i = heap_len++;
+	while (i > 0 && event_before(&ev, &heap[(i - 1) / 2])) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = ev;
+}
+
+static struct sim_event
+heap_pop(void)
+{
+	struct sim_event top = heap[0];
+	struct sim_event last = heap[--heap_len];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < heap_len) {
+		if (child + 1 < heap_len && event_before(&heap[child + 1], &heap[child]))
+			child++;
+		if (!event_before(&heap[child], &last))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+static void
+set_clock(u64 now)
+{
+	sim_now = now;
+	/* Start well clear of 0 like the kernel, for time_after() users */
+	jiffies = 300 * HZ + now / (1000000000ULL / HZ);
+}
+
+/* Work items run one at a time after each event, in queueing order */
+static struct work_struct *work_head, *work_tail;
+
+void
+sim_run_work(void)
+{
+	struct task_struct *task = sim_current;
+	struct work_struct *work;
+
+	sim_current = &kworker;
+	while ((work = work_head) != NULL) {
+		work_head = work->next;
+		if (work_head == NULL)
+			work_tail = NULL;
+		work->next = NULL;
+		work->pending = 0;
+		work->func(work);
+	}
+	sim_current = task;
+}
+
+/* Run the next event, false when there are none left */
+bool
+sim_step(void)
+{
+	struct sim_event ev;
+
+	if (heap_len == 0)
+		return false;
+	ev = heap_pop();
+	set_clock(ev.when);
+	ev.fn(ev.arg);
+	sim_run_work();
+	return true;
+}
+
+void
+sim_init(void)
+{
+	int i;
+
+	set_clock(0);
+	for (i = 0; i < SIM_NR_DEVS; i++)
+		sim_bdevs[i].sim_dev = i;
+	flashcache_io_client = dm_io_client_create();
+}
+
+struct workqueue_struct *
+alloc_workqueue(const char *fmt, unsigned int flags, int max_active, ...)
+{
+	static struct workqueue_struct wq;
+
+	return &wq;
+}
+
+void
+destroy_workqueue(struct workqueue_struct *wq)
+{
+}
+
+bool
+queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	if (work->pending)
+		return false;
+	work->pending = 1;
+	work->next = NULL;
+	if (work_tail)
+		work_tail->next = work;
+	else
+		work_head = work;
+	work_tail = work;
+	return true;
+}
+
+bool
+schedule_work(struct work_struct *work)
+{
+	return queue_work(NULL, work);
+}
+
+static void
+delayed_work_fire(void *arg)
+{
+	schedule_work(arg);
+}
+
+bool
+schedule_delayed_work(struct delayed_work *dw, unsigned long delay)
+{
+	sim_at(sim_now + delay * (1000000000ULL / HZ), delayed_work_fire,
+	       &dw->work);
+	return true;
+}
+
+void
+do_gettimeofday(struct timeval *tv)
+{
+	tv->tv_sec = sim_now / 1000000000ULL;
+	tv->tv_usec = (sim_now % 1000000000ULL) / 1000;
+}
+
+struct pid *
+find_vpid(int nr)
+{
+	return NULL;
+}
+
+struct task_struct *
+pid_task(struct pid *pid, int type)
+{
+	return NULL;
+}
+
+/*
+ * Devices. A request goes to the channel that frees up first and holds
+ * it for its seek and transfer time. An HDD has a single channel and
+ * skips the seek when a request starts where the previous one ended.
+ */
+static u64
+dev_submit(struct dm_io_region *where, int op, int op_flags)
+{
+	struct sim_dev *dev = &sim_devs[where->bdev->sim_dev];
+	unsigned long kb = to_bytes(where->count) >> 10;
+	u64 start, service;
+	int i, ch = 0;
+
+	for (i = 1; i < dev->channels; i++)
+		if (dev->free_at[i] < dev->free_at[ch])
+			ch = i;
+	start = max(sim_now, dev->free_at[ch]);
+	service = kb * dev->ns_per_kb;
+	if (!dev->rotational || where->sector != dev->next_sector)
+		service += dev->seek_ns;
+	dev->free_at[ch] = start + service;
+	dev->next_sector = where->sector + where->count;
+	dev->busy_ns += service;
+	if (op == WRITE) {
+		dev->writes++;
+		dev->write_kb += kb;
+	} else {
+		dev->reads++;
+		dev->read_kb += kb;
+		if (op_flags & REQ_RAHEAD)
+			dev->readahead_kb += kb;
+	}
+	return start + service;
+}
+
+struct io_done {
+	io_notify_fn fn;
+	void *context;
+};
+
+static void
+io_complete(void *arg)
+{
+	struct io_done *done = arg;
+
+	sim_in_interrupt = 1;
+	done->fn(0, done->context);
+	sim_in_interrupt = 0;
+	free(done);
+}
+
+int
+dm_io(struct dm_io_request *io_req, unsigned int num_regions,
+      struct dm_io_region *region, unsigned long *sync_error_bits)
+{
+	struct io_done *done;
+	u64 end = sim_now;
+	unsigned int i;
+
+	for (i = 0; i < num_regions; i++)
+		end = max(end, dev_submit(&region[i], io_req->bi_op,
+					  io_req->bi_op_flags));
+	if (io_req->notify.fn == NULL) {
+		/* Synchronous, the caller does not see the time pass */
+		if (sync_error_bits)
+			*sync_error_bits = 0;
+		return 0;
+	}
+	done = malloc(sizeof(*done));
+	if (done == NULL)
+		return -ENOMEM;
+	done->fn = io_req->notify.fn;
+	done->context = io_req->notify.context;
+	sim_at(end, io_complete, done);
+	return 0;
+}
+
+struct dm_io_client *
+dm_io_client_create(void)
+{
+	static struct dm_io_client client;
+
+	return &client;
+}
+
+void
+dm_io_client_destroy(struct dm_io_client *client)
+{
+}
+
+/* Cleaning is only needed in write back mode, which is not simulated */
+int
+dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
+	       unsigned int num_dests, struct dm_io_region *dests,
+	       unsigned int flags, dm_kcopyd_notify_fn fn, void *context)
+{
+	panic("sim: kcopyd is not simulated\n");
+}
+
+void
+flashcache_clean_write_kickoff(struct flashcache_copy_job *job)
+{
+	panic("sim: cleaning is not simulated\n");
+}
+
+void
+flashcache_clean_md_write_kickoff(struct flashcache_copy_job *job)
+{
+	panic("sim: cleaning is not simulated\n");
+}
+
+/* Bios */
+
+struct bio *
+bio_alloc(gfp_t flags, unsigned int nr_vecs)
+{
+	struct bio *bio;
+
+	bio = calloc(1, sizeof(*bio) + nr_vecs * sizeof(struct bio_vec));
+	if (bio == NULL)
+		return NULL;
+	bio->bi_io_vec = bio->sim_inline_vecs;
+	atomic_set(&bio->__bi_remaining, 1);
+	return bio;
+}
+
+void
+bio_put(struct bio *bio)
+{
+	free(bio);
+}
+
+void
+bio_endio(struct bio *bio)
+{
+	/* A bio with chained splits ends when the last of them does */
+	if (!atomic_dec_and_test(&bio->__bi_remaining))
+		return;
+	if (bio->bi_end_io)
+		bio->bi_end_io(bio);
+}
+
+static void
+bio_chain_endio(struct bio *bio)
+{
+	struct bio *parent = bio->bi_private;
+
+	if (bio->bi_status && !parent->bi_status)
+		parent->bi_status = bio->bi_status;
+	bio_put(bio);
+	bio_endio(parent);
+}
+
+struct bio *
+bio_split(struct bio *bio, int sectors, gfp_t gfp, struct bio_set *bs)
+{
+	struct bio *split = bio_alloc(gfp, 0);
+
+	if (split == NULL)
+		return NULL;
+	split->bi_bdev = bio->bi_bdev;
+	split->bi_opf = bio->bi_opf;
+	split->bi_io_vec = bio->bi_io_vec;
+	split->bi_vcnt = bio->bi_vcnt;
+	split->bi_iter = bio->bi_iter;
+	split->bi_iter.bi_size = to_bytes(sectors);
+	bio_advance_iter(bio, &bio->bi_iter, to_bytes(sectors));
+	return split;
+}
+
+void
+bio_chain(struct bio *bio, struct bio *parent)
+{
+	bio->bi_private = parent;
+	bio->bi_end_io = bio_chain_endio;
+	atomic_inc(&parent->__bi_remaining);
+}
+
+struct bio_set *
+bioset_create(unsigned int pool_size, unsigned int front_pad)
+{
+	static struct bio_set bs;
+
+	return &bs;
+}
+
+void
+bioset_free(struct bio_set *bs)
+{
+}
+
+/* Memory */
+
+struct page *
+alloc_page(gfp_t flags)
+{
+	struct page *page = malloc(sizeof(*page));
+
+	if (page == NULL)
+		return NULL;
+	page->addr = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	if (page->addr == NULL) {
+		free(page);
+		return NULL;
+	}
+	return page;
+}
+
+void
+__free_page(struct page *page)
+{
+	free(page->addr);
+	free(page);
+}
+
+unsigned long
+__get_free_pages(gfp_t flags, unsigned int order)
+{
+	return (unsigned long)aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+}
+
+void
+free_pages(unsigned long addr, unsigned int order)
+{
+	free((void *)addr);
+}
+
+/*
+ * Pages of the vmalloc area are only looked up to be handed to dm_io
+ * right away, a ring of descriptors is enough.
+ */
+struct page *
+sim_addr_to_page(const void *addr)
+{
+	static struct page ring[4096];
+	static unsigned int next;
+	struct page *page = &ring[next++ % ARRAY_SIZE(ring)];
+
+	page->addr = (void *)((unsigned long)addr & PAGE_MASK);
+	return page;
+}
+
+void *
+mempool_alloc(mempool_t *pool, gfp_t flags)
+{
+	return malloc(pool->size);
+}
+
+void
+mempool_free(void *element, mempool_t *pool)
+{
+	free(element);
+}
+
+/* Helpers */
+
+void
+sort(void *base, size_t num, size_t size,
+     int (*cmp)(const void *, const void *),
+     void (*swap)(void *, void *, int))
+{
+	qsort(base, num, size, cmp);
+}
+
+int
+kstrtoull(const char *s, unsigned int base, unsigned long long *res)
+{
+	char *end;
+
+	errno = 0;
+	*res = strtoull(s, &end, base);
+	if (errno || end == s || (*end != '\0' && *end != '\n'))
+		return -EINVAL;
+	return 0;
+}
+
+int
+seq_printf(struct seq_file *seq, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(seq->fp, fmt, ap);
+	va_end(ap);
+	return 0;
+}
@@ -0,0 +1,928 @@
+/*
+ * sim_kernel.h
+ *
+ * Just enough of the kernel API for the flashcache and prefetchd sources
+ * to build as a userspace program, see sim/pfdsim.c. Everything runs on one
+ * thread driven by the event loop in shim.c: locks only record that they
+ * are held, work items run when the current event has been handled and
+ * dm_io completes on the simulated clock.
+ */
+#ifndef SIM_KERNEL_H
+#define SIM_KERNEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+
+/* The sources check for the bi_iter/bi_op era of the bio API */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(4, 14, 0)
+
+#include "prefetchd_switch.h"
+
+/* Types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned long sector_t;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef int blk_status_t;
+
+#define __init
+#define __exit
+#define __user
+#define ____cacheline_aligned __attribute__((aligned(64)))
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#define WRITE_ONCE(x, v) (ACCESS_ONCE(x) = (v))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(x, y) ({ typeof(x) __x = (x); typeof(y) __y = (y); \
+			 __x < __y ? __x : __y; })
+#define max(x, y) ({ typeof(x) __x = (x); typeof(y) __y = (y); \
+			 __x > __y ? __x : __y; })
+#define min_t(t, x, y) min((t)(x), (t)(y))
+#define max_t(t, x, y) max((t)(x), (t)(y))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define IS_ERR(p) ((unsigned long)(p) >= (unsigned long)-4095)
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+
+/* Logging */
+
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define printk_ratelimit() 0
+#define DMERR(fmt, ...) fprintf(stderr, "flashcache: " fmt "\n", ##__VA_ARGS__)
+#define DMINFO(fmt, ...) do { } while (0)
+#define dump_stack() do { } while (0)
+#define panic(fmt, ...) do { \
+	fprintf(stderr, fmt, ##__VA_ARGS__); \
+	abort(); \
+} while (0)
+#define BUG() abort()
+#define BUG_ON(x) do { if (x) abort(); } while (0)
+#define WARN_ON(x) (!!(x))
+
+/* Modules */
+
+#define MODULE_PARM_DESC(name, desc)
+#define MODULE_LICENSE(l)
+#define MODULE_AUTHOR(a)
+#define MODULE_DESCRIPTION(d)
+/* Parameters are set through sim_set_<name>(), see sim.h */
+#define module_param(name, type, perm) \
+	void sim_set_##name(type val) { name = val; }
+#define EXPORT_SYMBOL(sym)
+#define module_init(fn)
+#define module_exit(fn)
+#define THIS_MODULE NULL
+
+/* Lists */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_last_entry(ptr, type, member) list_entry((ptr)->prev, type, member)
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+	     pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member), \
+	     n = list_entry(pos->member.next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+static inline void INIT_HLIST_NODE(struct hlist_node *h)
+{
+	h->next = NULL;
+	h->pprev = NULL;
+}
+
+static inline int hlist_unhashed(const struct hlist_node *h)
+{
+	return !h->pprev;
+}
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	if (first)
+		first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void __hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+
+	*pprev = next;
+	if (next)
+		next->pprev = pprev;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	__hlist_del(n);
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	if (!hlist_unhashed(n)) {
+		__hlist_del(n);
+		INIT_HLIST_NODE(n);
+	}
+}
+
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+#define hlist_entry_safe(ptr, type, member) \
+	({ typeof(ptr) ____ptr = (ptr); \
+	   ____ptr ? hlist_entry(____ptr, type, member) : NULL; })
+#define hlist_for_each_entry(pos, head, member) \
+	for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member); \
+	     pos; \
+	     pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
+#define hlist_for_each_entry_safe(pos, n, head, member) \
+	for (pos = hlist_entry_safe((head)->first, typeof(*pos), member); \
+	     pos && ({ n = pos->member.next; 1; }); \
+	     pos = hlist_entry_safe(n, typeof(*pos), member))
+
+/* Atomics, plain integers on one thread */
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+typedef struct {
+	long counter;
+} atomic64_t;
+
+#define ATOMIC_INIT(i) { (i) }
+#define atomic_read(v) ((v)->counter)
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic_inc(v) ((void)((v)->counter++))
+#define atomic_dec(v) ((void)((v)->counter--))
+#define atomic_add(i, v) ((void)((v)->counter += (i)))
+#define atomic_sub(i, v) ((void)((v)->counter -= (i)))
+#define atomic_inc_return(v) (++(v)->counter)
+#define atomic_dec_return(v) (--(v)->counter)
+#define atomic_add_return(i, v) ((v)->counter += (i))
+#define atomic_sub_return(i, v) ((v)->counter -= (i))
+#define atomic_dec_and_test(v) (--(v)->counter == 0)
+#define atomic_inc_and_test(v) (++(v)->counter == 0)
+#define atomic_xchg(v, n) ({ typeof((v)->counter) __old = (v)->counter; \
+			     (v)->counter = (n); __old; })
+#define atomic_cmpxchg(v, o, n) ({ typeof((v)->counter) __old = (v)->counter; \
+				   if (__old == (o)) \
+					   (v)->counter = (n); \
+				   __old; })
+#define atomic_add_unless(v, a, u) ((v)->counter != (u) ? \
+				    ((v)->counter += (a), 1) : 0)
+#define atomic64_read atomic_read
+#define atomic64_set atomic_set
+#define atomic64_inc atomic_inc
+#define atomic64_add atomic_add
+
+#define smp_mb() do { } while (0)
+#define smp_rmb() do { } while (0)
+#define smp_wmb() do { } while (0)
+#define barrier() do { } while (0)
+
+/* Bitmaps */
+
+#define BITS_PER_LONG (8 * (int)sizeof(long))
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline void __set_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+/* The sim is single threaded, the atomic versions need not be */
+#define set_bit __set_bit
+#define clear_bit __clear_bit
+
+static inline int test_bit(long nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr,
+					  unsigned long size,
+					  unsigned long offset)
+{
+	unsigned long word;
+
+	if (offset >= size)
+		return size;
+	word = addr[offset / BITS_PER_LONG] & (~0UL << (offset % BITS_PER_LONG));
+	offset -= offset % BITS_PER_LONG;
+	while (word == 0) {
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return size;
+		word = addr[offset / BITS_PER_LONG];
+	}
+	offset += __builtin_ctzl(word);
+	return offset < size ? offset : size;
+}
+
+/* Locks only record that they are held, for VERIFY(spin_is_locked()) */
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+typedef spinlock_t rwlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name) { 0 }
+#define DEFINE_SPINLOCK(name) spinlock_t name = { 0 }
+#define spin_lock_init(l) ((l)->locked = 0)
+#define spin_is_locked(l) ((l)->locked)
+#define spin_lock(l) ((l)->locked = 1)
+#define spin_unlock(l) ((l)->locked = 0)
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_bh(l) spin_lock(l)
+#define spin_unlock_bh(l) spin_unlock(l)
+#define spin_lock_irqsave(l, f) do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void)(f); spin_unlock(l); } while (0)
+#define spin_trylock_irqsave(l, f) ((f) = 0, (l)->locked ? 0 : ((l)->locked = 1))
+
+struct mutex {
+	int locked;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { 0 }
+#define mutex_init(m) ((m)->locked = 0)
+#define mutex_lock(m) ((m)->locked = 1)
+#define mutex_unlock(m) ((m)->locked = 0)
+
+struct semaphore {
+	int count;
+};
+
+#define rcu_read_lock() do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+#define synchronize_rcu() do { } while (0)
+
+/* Scheduling and time */
+
+#define HZ 1000
+#define USEC_PER_SEC 1000000L
+#define TASK_UNINTERRUPTIBLE 2
+
+extern unsigned long jiffies;
+
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+#define time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b) time_after_eq(b, a)
+#define msecs_to_jiffies(m) ((unsigned long)(m) * HZ / 1000)
+#define jiffies_to_msecs(j) ((unsigned int)((j) * 1000 / HZ))
+
+void do_gettimeofday(struct timeval *tv);
+
+struct task_struct {
+	pid_t pid;
+	pid_t tgid;
+};
+
+extern struct task_struct *sim_current;
+#define current sim_current
+
+struct pid;
+#define PIDTYPE_PID 0
+struct pid *find_vpid(int nr);
+struct task_struct *pid_task(struct pid *pid, int type);
+
+#define schedule() do { } while (0)
+#define yield() do { } while (0)
+#define cond_resched() do { } while (0)
+
+extern int sim_in_interrupt;
+#define in_interrupt() (sim_in_interrupt)
+#define in_softirq() (sim_in_interrupt)
+
+/* Wait queues; nothing sleeps in the simulator */
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+struct wait_queue_entry {
+	int unused;
+};
+
+#define DECLARE_WAIT_QUEUE_HEAD(name) wait_queue_head_t name = { 0 }
+#define DEFINE_WAIT(name) struct wait_queue_entry name = { 0 }
+#define init_waitqueue_head(q) ((q)->unused = 0)
+#define wake_up(q) do { } while (0)
+#define wake_up_all(q) do { } while (0)
+#define prepare_to_wait(q, w, s) do { } while (0)
+#define finish_wait(q, w) do { } while (0)
+#define wait_event(q, cond) do { \
+	if (!(cond)) \
+		panic("sim: wait_event(%s) would sleep\n", #cond); \
+} while (0)
+
+/* Work queues, see shim.c */
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	int pending;
+	struct work_struct *next;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+struct workqueue_struct {
+	int unused;
+};
+
+#define WQ_UNBOUND 0x2
+#define WQ_MEM_RECLAIM 0x8
+#define INIT_WORK(w, f) do { \
+	(w)->func = (f); \
+	(w)->pending = 0; \
+	(w)->next = NULL; \
+} while (0)
+#define INIT_DELAYED_WORK(dw, f) INIT_WORK(&(dw)->work, f)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					 int max_active, ...);
+#define create_singlethread_workqueue(name) alloc_workqueue(name, 0, 1)
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool schedule_work(struct work_struct *work);
+bool schedule_delayed_work(struct delayed_work *dw, unsigned long delay);
+#define cancel_delayed_work(dw) false
+#define cancel_delayed_work_sync(dw) false
+#define cancel_work_sync(w) false
+#define flush_workqueue(wq) do { } while (0)
+#define flush_scheduled_work() do { } while (0)
+
+/* Memory */
+
+#define GFP_KERNEL 0x01
+#define GFP_NOIO 0x02
+#define GFP_ATOMIC 0x04
+#define GFP_NOWAIT 0x08
+#define __GFP_HIGHMEM 0x10
+#define __GFP_ZERO 0x20
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return (flags & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+
+#define kzalloc(size, flags) calloc(1, (size))
+#define kcalloc(n, size, flags) calloc((n), (size))
+#define kfree(p) free(p)
+#define vmalloc(size) malloc(size)
+#define vzalloc(size) calloc(1, (size))
+#define vfree(p) free(p)
+/* Both come from malloc(), either free will do */
+#define is_vmalloc_addr(p) 0
+
+/* Per CPU data, the simulation has a single CPU */
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define per_cpu_ptr(p, cpu) ((void)(cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define get_cpu() 0
+#define put_cpu() do { } while (0)
+
+struct page {
+	void *addr;
+};
+
+struct page *alloc_page(gfp_t flags);
+void __free_page(struct page *page);
+#define alloc_pages(flags, order) alloc_page(flags)
+#define __free_pages(page, order) __free_page(page)
+unsigned long __get_free_pages(gfp_t flags, unsigned int order);
+void free_pages(unsigned long addr, unsigned int order);
+struct page *sim_addr_to_page(const void *addr);
+#define vmalloc_to_page(addr) sim_addr_to_page((const void *)(addr))
+#define virt_to_page(addr) sim_addr_to_page((const void *)(addr))
+#define page_address(page) ((page)->addr)
+#define kmap(page) ((page)->addr)
+#define kunmap(page) do { } while (0)
+#define kmap_atomic(page, ...) ((page)->addr)
+#define kunmap_atomic(addr, ...) do { (void)(addr); } while (0)
+
+static inline int get_order(unsigned long size)
+{
+	int order = 0;
+
+	size = (size - 1) >> PAGE_SHIFT;
+	while (size) {
+		order++;
+		size >>= 1;
+	}
+	return order;
+}
+
+typedef struct mempool_s {
+	size_t size;
+} mempool_t;
+
+typedef struct kmem_cache {
+	size_t size;
+} kmem_cache_t;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *cache);
+mempool_t *mempool_create(int min_nr, void *(*alloc_fn)(gfp_t, void *),
+			  void (*free_fn)(void *, void *), void *pool_data);
+void mempool_destroy(mempool_t *pool);
+void *mempool_alloc(mempool_t *pool, gfp_t flags);
+void mempool_free(void *element, mempool_t *pool);
+void *mempool_alloc_slab(gfp_t flags, void *pool_data);
+void mempool_free_slab(void *element, void *pool_data);
+
+/* Helpers */
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> ((-shift) & 31));
+}
+
+#define __jhash_final(a, b, c) \
+{ \
+	c ^= b; c -= rol32(b, 14); \
+	a ^= c; a -= rol32(c, 11); \
+	b ^= a; b -= rol32(a, 25); \
+	c ^= b; c -= rol32(b, 16); \
+	a ^= c; a -= rol32(c, 4);  \
+	b ^= a; b -= rol32(a, 14); \
+	c ^= b; c -= rol32(b, 24); \
+}
+
+#define JHASH_INITVAL 0xdeadbeef
+
+static inline u32 jhash_3words(u32 a, u32 b, u32 c, u32 initval)
+{
+	a += JHASH_INITVAL;
+	b += JHASH_INITVAL;
+	c += initval;
+	__jhash_final(a, b, c);
+	return c;
+}
+
+#define jhash_2words(a, b, initval) jhash_3words((a), (b), 0, (initval))
+#define jhash_1word(a, initval) jhash_3words((a), 0, 0, (initval))
+
+#define GOLDEN_RATIO_PRIME_32 0x9e370001UL
+#define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	return (val * 0x61C88647u) >> (32 - bits);
+}
+
+static inline u64 hash_64(u64 val, unsigned int bits)
+{
+	return (val * 0x61C8864680B583EBull) >> (64 - bits);
+}
+
+#define hash_long(val, bits) hash_64((val), (bits))
+
+static inline int ilog2(unsigned long n)
+{
+	return 63 - __builtin_clzl(n);
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	return n <= 1 ? 1 : 1UL << (ilog2(n - 1) + 1);
+}
+
+#define is_power_of_2(n) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+void sort(void *base, size_t num, size_t size,
+	  int (*cmp)(const void *, const void *),
+	  void (*swap)(void *, void *, int));
+void get_random_bytes(void *buf, int nbytes);
+u32 prandom_u32(void);
+
+int kstrtoull(const char *s, unsigned int base, unsigned long long *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+
+#define copy_from_user(to, from, n) (memcpy((to), (from), (n)), 0)
+#define copy_to_user(to, from, n) (memcpy((to), (from), (n)), 0)
+
+/* Sysctl and seq_file, not driven by the simulator */
+
+struct ctl_table;
+struct ctl_table_header;
+struct file;
+struct inode;
+struct seq_file;
+
+int seq_printf(struct seq_file *seq, const char *fmt, ...);
+#define seq_puts(seq, s) seq_printf((seq), "%s", (s))
+
+/* Block layer */
+
+#define SECTOR_SHIFT 9
+#define to_sector(x) ((x) >> SECTOR_SHIFT)
+#define to_bytes(x) ((x) << SECTOR_SHIFT)
+
+#define READ 0
+#define WRITE 1
+#define READA READ
+
+#define REQ_OP_READ 0
+#define REQ_OP_WRITE 1
+#define REQ_OP_DISCARD 3
+#define REQ_SYNC (1U << 11)
+#define REQ_META (1U << 12)
+#define REQ_PRIO (1U << 13)
+#define REQ_RAHEAD (1U << 19)
+#define REQ_PREFLUSH (1U << 18)
+#define REQ_FUA (1U << 17)
+#define REQ_OP_MASK 0xff
+
+#define BLK_STS_OK 0
+#define BLK_STS_IOERR 10
+#define BIO_POOL_SIZE 2
+
+static inline blk_status_t errno_to_blk_status(int error)
+{
+	return error ? BLK_STS_IOERR : BLK_STS_OK;
+}
+
+struct inode {
+	loff_t i_size;
+};
+
+struct hd_struct {
+	sector_t nr_sects;
+};
+
+struct gendisk {
+	char disk_name[32];
+};
+
+struct block_device {
+	struct inode *bd_inode;
+	struct hd_struct *bd_part;
+	struct gendisk *bd_disk;
+	/* Index of the simulated device, see shim.c */
+	int sim_dev;
+};
+
+struct bio_vec {
+	struct page *bv_page;
+	unsigned int bv_len;
+	unsigned int bv_offset;
+};
+
+struct bvec_iter {
+	sector_t bi_sector;
+	unsigned int bi_size;
+	unsigned int bi_idx;
+	unsigned int bi_bvec_done;
+};
+
+struct bio;
+typedef void (bio_end_io_t)(struct bio *);
+
+struct bio {
+	struct bio *bi_next;
+	struct block_device *bi_bdev;
+	unsigned int bi_opf;
+	blk_status_t bi_status;
+	struct bvec_iter bi_iter;
+	atomic_t __bi_remaining;
+	bio_end_io_t *bi_end_io;
+	void *bi_private;
+	unsigned short bi_vcnt;
+	struct bio_vec *bi_io_vec;
+	/* bio_vecs and the bio itself come from one allocation */
+	struct bio_vec sim_inline_vecs[0];
+};
+
+struct bio_set {
+	int unused;
+};
+
+#define bio_op(bio) ((bio)->bi_opf & REQ_OP_MASK)
+#define bio_data_dir(bio) (bio_op(bio) & 1 ? WRITE : READ)
+#define bio_sectors(bio) ((bio)->bi_iter.bi_size >> SECTOR_SHIFT)
+#define bio_end_sector(bio) ((bio)->bi_iter.bi_sector + bio_sectors(bio))
+#define bio_set_dev(bio, bdev) ((bio)->bi_bdev = (bdev))
+
+static inline struct bio_vec bio_iter_iovec(struct bio *bio,
+					    struct bvec_iter iter)
+{
+	struct bio_vec bv = bio->bi_io_vec[iter.bi_idx];
+
+	bv.bv_offset += iter.bi_bvec_done;
+	bv.bv_len = min(bv.bv_len - iter.bi_bvec_done, iter.bi_size);
+	return bv;
+}
+
+static inline void bio_advance_iter(struct bio *bio, struct bvec_iter *iter,
+				    unsigned int bytes)
+{
+	iter->bi_sector += bytes >> SECTOR_SHIFT;
+	iter->bi_size -= bytes;
+	while (bytes) {
+		unsigned int len = bio->bi_io_vec[iter->bi_idx].bv_len -
+			iter->bi_bvec_done;
+		unsigned int step = min(bytes, len);
+
+		bytes -= step;
+		iter->bi_bvec_done += step;
+		if (iter->bi_bvec_done == bio->bi_io_vec[iter->bi_idx].bv_len) {
+			iter->bi_bvec_done = 0;
+			iter->bi_idx++;
+		}
+	}
+}
+
+#define bio_for_each_segment(bvl, bio, iter) \
+	for (iter = (bio)->bi_iter; \
+	     (iter).bi_size && ((bvl = bio_iter_iovec((bio), (iter))), 1); \
+	     bio_advance_iter((bio), &(iter), (bvl).bv_len))
+
+struct bio *bio_alloc(gfp_t flags, unsigned int nr_vecs);
+void bio_put(struct bio *bio);
+void bio_endio(struct bio *bio);
+struct bio *bio_split(struct bio *bio, int sectors, gfp_t gfp,
+		      struct bio_set *bs);
+void bio_chain(struct bio *bio, struct bio *parent);
+struct bio_set *bioset_create(unsigned int pool_size, unsigned int front_pad);
+void bioset_free(struct bio_set *bs);
+void generic_make_request(struct bio *bio);
+#define submit_bio(bio) generic_make_request(bio)
+
+struct bio_list {
+	struct bio *head;
+	struct bio *tail;
+};
+
+static inline int bio_list_empty(const struct bio_list *bl)
+{
+	return bl->head == NULL;
+}
+
+static inline void bio_list_init(struct bio_list *bl)
+{
+	bl->head = bl->tail = NULL;
+}
+
+static inline void bio_list_add(struct bio_list *bl, struct bio *bio)
+{
+	bio->bi_next = NULL;
+	if (bl->tail)
+		bl->tail->bi_next = bio;
+	else
+		bl->head = bio;
+	bl->tail = bio;
+}
+
+static inline void bio_list_merge(struct bio_list *bl, struct bio_list *bl2)
+{
+	if (!bl2->head)
+		return;
+	if (bl->tail)
+		bl->tail->bi_next = bl2->head;
+	else
+		bl->head = bl2->head;
+	bl->tail = bl2->tail;
+}
+
+static inline struct bio *bio_list_pop(struct bio_list *bl)
+{
+	struct bio *bio = bl->head;
+
+	if (bio) {
+		bl->head = bl->head->bi_next;
+		if (!bl->head)
+			bl->tail = NULL;
+		bio->bi_next = NULL;
+	}
+	return bio;
+}
+
+#define BIO_EMPTY_LIST { NULL, NULL }
+
+int __blkdev_driver_ioctl(struct block_device *bdev, fmode_t mode,
+			  unsigned int cmd, unsigned long arg);
+
+/* Device mapper */
+
+#define DM_MAPIO_SUBMITTED 0
+#define DM_MAPIO_REMAPPED 1
+
+struct dm_dev {
+	struct block_device *bdev;
+	fmode_t mode;
+	char name[16];
+};
+
+struct dm_target {
+	void *private;
+	sector_t begin;
+	sector_t len;
+	char *error;
+	unsigned int num_flush_bios;
+	unsigned int num_discard_bios;
+	void *table;
+};
+
+union map_info {
+	void *ptr;
+};
+
+struct dm_io_region {
+	struct block_device *bdev;
+	sector_t sector;
+	sector_t count;
+};
+
+struct page_list {
+	struct page_list *next;
+	struct page *page;
+};
+
+typedef void (*io_notify_fn)(unsigned long error, void *context);
+
+enum dm_io_mem_type {
+	DM_IO_PAGE_LIST,
+	DM_IO_BIO,
+	DM_IO_VMA,
+	DM_IO_KMEM,
+};
+
+struct dm_io_memory {
+	enum dm_io_mem_type type;
+	unsigned int offset;
+	union {
+		struct page_list *pl;
+		struct bio *bio;
+		void *vma;
+		void *addr;
+	} ptr;
+};
+
+struct dm_io_notify {
+	io_notify_fn fn;
+	void *context;
+};
+
+struct dm_io_client {
+	int unused;
+};
+
+struct dm_io_request {
+	int bi_op;
+	int bi_op_flags;
+	struct dm_io_memory mem;
+	struct dm_io_notify notify;
+	struct dm_io_client *client;
+};
+
+int dm_io(struct dm_io_request *io_req, unsigned int num_regions,
+	  struct dm_io_region *region, unsigned long *sync_error_bits);
+struct dm_io_client *dm_io_client_create(void);
+void dm_io_client_destroy(struct dm_io_client *client);
+
+struct dm_kcopyd_client;
+typedef void (*dm_kcopyd_notify_fn)(int read_err, unsigned long write_err,
+				    void *context);
+int dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
+		   unsigned int num_dests, struct dm_io_region *dests,
+		   unsigned int flags, dm_kcopyd_notify_fn fn, void *context);
+
+#define dm_table_get_mode(t) 0
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * sim.h
+ *
+ * Interface between the kernel shims (shim.c) and the trace replay
+ * driver (pfdsim.c).
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include "sim_kernel.h"
+
+/* Simulated devices, picked by block_device.sim_dev */
+enum {
+	SIM_HDD = 0,
+	SIM_SSD,
+	SIM_NR_DEVS,
+};
+
+struct sim_dev {
+	/* Model */
+	int channels;
+	u64 seek_ns;		/* Per request, or per non-contiguous one on an HDD */
+	u64 ns_per_kb;
+	bool rotational;
+
+	/* State */
+	u64 free_at[64];
+	sector_t next_sector;
+
+	/* Counters */
+	unsigned long reads, writes;
+	unsigned long read_kb, write_kb;
+	unsigned long readahead_kb;
+	u64 busy_ns;
+};
+
+extern struct sim_dev sim_devs[SIM_NR_DEVS];
+extern struct block_device sim_bdevs[SIM_NR_DEVS];
+
+/* Simulated clock in ns */
+extern u64 sim_now;
+
+typedef void (*sim_event_fn)(void *arg);
+
+void sim_at(u64 when, sim_event_fn fn, void *arg);
+bool sim_step(void);
+void sim_run_work(void);
+void sim_init(void);
+
+struct seq_file {
+	FILE *fp;
+};
+
+/* Setters for the module parameters, see module_param() in sim_kernel.h */
+void sim_set_pfd_cache_blocks(int val);
+void sim_set_pfd_global_inflight(int val);
+void sim_set_pfd_stat_streams(int val);
+
+#endif
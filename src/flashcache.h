@@ -152,7 +152,7 @@ MUST DISABLE IRQs.
 /*
  * The LRU pointers are maintained as set-relative offsets, instead of 
  * pointers. This enables us to store the LRU pointers per cacheblock
- * using 4 bytes instead of 16 bytes. The upshot of this is that we 
+ * in 14 bits each instead of 16 bytes. The upshot of this is that we 
  * are required to clamp the associativity at an 8K max.
  */
 #define FLASHCACHE_MIN_ASSOC	 256
@@ -160,8 +160,26 @@ MUST DISABLE IRQs.
 #define FLASHCACHE_MIN_DISK_ASSOC       256     /* Min Disk Assoc of 128KB in sectors */
 #define FLASHCACHE_MAX_DISK_ASSOC       2048    /* Max Disk Assoc of 1MB in sectors */
 #define FLASHCACHE_NULL	0xFFFF
+#define FLASHCACHE_LRU_NULL	0x3FFF	/* Ends the 14 bit LRU links */
+/* use_cnt saturates here, so lru_promote_thresh can't go above it */
+#define FLASHCACHE_LRU_USE_MAX	3
+
+/*
+ * cacheblock.refs holds the block's read pins in its low 16 bits, or
+ * FLASHCACHE_BLOCK_CLAIMED while the set lock holder changes the block,
+ * and the number of jobs queued on the block in its high 16 bits.
+ */
+#define FLASHCACHE_PIN_MASK		0xFFFF
+#define FLASHCACHE_BLOCK_CLAIMED	FLASHCACHE_PIN_MASK
+#define FLASHCACHE_PIN_MAX		(FLASHCACHE_BLOCK_CLAIMED - 1)
+#define FLASHCACHE_QUEUED_ONE		(1 << 16)
+#define FLASHCACHE_NR_QUEUED(CACHEBLK)	((u_int32_t)atomic_read(&(CACHEBLK)->refs) >> 16)
 
 struct cacheblock;
+#ifdef PREFETCHD_ON
+struct pfd_stat_table;
+struct pfd_cache;
+#endif
 
 struct cache_set {
 	spinlock_t 		set_spin_lock;
@@ -189,6 +207,9 @@ struct cache_set {
 #define NUM_BLOCK_HASH_BUCKETS		512
 	u_int16_t		hash_buckets[NUM_BLOCK_HASH_BUCKETS];
 	u_int16_t		invalid_head;
+#ifdef PREFETCHD_ON
+	u_int16_t		nr_pfd_admitted;	/* Blocks marked PFD_ADMITTED */
+#endif
 };
 
 struct flashcache_errors {
@@ -203,6 +224,7 @@ struct flashcache_stats {
 	unsigned long reads;		/* Number of reads */
 	unsigned long writes;		/* Number of writes */
 	unsigned long read_hits;	/* Number of cache hits */
+	unsigned long read_hits_nolock;	/* Of which found without the set lock */
 	unsigned long write_hits;	/* Number of write hits (includes dirty write hits) */
 	unsigned long dirty_write_hits;	/* Number of "dirty" write hits */
 	unsigned long replace;		/* Number of cache replacements */
@@ -236,11 +258,35 @@ struct flashcache_stats {
 	unsigned long skipclean;
 	unsigned long trim_blocks;
 	unsigned long clean_set_ios;
+	unsigned long wb_sweep_ios, wb_sweep_clusters;	/* Elevator writeback */
 	unsigned long force_clean_block;
 	unsigned long lru_promotions;
 	unsigned long lru_demotions;
 };
 
+#ifdef PREFETCHD_ON
+struct pfd_cache_stats {
+	unsigned long issued;		/* Blocks prefetched */
+	unsigned long delta_issued;	/* Of which predicted by delta correlation */
+	unsigned long completed;	/* Prefetches that landed in the buffer */
+	unsigned long failed;		/* Prefetches that failed or were dropped */
+	unsigned long from_ssd, from_hdd;
+	unsigned long skipped_dirty;	/* Not read from disk, SSD copy is newer */
+	unsigned long queue_drops;	/* Requests dropped on a full ring */
+	unsigned long cancelled;	/* Queued prefetches dropped on a pattern change */
+	unsigned long throttled;	/* Prefetches cut short by the budget */
+	unsigned long hits;		/* Bios served entirely from the buffer */
+	unsigned long partial_hits;	/* Bios served in part from the buffer */
+	unsigned long misses;
+	unsigned long bytes_served;
+	unsigned long parked;		/* Reads parked on a prefetch in flight */
+	unsigned long evicted_unused;	/* Prefetched blocks evicted unread */
+	unsigned long invalidates;	/* Blocks dropped by writes */
+	unsigned long admitted;		/* Prefetched blocks written to the SSD */
+	unsigned long admit_skipped;	/* Not admitted: cached, busy or over quota */
+};
+#endif
+
 struct diskclean_buf_ {
 	struct diskclean_buf_ *next;
 };
@@ -275,7 +321,27 @@ struct cache_c {
 	int 			on_ssd_version;
 	
 	struct cacheblock	*cache;	/* Hash table for cache blocks */
+	struct cacheblock_cold	*cache_cold;	/* LRU links and checksums, by cache index */
 	struct cache_set	*cache_sets;
+	/* 
+	 * DIRTY and DIRTY_FALLOW_2 blocks, by cache index. A set's bits are
+	 * whole words (assoc >= 256), under the set lock, so the cleaner
+	 * finds dirty blocks without walking the set.
+	 */
+	unsigned long		*dirty_map;
+	unsigned long		*fallow_map;
+	/*
+	 * Write back only. Disk clusters (the runs of disk blocks that
+	 * hash_block() maps to one set) that may hold dirty blocks, by disk
+	 * offset. Bits are set atomically on the dirty transition and cleared
+	 * lazily by the writeback sweep, see flashcache_wb_sweep().
+	 */
+	unsigned long		*wb_cluster_map;
+	unsigned long		wb_nr_clusters;
+	unsigned int		wb_cluster_shift;	/* Cluster size in sectors, in bits */
+	unsigned long		wb_cursor;	/* Next cluster the sweep visits */
+	atomic_t		wb_sweep_busy;
+	unsigned long		disk_last_io;	/* jiffies of the last foreground disk IO */
 	struct cache_md_block_head *md_blocks_buf;
 
  	/* None of these change once cache is created */
@@ -297,6 +363,8 @@ struct cache_c {
 	/* XXX - Updates of nr_jobs should happen inside the lock. But doing it outside
 	   is OK since the filesystem is unmounted at this point */
 	atomic_t nr_jobs;		/* Number of I/O jobs */
+	struct flashcache_job_queue *job_queues;	/* Per CPU, see alloc_percpu() */
+	struct workqueue_struct *kcached_wq;
 
 #define SLOW_REMOVE    1                                                                                    
 #define FAST_REMOVE    2
@@ -330,6 +398,11 @@ struct cache_c {
 #else
 	struct delayed_work delayed_clean;
 #endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+	struct work_struct wb_sweep;
+#else
+	struct delayed_work wb_sweep;
+#endif
 
 	spinlock_t ioctl_lock;	/* XXX- RCU! */
 	unsigned long pid_expire_check;
@@ -391,6 +464,8 @@ struct cache_c {
 	int sysctl_lru_hot_pct;
 	int sysctl_lru_promote_thresh;
 	int sysctl_new_style_write_merge;
+	int sysctl_wb_sweep_thresh;
+	int sysctl_wb_sweep_idle_ms;
 
 	/* Sequential I/O spotter */
 	struct sequential_io	seq_recent_ios[SEQUENTIAL_TRACKER_QUEUE_DEPTH];
@@ -400,6 +475,22 @@ struct cache_c {
 #define FLASHCACHE_WRITE_CLUST_HIST_SIZE	128
 	unsigned long	write_clust_hist[FLASHCACHE_WRITE_CLUST_HIST_SIZE];
 	unsigned long	write_clust_hist_ovf;
+
+#ifdef PREFETCHD_ON
+	/* Prefetchd stream tracker, see pfd_stat.c */
+	struct pfd_stat_table *pfd_stat_table;
+	/* Prefetch buffer, see pfd_cache.c */
+	struct pfd_cache *pfd_cache;
+	int sysctl_pfd_cache_blocks;
+	int sysctl_pfd_zerostats;
+	int sysctl_pfd_admit_pct;
+	int sysctl_pfd_stream_key;
+	int sysctl_pfd_delta;
+	int sysctl_pfd_max_inflight;
+	int sysctl_pfd_max_rate;	/* KB/s, 0 for no limit */
+	int pfd_admit_set;	/* Max PFD_ADMITTED blocks per set */
+	struct pfd_cache_stats pfd_cache_stats;
+#endif
 };
 
 /* kcached/pending job states */
@@ -433,6 +524,30 @@ struct kcached_job {
 	struct kcached_job *next;
 };
 
+/* 
+ * kcached job lists. Each cache device has a set of them per CPU,
+ * filled by the completions on that CPU and drained by a work item
+ * queued on the same CPU, so neither a lock nor a worker is shared
+ * between devices or CPUs.
+ */
+enum {
+	FLASHCACHE_JOBS_MD_COMPLETE,
+	FLASHCACHE_JOBS_PENDING,
+	FLASHCACHE_JOBS_MD_IO,
+	FLASHCACHE_JOBS_IO,
+	FLASHCACHE_JOBS_UNCACHED_IO_COMPLETE,
+	FLASHCACHE_JOBS_CLEANING_READ_COMPLETE,
+	FLASHCACHE_JOBS_CLEANING_WRITE_COMPLETE,
+	FLASHCACHE_NR_JOB_LISTS,
+};
+
+struct flashcache_job_queue {
+	spinlock_t		lock;
+	struct list_head	jobs[FLASHCACHE_NR_JOB_LISTS];
+	struct work_struct	work;
+	struct cache_c		*dmc;
+} ____cacheline_aligned_in_smp;
+
 struct pending_job {
 	struct bio *bio;
 	int	action;	
@@ -490,6 +605,11 @@ enum {
  */
 #define DIRTY_FALLOW_1		0x0080	
 #define DIRTY_FALLOW_2		0x0100
+/*
+ * Admitted into the cache by the prefetcher and not read since. Such
+ * blocks count against the per set admission quota. Never persisted.
+ */
+#define PFD_ADMITTED		0x0200
 
 #define FALLOW_DOCLEAN		(DIRTY_FALLOW_1 | DIRTY_FALLOW_2)
 #define BLOCK_IO_INPROG	(DISKREADINPROG | DISKWRITEINPROG | CACHEREADINPROG | CACHEWRITEINPROG)
@@ -501,6 +621,8 @@ enum {
 /* Cache metadata is read by Flashcache utilities */
 #ifndef __KERNEL__
 typedef u_int64_t sector_t;
+/* Same layout as the kernel's, for sizeof(struct cacheblock) */
+typedef struct { int counter; } atomic_t;
 #endif
 
 /* On Flash (cache metadata) Structures */
@@ -509,15 +631,25 @@ typedef u_int64_t sector_t;
 #define CACHE_MD_STATE_FASTCLEAN	0xcafefeed
 #define CACHE_MD_STATE_UNSTABLE		0xc8249756
 
-/* Cache block metadata structure */
+/* 
+ * Cache block metadata structure. This is what lookups and hits touch,
+ * including the read pins and pending queue count, 16 bytes so a set's
+ * blocks sit 4 to a cache line and none straddles one. The hash chains
+ * and invalid list are singly linked (hash_next). The replacement state
+ * and checksum are in the parallel struct cacheblock_cold array, 4
+ * bytes a block (12 with checksums).
+ */
 struct cacheblock {
-	u_int16_t	cache_state;
-	int16_t 	nr_queued;	/* jobs in pending queue */
-	u_int16_t	lru_prev, lru_next;
-	u_int8_t        use_cnt;
-	u_int8_t        lru_state;
 	sector_t 	dbn;	/* Sector number of the cached block */
-	u_int16_t	hash_prev, hash_next;
+	atomic_t	refs;	/* read pins and queued jobs, see FLASHCACHE_PIN_MASK */
+	u_int16_t	cache_state;
+	u_int16_t	hash_next;
+};
+
+struct cacheblock_cold {
+	u_int32_t	lru_prev:14, lru_next:14;
+	u_int32_t	lru_state:2;
+	u_int32_t	use_cnt:2;
 #ifdef FLASHCACHE_DO_CHECKSUMS
 	u_int64_t 	checksum;
 #endif
@@ -620,6 +752,10 @@ struct cache_md_block_head {
 #define FALLOW_SPEED_MIN	1
 #define FALLOW_SPEED_MAX	100
 #define FALLOW_CLEAN_SPEED	2
+#define WB_SWEEP_THRESH_DEF	10	/* Device wide dirty pct to start sweeping */
+#define WB_SWEEP_IDLE_MS	1000	/* Sweep once the disk is idle this long */
+#define WB_SWEEP_TICK		(HZ / 10)
+#define WB_SWEEP_MAX_CLUSTERS	64	/* Clusters visited per sweep step */
 
 #define FLASHCACHE_LRU_HOT_PCT_DEFAULT	50
 
@@ -684,8 +820,8 @@ void flashcache_store_checksum(struct kcached_job *job);
 int flashcache_validate_checksum(struct kcached_job *job);
 int flashcache_read_compute_checksum(struct cache_c *dmc, int index, void *block);
 #endif
-struct kcached_job *pop(struct list_head *jobs);
-void push(struct list_head *jobs, struct kcached_job *job);
+int flashcache_job_queues_init(struct cache_c *dmc);
+void flashcache_job_queues_destroy(struct cache_c *dmc);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
 void do_work(void *unused);
 #else
@@ -698,10 +834,6 @@ void push_io(struct kcached_job *job);
 void push_md_io(struct kcached_job *job);
 void push_md_complete(struct kcached_job *job);
 void push_uncached_io_complete(struct kcached_job *job);
-int flashcache_pending_empty(void);
-int flashcache_io_empty(void);
-int flashcache_md_io_empty(void);
-int flashcache_md_complete_empty(void);
 void flashcache_md_write_done(struct kcached_job *job);
 void flashcache_do_pending(struct kcached_job *job);
 void flashcache_free_pending_jobs(struct cache_c *dmc, struct cacheblock *cacheblk, 
@@ -711,7 +843,14 @@ void flashcache_md_write(struct kcached_job *job);
 void flashcache_md_write_kickoff(struct kcached_job *job);
 void flashcache_do_io(struct kcached_job *job);
 void flashcache_uncached_io_complete(struct kcached_job *job);
+void flashcache_read_cache(struct cache_c *dmc, struct bio *bio);
+#ifdef PREFETCHD_ON
+struct kcached_job *flashcache_pfd_admit(struct cache_c *dmc, sector_t dbn);
+void flashcache_pfd_admit_done(struct kcached_job *job, int error);
+void flashcache_pfd_clear_admitted(struct cache_c *dmc, int index);
+#endif
 void flashcache_clean_set(struct cache_c *dmc, int set, int force_clean_blocks);
+void flashcache_wb_sweep(struct cache_c *dmc);
 void flashcache_sync_all(struct cache_c *dmc);
 void flashcache_reclaim_fifo_get_old_block(struct cache_c *dmc, int start_index, int *index);
 void flashcache_reclaim_lru_get_old_block(struct cache_c *dmc, int start_index, int *index);
@@ -764,8 +903,15 @@ void flashcache_hash_destroy(struct cache_c *dmc);
 void flashcache_hash_remove(struct cache_c *dmc, int index);
 int flashcache_hash_lookup(struct cache_c *dmc, int set,
 			   sector_t dbn);
+int flashcache_hash_lookup_nolock(struct cache_c *dmc, int set,
+				  sector_t dbn);
 void flashcache_hash_insert(struct cache_c *dmc, int index);
 
+int flashcache_block_claim(struct cache_c *dmc, int index);
+void flashcache_block_unclaim(struct cache_c *dmc, int index);
+int flashcache_block_pin(struct cache_c *dmc, int index);
+int flashcache_block_unpin(struct cache_c *dmc, int index);
+
 void flashcache_invalid_insert(struct cache_c *dmc, int index);
 void flashcache_invalid_remove(struct cache_c *dmc, int index);
 int flashcache_invalid_get(struct cache_c *dmc, int set);
@@ -67,7 +67,6 @@
 #endif
 
 struct cache_c *cache_list_head = NULL;
-struct work_struct _kcached_wq;
 u_int64_t size_hist[33];
 
 struct kmem_cache *_job_cache;
@@ -78,11 +77,6 @@ mempool_t *_pending_job_pool;
 atomic_t nr_cache_jobs;
 atomic_t nr_pending_jobs;
 
-extern struct list_head *_pending_jobs;
-extern struct list_head *_io_jobs;
-extern struct list_head *_md_io_jobs;
-extern struct list_head *_md_complete_jobs;
-
 struct flashcache_control_s {
 	unsigned long synch_flags;
 };
@@ -162,11 +156,6 @@ flashcache_jobs_init(void)
 static void 
 flashcache_jobs_exit(void)
 {
-	VERIFY(flashcache_pending_empty());
-	VERIFY(flashcache_io_empty());
-	VERIFY(flashcache_md_io_empty());
-	VERIFY(flashcache_md_complete_empty());
-
 	mempool_destroy(_job_pool);
 	kmem_cache_destroy(_job_cache);
 	_job_pool = NULL;
@@ -183,7 +172,7 @@ flashcache_kcached_init(struct cache_c *dmc)
 	init_waitqueue_head(&dmc->destroyq);
 	atomic_set(&dmc->nr_jobs, 0);
 	atomic_set(&dmc->remove_in_prog, 0);
-	return 0;
+	return flashcache_job_queues_init(dmc);
 }
 
 /*
@@ -226,7 +215,7 @@ flashcache_writeback_md_store(struct cache_c *dmc)
 			num_dirty++;
 		next_ptr->dbn = dmc->cache[i].dbn;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-		next_ptr->checksum = dmc->cache[i].checksum;
+		next_ptr->checksum = dmc->cache_cold[i].checksum;
 #endif
 		next_ptr->cache_state = dmc->cache[i].cache_state & 
 			(INVALID | VALID | DIRTY);
@@ -344,6 +333,35 @@ flashcache_writeback_md_store(struct cache_c *dmc)
 	return 0;
 }
 
+/* Free the incore block metadata, safe to call more than once */
+static void
+flashcache_free_cache(struct cache_c *dmc)
+{
+	vfree((void *)dmc->cache);
+	vfree((void *)dmc->cache_cold);
+	dmc->cache = NULL;
+	dmc->cache_cold = NULL;
+}
+
+/* 
+ * Allocate the zeroed incore block metadata for dmc->size blocks, see
+ * struct cacheblock.
+ */
+static int
+flashcache_alloc_cache(struct cache_c *dmc)
+{
+	dmc->cache = (struct cacheblock *)vmalloc(dmc->size * sizeof(struct cacheblock));
+	dmc->cache_cold = (struct cacheblock_cold *)
+		vmalloc(dmc->size * sizeof(struct cacheblock_cold));
+	if (!dmc->cache || !dmc->cache_cold) {
+		flashcache_free_cache(dmc);
+		return 1;
+	}
+	memset(dmc->cache, 0, dmc->size * sizeof(struct cacheblock));
+	memset(dmc->cache_cold, 0, dmc->size * sizeof(struct cacheblock_cold));
+	return 0;
+}
+
 static int 
 flashcache_writethrough_create(struct cache_c *dmc)
 {
@@ -367,28 +385,26 @@ flashcache_writethrough_create(struct cache_c *dmc)
   		      cache_size, dev_size);
 		return 1;
 	}
-	order = dmc->size * sizeof(struct cacheblock);
+	order = dmc->size * (sizeof(struct cacheblock) + sizeof(struct cacheblock_cold));
 	DMINFO("Allocate %luKB (%luB per) mem for %lu-entry cache" \
 	       "(capacity:%luMB, associativity:%u, block size:%u " \
 	       "sectors(%uKB))",
-	       order >> 10, sizeof(struct cacheblock), dmc->size,
+	       order >> 10, sizeof(struct cacheblock) + sizeof(struct cacheblock_cold), dmc->size,
 	       cache_size >> (20-SECTOR_SHIFT), dmc->assoc, dmc->block_size,
 	       dmc->block_size >> (10-SECTOR_SHIFT));
-	dmc->cache = (struct cacheblock *)vmalloc(order);
-	if (!dmc->cache) {
+	if (flashcache_alloc_cache(dmc)) {
 		DMERR("flashcache_writethrough_create: Unable to allocate cache md");
 		return 1;
 	}
-	memset(dmc->cache, 0, order);
 	/* Initialize the cache structs */
 	for (i = 0; i < dmc->size ; i++) {
 		dmc->cache[i].dbn = 0;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-		dmc->cache[i].checksum = 0;
+		dmc->cache_cold[i].checksum = 0;
 #endif
 		dmc->cache[i].cache_state = INVALID;
-		dmc->cache[i].lru_state = 0;
-		dmc->cache[i].nr_queued = 0;
+		atomic_set(&dmc->cache[i].refs, 0);
+		dmc->cache_cold[i].lru_state = 0;
 	}
 	dmc->md_blocks = 0;
 	return 0;
@@ -452,29 +468,27 @@ flashcache_writeback_create(struct cache_c *dmc, int force)
 		vfree((void *)header);
 		return 1;
 	}
-	order = dmc->size * sizeof(struct cacheblock);
+	order = dmc->size * (sizeof(struct cacheblock) + sizeof(struct cacheblock_cold));
 	DMINFO("Allocate %luKB (%luB per) mem for %lu-entry cache" \
 	       "(capacity:%luMB, associativity:%u, block size:%u " \
 	       "sectors(%uKB))",
-	       order >> 10, sizeof(struct cacheblock), dmc->size,
+	       order >> 10, sizeof(struct cacheblock) + sizeof(struct cacheblock_cold), dmc->size,
 	       cache_size >> (20-SECTOR_SHIFT), dmc->assoc, dmc->block_size,
 	       dmc->block_size >> (10-SECTOR_SHIFT));
-	dmc->cache = (struct cacheblock *)vmalloc(order);
-	if (!dmc->cache) {
+	if (flashcache_alloc_cache(dmc)) {
 		vfree((void *)header);
 		DMERR("flashcache_writeback_create: Unable to allocate cache md");
 		return 1;
 	}
-	memset(dmc->cache, 0, order);
 	/* Initialize the cache structs */
 	for (i = 0; i < dmc->size ; i++) {
 		dmc->cache[i].dbn = 0;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-		dmc->cache[i].checksum = 0;
+		dmc->cache_cold[i].checksum = 0;
 #endif
 		dmc->cache[i].cache_state = INVALID;
-		dmc->cache[i].lru_state = 0;
-		dmc->cache[i].nr_queued = 0;
+		atomic_set(&dmc->cache[i].refs, 0);
+		dmc->cache_cold[i].lru_state = 0;
 	}
 	meta_data_cacheblock = (struct flash_cacheblock *)vmalloc(METADATA_IO_BLOCKSIZE);
 	if (!meta_data_cacheblock) {
@@ -489,7 +503,7 @@ flashcache_writeback_create(struct cache_c *dmc, int force)
 	for (i = 0 ; i < dmc->size ; i++) {
 		next_ptr->dbn = dmc->cache[i].dbn;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-		next_ptr->checksum = dmc->cache[i].checksum;
+		next_ptr->checksum = dmc->cache_cold[i].checksum;
 #endif
 		next_ptr->cache_state = dmc->cache[i].cache_state & 
 			(INVALID | VALID | DIRTY);
@@ -512,7 +526,7 @@ flashcache_writeback_create(struct cache_c *dmc, int force)
 				if (error) {
 					vfree((void *)header);
 					vfree((void *)meta_data_cacheblock);
-					vfree(dmc->cache);
+					flashcache_free_cache(dmc);
 					DMERR("flashcache_writeback_create: Could not write cache metadata block %lu error %d !",
 					      where.sector, error);
 					return 1;
@@ -536,7 +550,7 @@ flashcache_writeback_create(struct cache_c *dmc, int force)
 		if (error) {
 			vfree((void *)header);
 			vfree((void *)meta_data_cacheblock);
-			vfree(dmc->cache);
+			flashcache_free_cache(dmc);
 			DMERR("flashcache_writeback_create: Could not write cache metadata block %lu error %d !",
 			      where.sector, error);
 			return 1;		
@@ -574,7 +588,7 @@ flashcache_writeback_create(struct cache_c *dmc, int force)
 	error = flashcache_dm_io_sync_vm(dmc, &where, WRITE, header);
 	if (error) {
 		vfree((void *)header);
-		vfree(dmc->cache);
+		flashcache_free_cache(dmc);
 		DMERR("flashcache_writeback_create: Could not write cache superblock %lu error %d !",
 		      where.sector, error);
 		return 1;		
@@ -680,26 +694,24 @@ flashcache_writeback_load(struct cache_c *dmc)
 	DMINFO("flashcache_writeback_load: md_blocks = %d, md_sectors = %d, md_block_size = %d\n", 
 	       dmc->md_blocks, dmc->md_blocks * MD_SECTORS_PER_BLOCK(dmc), dmc->md_block_size);
 	data_size = dmc->size * dmc->block_size;
-	order = dmc->size * sizeof(struct cacheblock);
+	order = dmc->size * (sizeof(struct cacheblock) + sizeof(struct cacheblock_cold));
 	DMINFO("Allocate %luKB (%ldB per) mem for %lu-entry cache" \
 	       "(capacity:%luMB, associativity:%u, block size:%u " \
 	       "sectors(%uKB))",
-	       order >> 10, sizeof(struct cacheblock), dmc->size,
+	       order >> 10, sizeof(struct cacheblock) + sizeof(struct cacheblock_cold), dmc->size,
 	       (dmc->md_blocks * MD_SECTORS_PER_BLOCK(dmc) + data_size) >> (20-SECTOR_SHIFT), 
 	       dmc->assoc, dmc->block_size,
 	       dmc->block_size >> (10-SECTOR_SHIFT));
-	dmc->cache = (struct cacheblock *)vmalloc(order);
-	if (!dmc->cache) {
+	if (flashcache_alloc_cache(dmc)) {
 		DMERR("load_metadata: Unable to allocate memory");
 		vfree((void *)header);
 		return 1;
 	}
-	memset(dmc->cache, 0, order);
 	/* Read the metadata in large blocks and populate incore state */
 	meta_data_cacheblock = (struct flash_cacheblock *)vmalloc(METADATA_IO_BLOCKSIZE);
 	if (!meta_data_cacheblock) {
 		vfree((void *)header);
-		vfree(dmc->cache);
+		flashcache_free_cache(dmc);
 		DMERR("flashcache_writeback_load: Unable to allocate memory");
 		return 1;
 	}
@@ -716,7 +728,7 @@ flashcache_writeback_load(struct cache_c *dmc)
 		error = flashcache_dm_io_sync_vm(dmc, &where, READ, meta_data_cacheblock);
 		if (error) {
 			vfree((void *)header);
-			vfree(dmc->cache);
+			flashcache_free_cache(dmc);
 			vfree((void *)meta_data_cacheblock);
 			DMERR("flashcache_writeback_load: Could not read cache metadata block %lu error %d !",
 			      where.sector, error);
@@ -735,7 +747,7 @@ flashcache_writeback_load(struct cache_c *dmc)
 				next_ptr = (struct flash_cacheblock *)
 					((caddr_t)meta_data_cacheblock + MD_BLOCK_BYTES(dmc) * (j / MD_SLOTS_PER_BLOCK(dmc)));
 			}
-			dmc->cache[i].nr_queued = 0;
+			atomic_set(&dmc->cache[i].refs, 0);
 			/* 
 			 * If unclean shutdown, only the DIRTY blocks are loaded.
 			 */
@@ -750,12 +762,12 @@ flashcache_writeback_load(struct cache_c *dmc)
 				dmc->cache[i].dbn = next_ptr->dbn;
 #ifdef FLASHCACHE_DO_CHECKSUMS
 				if (clean_shutdown)
-					dmc->cache[i].checksum = next_ptr->checksum;
+					dmc->cache_cold[i].checksum = next_ptr->checksum;
 				else {
 					error = flashcache_read_compute_checksum(dmc, i, block);
 					if (error) {
 						vfree((void *)header);
-						vfree(dmc->cache);
+						flashcache_free_cache(dmc);
 						vfree((void *)meta_data_cacheblock);
 						DMERR("flashcache_writeback_load: Could not read cache metadata block %lu error %d !",
 						      dmc->cache[i].dbn, error);
@@ -767,7 +779,7 @@ flashcache_writeback_load(struct cache_c *dmc)
 				dmc->cache[i].cache_state = INVALID;
 				dmc->cache[i].dbn = 0;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-				dmc->cache[i].checksum = 0;
+				dmc->cache_cold[i].checksum = 0;
 #endif
 			}
 			next_ptr++;
@@ -815,7 +827,7 @@ flashcache_writeback_load(struct cache_c *dmc)
 	error = flashcache_dm_io_sync_vm(dmc, &where, WRITE, header);
 	if (error) {
 		vfree((void *)header);
-		vfree(dmc->cache);
+		flashcache_free_cache(dmc);
 		DMERR("flashcache_writeback_load: Could not write cache superblock %lu error %d !",
 		      where.sector, error);
 		return 1;		
@@ -844,6 +856,25 @@ flashcache_clean_all_sets(struct work_struct *work)
 		flashcache_clean_set(dmc, i, 0);
 }
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static void
+flashcache_wb_sweep_tick(void *data)
+{
+	struct cache_c *dmc = (struct cache_c *)data;
+#else
+static void
+flashcache_wb_sweep_tick(struct work_struct *work)
+{
+	struct cache_c *dmc = container_of(work, struct cache_c, 
+					   wb_sweep.work);
+#endif
+
+	flashcache_wb_sweep(dmc);
+	/* Device removal cancels the sweep, don't rearm behind its back */
+	if (!atomic_read(&dmc->remove_in_prog))
+		schedule_delayed_work(&dmc->wb_sweep, WB_SWEEP_TICK);
+}
+
 static int inline
 flashcache_get_dev(struct dm_target *ti, char *pth, struct dm_dev **dmd,
 		   char *dmc_dname, sector_t tilen)
@@ -1121,19 +1152,33 @@ init:
 	if (!dmc->cache_sets) {
 		ti->error = "Unable to allocate memory";
 		r = -ENOMEM;
-		vfree((void *)dmc->cache);
+		flashcache_free_cache(dmc);
 		goto bad3;
 	}				
 	memset(dmc->cache_sets, 0, order);
+	order = BITS_TO_LONGS(dmc->size) * sizeof(unsigned long);
+	dmc->dirty_map = (unsigned long *)vmalloc(order);
+	dmc->fallow_map = (unsigned long *)vmalloc(order);
+	if (!dmc->dirty_map || !dmc->fallow_map) {
+		ti->error = "Unable to allocate memory";
+		r = -ENOMEM;
+		flashcache_free_cache(dmc);
+		vfree((void *)dmc->cache_sets);
+		vfree((void *)dmc->dirty_map);
+		vfree((void *)dmc->fallow_map);
+		goto bad3;
+	}
+	memset(dmc->dirty_map, 0, order);
+	memset(dmc->fallow_map, 0, order);
 	for (i = 0 ; i < dmc->num_sets ; i++) {
 		dmc->cache_sets[i].set_fifo_next = i * dmc->assoc;
 		dmc->cache_sets[i].set_clean_next = i * dmc->assoc;
 		dmc->cache_sets[i].fallow_tstamp = jiffies;
 		dmc->cache_sets[i].fallow_next_cleaning = jiffies;
-		dmc->cache_sets[i].hotlist_lru_tail = FLASHCACHE_NULL;
-		dmc->cache_sets[i].hotlist_lru_head = FLASHCACHE_NULL;
-		dmc->cache_sets[i].warmlist_lru_tail = FLASHCACHE_NULL;
-		dmc->cache_sets[i].warmlist_lru_head = FLASHCACHE_NULL;
+		dmc->cache_sets[i].hotlist_lru_tail = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].hotlist_lru_head = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].warmlist_lru_tail = FLASHCACHE_LRU_NULL;
+		dmc->cache_sets[i].warmlist_lru_head = FLASHCACHE_LRU_NULL;
 		spin_lock_init(&dmc->cache_sets[i].set_spin_lock);
 	}
 	
@@ -1143,8 +1188,10 @@ init:
 	if (flashcache_diskclean_init(dmc)) {
 		ti->error = "Unable to allocate memory";
 		r = -ENOMEM;
-		vfree((void *)dmc->cache);
+		flashcache_free_cache(dmc);
 		vfree((void *)dmc->cache_sets);
+		vfree((void *)dmc->dirty_map);
+		vfree((void *)dmc->fallow_map);
 		goto bad3;
 	}		
 
@@ -1152,8 +1199,10 @@ init:
 		ti->error = "Unable to allocate memory";
 		r = -ENOMEM;
 		flashcache_diskclean_destroy(dmc);
-		vfree((void *)dmc->cache);
+		flashcache_free_cache(dmc);
 		vfree((void *)dmc->cache_sets);
+		vfree((void *)dmc->dirty_map);
+		vfree((void *)dmc->fallow_map);
 		goto bad3;
 	}		
 
@@ -1165,11 +1214,37 @@ init:
 			r = -ENOMEM;
 			flashcache_kcopy_destroy(dmc);
 			flashcache_diskclean_destroy(dmc);
-			vfree((void *)dmc->cache);
+			flashcache_free_cache(dmc);
 			vfree((void *)dmc->cache_sets);
+			vfree((void *)dmc->dirty_map);
+			vfree((void *)dmc->fallow_map);
 			goto bad3;
 		}		
 
+		/* Clusters as hash_block() places them, see flashcache_wb_sweep() */
+		if (dmc->on_ssd_version < 3 || dmc->disk_assoc == 0)
+			dmc->wb_cluster_shift = dmc->block_shift + dmc->assoc_shift;
+		else
+			dmc->wb_cluster_shift = dmc->disk_assoc_shift;
+		dmc->wb_nr_clusters = (unsigned long)(ti->len >> dmc->wb_cluster_shift) + 1;
+		order = BITS_TO_LONGS(dmc->wb_nr_clusters) * sizeof(unsigned long);
+		dmc->wb_cluster_map = (unsigned long *)vmalloc(order);
+		if (!dmc->wb_cluster_map) {
+			ti->error = "Unable to allocate memory";
+			r = -ENOMEM;
+			vfree((void *)dmc->md_blocks_buf);
+			flashcache_kcopy_destroy(dmc);
+			flashcache_diskclean_destroy(dmc);
+			flashcache_free_cache(dmc);
+			vfree((void *)dmc->cache_sets);
+			vfree((void *)dmc->dirty_map);
+			vfree((void *)dmc->fallow_map);
+			goto bad3;
+		}
+		memset(dmc->wb_cluster_map, 0, order);
+		dmc->wb_cursor = 0;
+		atomic_set(&dmc->wb_sweep_busy, 0);
+
 		for (i = 0 ; i < dmc->md_blocks - 1 ; i++) {
 			dmc->md_blocks_buf[i].nr_in_prog = 0;
 			dmc->md_blocks_buf[i].queued_updates = NULL;
@@ -1185,6 +1260,7 @@ init:
 	atomic_set(&dmc->pending_jobs_count, 0);
 	spin_lock_init(&dmc->ioctl_lock);
 	spin_lock_init(&dmc->cache_pending_q_spinlock);
+	dmc->disk_last_io = jiffies;
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0)
 	ti->split_io = dmc->block_size;
@@ -1221,6 +1297,8 @@ init:
 	dmc->sysctl_lru_hot_pct = 75;
 	dmc->sysctl_lru_promote_thresh = 2;
 	dmc->sysctl_new_style_write_merge = 0;
+	dmc->sysctl_wb_sweep_thresh = WB_SWEEP_THRESH_DEF;
+	dmc->sysctl_wb_sweep_idle_ms = WB_SWEEP_IDLE_MS;
 
 	/* Sequential i/o spotting */	
 	for (i = 0; i < SEQUENTIAL_TRACKER_QUEUE_DEPTH; i++) {
@@ -1249,13 +1327,15 @@ init:
 	wake_up_bit(&flashcache_control->synch_flags, FLASHCACHE_UPDATE_LIST);
 
 	for (i = 0 ; i < dmc->size ; i++) {
-		dmc->cache[i].hash_prev = FLASHCACHE_NULL;
 		dmc->cache[i].hash_next = FLASHCACHE_NULL;
 		if (dmc->cache[i].cache_state & VALID) {
 			flashcache_hash_insert(dmc, i);
 			atomic_inc(&dmc->cached_blocks);
 		}
 		if (dmc->cache[i].cache_state & DIRTY) {
+			__set_bit(i, dmc->dirty_map);
+			__set_bit(dmc->cache[i].dbn >> dmc->wb_cluster_shift,
+				  dmc->wb_cluster_map);
 			dmc->cache_sets[i / dmc->assoc].nr_dirty++;
 			atomic_inc(&dmc->nr_dirty);
 		}
@@ -1267,6 +1347,14 @@ init:
 #else
 	INIT_DELAYED_WORK(&dmc->delayed_clean, flashcache_clean_all_sets);
 #endif
+	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+		INIT_WORK(&dmc->wb_sweep, flashcache_wb_sweep_tick, dmc);
+#else
+		INIT_DELAYED_WORK(&dmc->wb_sweep, flashcache_wb_sweep_tick);
+#endif
+		schedule_delayed_work(&dmc->wb_sweep, WB_SWEEP_TICK);
+	}
 
 	dmc->whitelist_head = NULL;
 	dmc->whitelist_tail = NULL;
@@ -1275,15 +1363,17 @@ init:
 	dmc->num_whitelist_pids = 0;
 	dmc->num_blacklist_pids = 0;
 
-	flashcache_ctr_procfs(dmc);
-
 #ifdef PREFETCHD_ON
+	pfd_stat_add(dmc);
 	pfd_cache_add(dmc);
 #endif
 
+	flashcache_ctr_procfs(dmc);
+
 	return 0;
 
 bad3:
+	flashcache_job_queues_destroy(dmc);
 	dm_put_device(ti, dmc->cache_dev);
 bad2:
 	dm_put_device(ti, dmc->disk_dev);
@@ -1335,11 +1425,13 @@ flashcache_dtr_stats_print(struct cache_c *dmc)
 		       "\tmetadata dirties(%lu), metadata cleans(%lu)\n" \
 		       "\tmetadata batch(%lu) metadata ssd writes(%lu)\n" \
 		       "\tcleanings(%lu) fallow cleanings(%lu)\n"	\
+		       "\tsweep cleanings(%lu) sweep clusters(%lu)\n"	\
 		       "\tno room(%lu) front merge(%lu) back merge(%lu)\n",
 		       stats->enqueues, stats->pending_inval,
 		       stats->md_write_dirty, stats->md_write_clean,
 		       stats->md_write_batch, stats->md_ssd_writes,
 		       stats->cleanings, stats->fallow_cleanings, 
+		       stats->wb_sweep_ios, stats->wb_sweep_clusters,
 		       stats->noroom, stats->front_merge, stats->back_merge);
 	} else if (dmc->cache_mode == FLASHCACHE_WRITE_THROUGH) {
 		DMINFO("\tread hits(%lu), read hit percent(%d)\n"	\
@@ -1433,17 +1525,23 @@ flashcache_dtr(struct dm_target *ti)
 
 	flashcache_dtr_procfs(dmc);
 
+#ifdef PREFETCHD_ON
+	pfd_cache_remove(dmc);
+	pfd_stat_remove(dmc);
+#endif
+
 	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK) {
 		flashcache_sync_for_remove(dmc);
 		flashcache_writeback_md_store(dmc);
 	}
+	flashcache_job_queues_destroy(dmc);
 	if (!dmc->sysctl_fast_remove && atomic_read(&dmc->nr_dirty) > 0)
 		DMERR("Could not sync %d blocks to disk, cache still dirty", 
 		      atomic_read(&dmc->nr_dirty));
 	DMINFO("cache jobs %d, pending jobs %d", atomic_read(&nr_cache_jobs), 
 	       atomic_read(&nr_pending_jobs));
 	for (i = 0 ; i < dmc->size ; i++)
-		nr_queued += dmc->cache[i].nr_queued;
+		nr_queued += FLASHCACHE_NR_QUEUED(&dmc->cache[i]);
 	DMINFO("cache queued jobs %d", nr_queued);	
 	flashcache_dtr_stats_print(dmc);
 
@@ -1476,10 +1574,14 @@ flashcache_dtr(struct dm_target *ti)
 	flashcache_hash_destroy(dmc);
 	flashcache_diskclean_destroy(dmc);
 	flashcache_kcopy_destroy(dmc);
-	vfree((void *)dmc->cache);
+	flashcache_free_cache(dmc);
 	vfree((void *)dmc->cache_sets);
-	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK)
+	vfree((void *)dmc->dirty_map);
+	vfree((void *)dmc->fallow_map);
+	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK) {
 		vfree((void *)dmc->md_blocks_buf);
+		vfree((void *)dmc->wb_cluster_map);
+	}
 	flashcache_del_all_pids(dmc, FLASHCACHE_WHITELIST, 1);
 	flashcache_del_all_pids(dmc, FLASHCACHE_BLACKLIST, 1);
 	VERIFY(dmc->num_whitelist_pids == 0);
@@ -1530,12 +1632,14 @@ flashcache_status_info(struct cache_c *dmc, status_type_t type,
 		       "\tmetadata dirties(%lu), metadata cleans(%lu)\n" \
 		       "\tmetadata batch(%lu) metadata ssd writes(%lu)\n" \
 		       "\tcleanings(%lu) fallow cleanings(%lu)\n"	\
+		       "\tsweep cleanings(%lu) sweep clusters(%lu)\n"	\
 		       "\tno room(%lu) front merge(%lu) back merge(%lu)\n" \
 		       "\tforce_clean_block(%lu)\n",
 		       stats->enqueues, stats->pending_inval,
 		       stats->md_write_dirty, stats->md_write_clean,
 		       stats->md_write_batch, stats->md_ssd_writes,
 		       stats->cleanings, stats->fallow_cleanings, 
+		       stats->wb_sweep_ios, stats->wb_sweep_clusters,
 		       stats->noroom, stats->front_merge, stats->back_merge,
 		       stats->force_clean_block);
 	} else if (dmc->cache_mode == FLASHCACHE_WRITE_THROUGH) {
@@ -1763,7 +1867,9 @@ flashcache_sync_for_remove(struct cache_c *dmc)
 		/* Wait for all the dirty blocks to get written out, and any other IOs */
 		wait_event(dmc->destroyq, !atomic_read(&dmc->nr_jobs));
 		cancel_delayed_work(&dmc->delayed_clean);
+		cancel_delayed_work(&dmc->wb_sweep);
 		flush_scheduled_work();
+		flush_workqueue(dmc->kcached_wq);
 	} while (!dmc->sysctl_fast_remove && atomic_read(&dmc->nr_dirty) > 0);
 }
 
@@ -1888,11 +1994,6 @@ flashcache_init(void)
 	}
 #endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,22) */
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
-	INIT_WORK(&_kcached_wq, do_work, NULL);
-#else
-	INIT_WORK(&_kcached_wq, do_work);
-#endif
 	for (r = 0 ; r < 33 ; r++)
 		size_hist[r] = 0;
 	r = dm_register_target(&flashcache_target);
@@ -249,7 +249,7 @@ flashcache_del_all_pids(struct cache_c *dmc, int which_list, int force)
 static void
 flashcache_pid_expiry_list_locked(struct cache_c *dmc, int which_list)
 {
-	struct flashcache_cachectl_pid **head, **tail, *node;
+	struct flashcache_cachectl_pid **head, **tail, *node, *next;
 	
 	if (which_list == FLASHCACHE_WHITELIST) {
 		head = &dmc->whitelist_head;
@@ -258,7 +258,8 @@ flashcache_pid_expiry_list_locked(struct cache_c *dmc, int which_list)
 		head = &dmc->blacklist_head;
 		tail = &dmc->blacklist_tail;
 	}
-	for (node = *head ; node != NULL ; node = node->next) {
+	for (node = *head ; node != NULL ; node = next) {
+		next = node->next;
 		if (which_list == FLASHCACHE_WHITELIST)
 			VERIFY(dmc->num_whitelist_pids > 0);
 		else
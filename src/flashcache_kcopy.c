@@ -66,7 +66,6 @@
 #define DM_MAPIO_SUBMITTED	0
 #endif
 
-extern struct work_struct _kcached_wq;
 extern atomic_t nr_cache_jobs;
 
 /*
@@ -369,7 +368,6 @@ flashcache_copy_data_write_callback(unsigned long error, void *context)
 		job->dmc->flashcache_errors.disk_write_errors++;
 	job->error = error;
 	push_cleaning_write_complete(job);
-	schedule_work(&_kcached_wq);
 }
 
 void
@@ -431,10 +429,8 @@ flashcache_copy_data_read_callback(unsigned long error, void *context)
 		job->error = error;
 	}
 	spin_unlock_irqrestore(&job->copy_job_spinlock, flags);
-	if (do_write) {
+	if (do_write)
 		push_cleaning_read_complete(job);
-		schedule_work(&_kcached_wq);
-	}
 }
 
 static void
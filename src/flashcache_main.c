@@ -91,11 +91,11 @@ static int flashcache_inval_blocks(struct cache_c *dmc, struct bio *bio);
 static void flashcache_dirty_writeback(struct cache_c *dmc, int index);
 void flashcache_sync_blocks(struct cache_c *dmc);
 static void flashcache_start_uncached_io(struct cache_c *dmc, struct bio *bio);
+static void flashcache_uncached_io(struct cache_c *dmc, struct bio *bio);
 
 static void flashcache_setlocks_multiget(struct cache_c *dmc, struct bio *bio);
 static void flashcache_setlocks_multidrop(struct cache_c *dmc, struct bio *bio);
 
-extern struct work_struct _kcached_wq;
 extern u_int64_t size_hist[];
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,26)
@@ -198,6 +198,7 @@ flashcache_detect_fallow(struct cache_c *dmc, int index)
 		else if ((cacheblk->cache_state & DIRTY_FALLOW_2) == 0) {
 			dmc->cache_sets[index / dmc->assoc].dirty_fallow++;
 			cacheblk->cache_state |= DIRTY_FALLOW_2;
+			__set_bit(index, dmc->fallow_map);
 		}
 	}
 }
@@ -214,11 +215,63 @@ flashcache_clear_fallow(struct cache_c *dmc, int index)
 		if (cacheblk->cache_state & DIRTY_FALLOW_2) {
 			VERIFY(dmc->cache_sets[set].dirty_fallow > 0);
 			dmc->cache_sets[set].dirty_fallow--;
+			__clear_bit(index, dmc->fallow_map);
 		}
 		cacheblk->cache_state &= ~FALLOW_DOCLEAN;
 	}
 }
 
+/*
+ * Drop a read pin, see flashcache_block_claim(). IO that queued up
+ * behind the readers waits for the last one, which takes the block
+ * over and hands it to do_pending like any other IO completion would.
+ * job is the reader's job, freed here, or NULL if it never got one.
+ */
+static void
+flashcache_read_unpin(struct cache_c *dmc, int index, struct kcached_job *job)
+{
+	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cache_set *cache_set = &dmc->cache_sets[index / dmc->assoc];
+	unsigned long flags;
+
+	if (!flashcache_block_unpin(dmc, index))
+		goto out;
+	spin_lock_irqsave(&cache_set->set_spin_lock, flags);
+	if (FLASHCACHE_NR_QUEUED(cacheblk) == 0 || 
+	    (cacheblk->cache_state & BLOCK_IO_INPROG) ||
+	    !flashcache_block_claim(dmc, index)) {
+		/* Nothing waits for us, or whoever holds the block runs it */
+		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+		goto out;
+	}
+	VERIFY(cacheblk->cache_state & VALID);
+	cacheblk->cache_state |= CACHEREADINPROG;
+	flashcache_block_unclaim(dmc, index);
+	spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+	if (job == NULL) {
+		job = new_kcached_job(dmc, NULL, index);
+		if (unlikely(job == NULL)) {
+			DMERR("flashcache: Read unpin failed ! Can't allocate memory for pending IO, block %lu", 
+			      cacheblk->dbn);
+			spin_lock_irqsave(&cache_set->set_spin_lock, flags);
+			flashcache_free_pending_jobs(dmc, cacheblk, -EIO);
+			cacheblk->cache_state &= ~(BLOCK_IO_INPROG);
+			spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+			return;
+		}
+		job->action = READCACHE;
+		atomic_inc(&dmc->nr_jobs);
+	}
+	push_pending(job);
+	return;
+out:
+	if (job != NULL) {
+		flashcache_free_cache_job(job);
+		if (atomic_dec_and_test(&dmc->nr_jobs))
+			wake_up(&dmc->destroyq);
+	}
+}
+
 void 
 flashcache_io_callback(unsigned long error, void *context)
 {
@@ -260,7 +313,6 @@ flashcache_io_callback(unsigned long error, void *context)
 			/* Kick off the write to the cache */
 			job->action = READFILL;
 			push_io(job);
-			schedule_work(&_kcached_wq);
 			return;
 		} else {
 			disk_error = -EIO;
@@ -270,13 +322,11 @@ flashcache_io_callback(unsigned long error, void *context)
 	case READCACHE:
 		DPRINTK("flashcache_io_callback: READCACHE %d",
 			index);
-		spin_lock_irqsave(&cache_set->set_spin_lock, flags);
+		/* Read hits pin the block, they do not set CACHEREADINPROG */
 		if (unlikely(dmc->sysctl_error_inject & READCACHE_ERROR)) {
 			job->error = error = -EIO;
 			dmc->sysctl_error_inject &= ~READCACHE_ERROR;
 		}
-		VERIFY(cacheblk->cache_state & CACHEREADINPROG);
-		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
 		if (unlikely(error))
 			dmc->flashcache_errors.ssd_read_errors++;
 #ifdef FLASHCACHE_DO_CHECKSUMS
@@ -284,7 +334,7 @@ flashcache_io_callback(unsigned long error, void *context)
 			if (flashcache_validate_checksum(job)) {
 				DMERR("flashcache_io_callback: Checksum mismatch at disk offset %lu", 
 				      job->job_io_regions.disk.sector);
-				error = -EIO;
+				job->error = error = -EIO;
 			}
 		}
 #endif
@@ -372,16 +422,23 @@ flashcache_io_callback(unsigned long error, void *context)
 		flashcache_bio_endio(bio, error, dmc, &job->io_start_time);
 		job->bio = NULL;
 	}
+	if (job->action == READCACHE) {
+		/* Errors drop the pin in flashcache_do_pending_error() */
+		if (unlikely(error))
+			push_pending(job);
+		else
+			flashcache_read_unpin(dmc, index, job);
+		return;
+	}
 	/* 
 	 * The INPROG flag is still set. We cannot turn that off until all the pending requests
 	 * processed. We need to loop the pending requests back to a workqueue. We have the job,
 	 * add it to the pending req queue.
 	 */
 	spin_lock_irqsave(&cache_set->set_spin_lock, flags);
-	if (unlikely(error || cacheblk->nr_queued > 0)) {
+	if (unlikely(error || FLASHCACHE_NR_QUEUED(cacheblk) > 0)) {
 		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
 		push_pending(job);
-		schedule_work(&_kcached_wq);
 	} else {
 		cacheblk->cache_state &= ~BLOCK_IO_INPROG;
 		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
@@ -404,12 +461,12 @@ flashcache_free_pending_jobs(struct cache_c *dmc, struct cacheblock *cacheblk,
 	while (freelist != NULL) {
 		pending_job = freelist;
 		freelist = pending_job->next;
-		VERIFY(cacheblk->nr_queued > 0);
-		cacheblk->nr_queued--;
+		VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) > 0);
+		atomic_sub(FLASHCACHE_QUEUED_ONE, &cacheblk->refs);
 		flashcache_bio_endio(pending_job->bio, error, dmc, NULL);
 		flashcache_free_pending_job(pending_job);
 	}
-	VERIFY(cacheblk->nr_queued == 0);
+	VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) == 0);
 }
 
 /* 
@@ -434,6 +491,23 @@ flashcache_do_pending_error(struct kcached_job *job)
 		      job->error, job->job_io_regions.disk.sector, job->action);
 	}
 	spin_lock_irq(&cache_set->set_spin_lock);
+	if (job->action == READCACHE) {
+		/* 
+		 * A read hit only holds a pin. The last reader out takes
+		 * the block over to invalidate it, the others just send
+		 * their read to disk.
+		 */
+		if (!flashcache_block_unpin(dmc, job->index) ||
+		    (cacheblk->cache_state & (VALID | BLOCK_IO_INPROG)) != VALID ||
+		    !flashcache_block_claim(dmc, job->index)) {
+			spin_unlock_irq(&cache_set->set_spin_lock);
+			if (bio != NULL)
+				flashcache_start_uncached_io(dmc, bio);
+			goto out;
+		}
+		cacheblk->cache_state |= CACHEREADINPROG;
+		flashcache_block_unclaim(dmc, job->index);
+	}
 	VERIFY(cacheblk->cache_state & VALID);
 	/* Invalidate block if possible */
 	if ((cacheblk->cache_state & DIRTY) == 0) {
@@ -456,10 +530,10 @@ flashcache_do_pending_error(struct kcached_job *job)
 		VERIFY(dmc->cache_mode != FLASHCACHE_WRITE_BACK);
 		pjob_list = flashcache_deq_pending(dmc, cacheblk - &dmc->cache[0]);
 		for (pjob = pjob_list ; pjob != NULL ; pjob = pjob->next) {
-			VERIFY(cacheblk->nr_queued > 0);
-			cacheblk->nr_queued--;
+			VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) > 0);
+			atomic_sub(FLASHCACHE_QUEUED_ONE, &cacheblk->refs);
 		}
-		VERIFY(cacheblk->nr_queued == 0);
+		VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) == 0);
 	} else
 		flashcache_free_pending_jobs(dmc, cacheblk, job->error);
 	spin_unlock_irq(&cache_set->set_spin_lock);
@@ -481,6 +555,7 @@ flashcache_do_pending_error(struct kcached_job *job)
 			flashcache_free_pending_job(pjob);
 		}
 	}
+out:
 	flashcache_free_cache_job(job);
 	if (atomic_dec_and_test(&dmc->nr_jobs))
 		wake_up(&dmc->destroyq);
@@ -526,8 +601,8 @@ flashcache_do_pending_noerror(struct kcached_job *job)
 		freelist = pending_job->next;
 		flashcache_setlocks_multiget(dmc, pending_job->bio);
 		VERIFY(!(cacheblk->cache_state & DIRTY));
-		VERIFY(cacheblk->nr_queued > 0);
-		cacheblk->nr_queued--;
+		VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) > 0);
+		atomic_sub(FLASHCACHE_QUEUED_ONE, &cacheblk->refs);
 		if (pending_job->action == INVALIDATE) {
 			DPRINTK("flashcache_do_pending: INVALIDATE  %llu",
 				next_job->bio->bi_iter.bi_sector);
@@ -554,7 +629,7 @@ flashcache_do_pending_noerror(struct kcached_job *job)
 		flashcache_free_pending_job(pending_job);
 	}
  	spin_lock_irq(&cache_set->set_spin_lock);
-	VERIFY(cacheblk->nr_queued == 0);
+	VERIFY(FLASHCACHE_NR_QUEUED(cacheblk) == 0);
 	cacheblk->cache_state &= ~(BLOCK_IO_INPROG);
 	flashcache_invalid_insert(dmc, index);
  	spin_unlock_irq(&cache_set->set_spin_lock);
@@ -735,7 +810,6 @@ flashcache_md_write_callback(unsigned long error, void *context)
 	else
 		job->error = 0;
 	push_md_complete(job);
-	schedule_work(&_kcached_wq);
 }
 
 static int
@@ -809,7 +883,7 @@ flashcache_md_write_kickoff(struct kcached_job *job)
 	     i++, md_block_ix++) {
 		md_block[i].dbn = dmc->cache[md_block_ix].dbn;
 #ifdef FLASHCACHE_DO_CHECKSUMS
-		md_block[i].checksum = dmc->cache[md_block_ix].checksum;
+		md_block[i].checksum = dmc->cache_cold[md_block_ix].checksum;
 #endif
 		md_block[i].cache_state = 
 			dmc->cache[md_block_ix].cache_state & (VALID | INVALID | DIRTY);
@@ -888,6 +962,9 @@ flashcache_md_write_done(struct kcached_job *job)
 			}
 			if (likely(job->error == 0)) {
 				if ((cacheblk->cache_state & DIRTY) == 0) {
+					__set_bit(index, dmc->dirty_map);
+					set_bit(cacheblk->dbn >> dmc->wb_cluster_shift,
+						dmc->wb_cluster_map);
 					cache_set->nr_dirty++;
 					atomic_inc(&dmc->nr_dirty);
 				}
@@ -896,7 +973,7 @@ flashcache_md_write_done(struct kcached_job *job)
 			} else
 				dmc->flashcache_errors.ssd_write_errors++;
 			flashcache_bio_endio(job->bio, job->error, dmc, &job->io_start_time);
-			if (job->error || cacheblk->nr_queued > 0) {
+			if (job->error || FLASHCACHE_NR_QUEUED(cacheblk) > 0) {
 				if (job->error) {
 					DMERR("flashcache: WRITE: Cache metadata write failed ! error %d block %lu", 
 					      job->error, cacheblk->dbn);
@@ -925,6 +1002,7 @@ flashcache_md_write_done(struct kcached_job *job)
 			if (likely(job->error == 0)) {
 				dmc->flashcache_stats.md_write_clean++;
 				cacheblk->cache_state &= ~DIRTY;
+				__clear_bit(index, dmc->dirty_map);
 				VERIFY(cache_set->nr_dirty > 0);
 				VERIFY(atomic_read(&dmc->nr_dirty) > 0);
 				cache_set->nr_dirty--;
@@ -935,7 +1013,7 @@ flashcache_md_write_done(struct kcached_job *job)
 			VERIFY(atomic_read(&dmc->clean_inprog) > 0);
 			cache_set->clean_inprog--;
 			atomic_dec(&dmc->clean_inprog);
-			if (job->error || cacheblk->nr_queued > 0) {
+			if (job->error || FLASHCACHE_NR_QUEUED(cacheblk) > 0) {
 				if (job->error) {
 					DMERR("flashcache: CLEAN: Cache metadata write failed ! error %d block %lu", 
 					      job->error, cacheblk->dbn);
@@ -950,9 +1028,10 @@ flashcache_md_write_done(struct kcached_job *job)
 					wake_up(&dmc->destroyq);
 			}
 			/* Kick off more cleanings */
-			if (action == WRITEDISK)
+			if (action == WRITEDISK) {
 				flashcache_clean_set(dmc, set, 0);
-			else
+				flashcache_wb_sweep(dmc);
+			} else
 				flashcache_sync_blocks(dmc);
 			dmc->flashcache_stats.cleanings++;
 			if (action == WRITEDISK_SYNC)
@@ -1025,7 +1104,6 @@ flashcache_md_write(struct kcached_job *job)
 		 * deadlock.
 		 */
 		push_md_io(job);
-		schedule_work(&_kcached_wq);
 	}
 }
 
@@ -1156,7 +1234,8 @@ flashcache_dirty_writeback(struct cache_c *dmc, int index)
  * set and across the cache, which this function enforces.
  *
  * 1) Select the n blocks that we want to clean (choosing whatever policy), 
- *    sort them.
+ *    sort them. Fallow and FIFO candidates come off the set's bits in 
+ *    dmc->fallow_map and dmc->dirty_map, LRU ones off the LRU lists.
  * 2) Then sweep the entire set looking for other DIRTY blocks that can be 
  *    tacked onto any of these blocks to form larger contigous writes. 
  *    The idea here is that if you are going to do a write anyway, then we 
@@ -1215,20 +1294,21 @@ flashcache_clean_set(struct cache_c *dmc, int set, int force_clean_blocks)
 	 * a sweep through the set to detect (mark) fallow blocks.
 	 */
 	if (dmc->sysctl_fallow_delay && time_after(jiffies, cache_set->fallow_tstamp)) {
-		for (i = start_index ; i < end_index ; i++)
+		for (i = find_next_bit(dmc->dirty_map, end_index, start_index) ;
+		     i < end_index ;
+		     i = find_next_bit(dmc->dirty_map, end_index, i + 1))
 			flashcache_detect_fallow(dmc, i);
 		cache_set->fallow_tstamp = jiffies + dmc->sysctl_fallow_delay * HZ;
 	}
 	/* If there are any dirty fallow blocks, clean them first */
-	for (i = start_index ; 
+	for (i = find_next_bit(dmc->fallow_map, end_index, start_index) ; 
 	     (dmc->sysctl_fallow_delay > 0 &&
 	      cache_set->dirty_fallow > 0 &&
 	      time_after(jiffies, cache_set->fallow_next_cleaning) &&
 	      i < end_index) ; 
-	     i++) {
+	     i = find_next_bit(dmc->fallow_map, end_index, i + 1)) {
 		cacheblk = &dmc->cache[i];
-		if (!(cacheblk->cache_state & DIRTY_FALLOW_2))
-			continue;
+		VERIFY(cacheblk->cache_state & DIRTY_FALLOW_2);
 		if (!flashcache_can_clean(dmc, cache_set, nr_writes)) {
 			/*
 			 * There are fallow blocks that need cleaning, but we 
@@ -1277,9 +1357,13 @@ flashcache_clean_set(struct cache_c *dmc, int set, int force_clean_blocks)
 	if (dmc->sysctl_reclaim_policy == FLASHCACHE_FIFO) {
 		i = cache_set->set_clean_next;
 		DPRINTK("flashcache_clean_set: Set %d", set);
-		while (scanned < dmc->assoc &&
+		/* Visit each dirty block at most once, starting at set_clean_next */
+		while (scanned < cache_set->nr_dirty &&
 		       flashcache_can_clean(dmc, cache_set, nr_writes) &&
 		       nr_writes < threshold_clean) {
+			i = find_next_bit(dmc->dirty_map, end_index, i);
+			if (i == end_index)
+				i = find_next_bit(dmc->dirty_map, end_index, start_index);
 			cacheblk = &dmc->cache[i];
 			if ((cacheblk->cache_state & (DIRTY | BLOCK_IO_INPROG)) == DIRTY) {
 				cacheblk->cache_state |= DISKWRITEINPROG;
@@ -1303,7 +1387,7 @@ flashcache_clean_set(struct cache_c *dmc, int set, int force_clean_blocks)
 				lru_rel_index = cache_set->warmlist_lru_head;
 			else
 				lru_rel_index = cache_set->hotlist_lru_head;
-			while (lru_rel_index != FLASHCACHE_NULL &&
+			while (lru_rel_index != FLASHCACHE_LRU_NULL &&
 			       flashcache_can_clean(dmc, cache_set, nr_writes) &&
 			       nr_writes < threshold_clean) {
 				cacheblk = &dmc->cache[lru_rel_index + start_index];
@@ -1321,7 +1405,7 @@ flashcache_clean_set(struct cache_c *dmc, int set, int force_clean_blocks)
 				 */
 				if (force_clean_blocks > 0 && scanned == force_clean_blocks)
 					goto out;
-				lru_rel_index = cacheblk->lru_next;
+				lru_rel_index = dmc->cache_cold[lru_rel_index + start_index].lru_next;
 			}
 		}
 	}
@@ -1356,51 +1440,235 @@ out:
 	flashcache_diskclean_free(dmc, writes_list, set_dirty_list);
 }
 
+/*
+ * Device wide writeback, in disk order.
+ * flashcache_clean_set() cleans one set at a time, and since sets are
+ * scattered over the disk, the disk sees cleanings as random writes.
+ * The sweep instead walks dmc->wb_cluster_map in ascending disk offset
+ * (a one way elevator, wrapping at the end of the disk), writing back
+ * all the idle dirty blocks of each cluster, sorted by dbn. A cluster
+ * lives in exactly one set, so one set lock covers it.
+ * It runs while the device is over the wb_sweep_thresh_pct dirty
+ * threshold, or once the disk has seen no foreground IO for
+ * wb_sweep_idle_ms, within the max_clean_ios_total budget. It is
+ * stepped from a periodic work and from cleaning completions.
+ * The per set cleaning stays as the backstop for sets over their own
+ * dirty threshold.
+ */
+static int
+flashcache_wb_sweep_due(struct cache_c *dmc)
+{
+	int nr_dirty = atomic_read(&dmc->nr_dirty);
+
+	if (nr_dirty == 0)
+		return 0;
+	if (dmc->sysctl_wb_sweep_thresh > 0 &&
+	    (u_int64_t)nr_dirty * 100 >= (u_int64_t)dmc->size * dmc->sysctl_wb_sweep_thresh)
+		return 1;
+	if (dmc->sysctl_wb_sweep_idle_ms > 0 &&
+	    time_after(jiffies, ACCESS_ONCE(dmc->disk_last_io) + 
+		       msecs_to_jiffies(dmc->sysctl_wb_sweep_idle_ms)))
+		return 1;
+	return 0;
+}
+
+/*
+ * Mark the idle dirty blocks of a cluster DISKWRITEINPROG and return them 
+ * in writes_list, sorted by dbn. At most budget blocks are marked, and no
+ * more than the set's max_clean_ios_set allows. *cut_short says blocks
+ * were left for lack of budget. Drops the cluster from the sweep when it
+ * has no dirty blocks left.
+ */
+static int
+flashcache_wb_sweep_cluster(struct cache_c *dmc, unsigned long cluster,
+			    struct dbn_index_pair *writes_list,
+			    struct dbn_index_pair *set_dirty_list,
+			    int budget, int *cut_short)
+{
+	int set = hash_block(dmc, (sector_t)cluster << dmc->wb_cluster_shift);
+	struct cache_set *cache_set = &dmc->cache_sets[set];
+	int start_index = set * dmc->assoc;
+	int end_index = start_index + dmc->assoc;
+	struct cacheblock *cacheblk;
+	int nr_writes = 0, nr_busy = 0, i;
+
+	*cut_short = 0;
+	spin_lock_irq(&cache_set->set_spin_lock);
+	for (i = find_next_bit(dmc->dirty_map, end_index, start_index) ;
+	     i < end_index ;
+	     i = find_next_bit(dmc->dirty_map, end_index, i + 1)) {
+		cacheblk = &dmc->cache[i];
+		if ((cacheblk->dbn >> dmc->wb_cluster_shift) != cluster)
+			continue;
+		if (cacheblk->cache_state & BLOCK_IO_INPROG) {
+			nr_busy++;
+			continue;
+		}
+		if (nr_writes >= budget ||
+		    cache_set->clean_inprog + nr_writes >= dmc->max_clean_ios_set) {
+			*cut_short = 1;
+			break;
+		}
+		cacheblk->cache_state |= DISKWRITEINPROG;
+		flashcache_clear_fallow(dmc, i);
+		writes_list[nr_writes].dbn = cacheblk->dbn;
+		writes_list[nr_writes].index = i;
+		nr_writes++;
+	}
+	if (nr_writes > 0) {
+		flashcache_merge_writes(dmc, writes_list, set_dirty_list, &nr_writes, set);
+		dmc->flashcache_stats.wb_sweep_ios += nr_writes;
+		dmc->flashcache_stats.wb_sweep_clusters++;
+		if (nr_writes < FLASHCACHE_WRITE_CLUST_HIST_SIZE)
+			dmc->write_clust_hist[nr_writes]++;
+		else
+			dmc->write_clust_hist_ovf++;
+	} else if (nr_busy == 0 && !*cut_short)
+		clear_bit(cluster, dmc->wb_cluster_map);
+	spin_unlock_irq(&cache_set->set_spin_lock);
+	return nr_writes;
+}
+
+void
+flashcache_wb_sweep(struct cache_c *dmc)
+{
+	struct dbn_index_pair *writes_list = NULL;
+	struct dbn_index_pair *set_dirty_list = NULL;
+	unsigned long cluster;
+	int nr_writes, visited, budget, cut_short, i;
+
+	if (dmc->cache_mode != FLASHCACHE_WRITE_BACK)
+		return;
+	if (atomic_read(&dmc->remove_in_prog) || !flashcache_wb_sweep_due(dmc))
+		return;
+	/* One sweeper at a time, a loser leaves the work to the winner */
+	if (atomic_cmpxchg(&dmc->wb_sweep_busy, 0, 1) != 0)
+		return;
+	if (flashcache_diskclean_alloc(dmc, &writes_list, &set_dirty_list)) {
+		dmc->flashcache_errors.memory_alloc_errors++;
+		goto out;
+	}
+	cluster = dmc->wb_cursor;
+	for (visited = 0 ; visited < WB_SWEEP_MAX_CLUSTERS ; visited++) {
+		budget = dmc->max_clean_ios_total - atomic_read(&dmc->clean_inprog);
+		if (budget <= 0)
+			break;
+		cluster = find_next_bit(dmc->wb_cluster_map, dmc->wb_nr_clusters, cluster);
+		if (cluster >= dmc->wb_nr_clusters) {
+			/* End of the disk, the next step starts over at the lowest offset */
+			cluster = 0;
+			break;
+		}
+		nr_writes = flashcache_wb_sweep_cluster(dmc, cluster, 
+							writes_list, set_dirty_list,
+							budget, &cut_short);
+		/* See flashcache_clean_set() for why this is not flashcache_copy_data() */
+		for (i = 0 ; i < nr_writes ; i++)
+			flashcache_dirty_writeback(dmc, writes_list[i].index);
+		/* Out of budget, the next step picks up the rest of this cluster */
+		if (cut_short)
+			break;
+		cluster++;
+	}
+	dmc->wb_cursor = cluster;
+	flashcache_diskclean_free(dmc, writes_list, set_dirty_list);
+out:
+	atomic_set(&dmc->wb_sweep_busy, 0);
+}
+
+/* Read a hit from the SSD, the caller has pinned the block */
+static void
+flashcache_read_hit_issue(struct cache_c *dmc, struct bio* bio, int index)
+{
+	struct kcached_job *job;
+
+	DPRINTK("Cache read: Block %llu(%lu), index = %d:%s",
+		bio->bi_iter.bi_sector, bio->bi_iter.bi_size, index, "CACHE HIT");
+	job = new_kcached_job(dmc, bio, index);
+	if (unlikely(dmc->sysctl_error_inject & READ_HIT_JOB_ALLOC_FAIL)) {
+		if (job)
+			flashcache_free_cache_job(job);
+		job = NULL;
+		dmc->sysctl_error_inject &= ~READ_HIT_JOB_ALLOC_FAIL;
+	}
+	if (unlikely(job == NULL)) {
+		/* 
+		 * We have a read hit, and can't allocate a job.
+		 * Dropping the pin runs any IO queued behind us.
+		 */
+		DMERR("flashcache: Read (hit) failed ! Can't allocate memory for cache IO, block %lu", 
+		      dmc->cache[index].dbn);
+		flashcache_bio_endio(bio, -EIO, dmc, NULL);
+		flashcache_read_unpin(dmc, index, NULL);
+	} else {
+		job->action = READCACHE; /* Fetch data from cache */
+		atomic_inc(&dmc->nr_jobs);
+		dmc->flashcache_stats.ssd_reads++;
+		dm_io_async_bvec(1, &job->job_io_regions.cache, READ,
+				 bio,
+				 flashcache_io_callback, job);
+	}
+}
+
+/*
+ * Read hit without the set lock. Most reads of a hot working set end
+ * here. Anything that is not a plain hit on an idle block (a miss, IO
+ * in progress or queued on the block, or a hit that has to change the
+ * block's state) takes the locked path. Returns 0 in that case.
+ */
+static int
+flashcache_read_hit_nolock(struct cache_c *dmc, struct bio *bio)
+{
+	sector_t dbn = bio->bi_iter.bi_sector;
+	int set = hash_block(dmc, dbn);
+	struct cache_set *cache_set = &dmc->cache_sets[set];
+	struct cacheblock *cacheblk;
+	unsigned long flags;
+	u_int16_t state;
+	int index;
+
+	index = flashcache_hash_lookup_nolock(dmc, set, dbn);
+	if (index == -1 || !flashcache_block_pin(dmc, index))
+		return 0;
+	/* The pin orders these after whoever last claimed the block */
+	cacheblk = &dmc->cache[index];
+	state = ACCESS_ONCE(cacheblk->cache_state);
+	smp_rmb();
+	if ((state & (VALID | BLOCK_IO_INPROG | FALLOW_DOCLEAN | PFD_ADMITTED)) != VALID ||
+	    FLASHCACHE_NR_QUEUED(cacheblk) != 0 ||
+	    cacheblk->dbn != dbn) {
+		flashcache_read_unpin(dmc, index, NULL);
+		return 0;
+	}
+	/* LRU order is only a hint, don't wait for it */
+	if (dmc->sysctl_reclaim_policy == FLASHCACHE_LRU &&
+	    spin_trylock_irqsave(&cache_set->set_spin_lock, flags)) {
+		flashcache_lru_accessed(dmc, index);
+		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+	}
+	dmc->flashcache_stats.read_hits++;
+	dmc->flashcache_stats.read_hits_nolock++;
+	flashcache_read_hit_issue(dmc, bio, index);
+	return 1;
+}
+
 static void
 flashcache_read_hit(struct cache_c *dmc, struct bio* bio, int index)
 {
 	struct cacheblock *cacheblk;
 	struct pending_job *pjob;
-	int set = index / dmc->assoc;
 
 	cacheblk = &dmc->cache[index];
 	/* If block is busy, queue IO pending completion of in-progress IO */
-	if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (cacheblk->nr_queued == 0)) {
-		struct kcached_job *job;
-			
-		cacheblk->cache_state |= CACHEREADINPROG;
+	if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (FLASHCACHE_NR_QUEUED(cacheblk) == 0) &&
+	    flashcache_block_pin(dmc, index)) {
+#ifdef PREFETCHD_ON
+		/* Read on demand, it has earned its place */
+		flashcache_pfd_clear_admitted(dmc, index);
+#endif
 		dmc->flashcache_stats.read_hits++;
 		flashcache_setlocks_multidrop(dmc, bio);
-		DPRINTK("Cache read: Block %llu(%lu), index = %d:%s",
-			bio->bi_iter.bi_sector, bio->bi_iter.bi_size, index, "CACHE HIT");
-		job = new_kcached_job(dmc, bio, index);
-		if (unlikely(dmc->sysctl_error_inject & READ_HIT_JOB_ALLOC_FAIL)) {
-			if (job)
-				flashcache_free_cache_job(job);
-			job = NULL;
-			dmc->sysctl_error_inject &= ~READ_HIT_JOB_ALLOC_FAIL;
-		}
-		if (unlikely(job == NULL)) {
-			/* 
-			 * We have a read hit, and can't allocate a job.
-			 * Since we dropped the spinlock, we have to drain any 
-			 * pending jobs.
-			 */
-			DMERR("flashcache: Read (hit) failed ! Can't allocate memory for cache IO, block %lu", 
-			      cacheblk->dbn);
-			flashcache_bio_endio(bio, -EIO, dmc, NULL);
-			spin_lock_irq(&dmc->cache_sets[set].set_spin_lock);
-			flashcache_free_pending_jobs(dmc, cacheblk, -EIO);
-			cacheblk->cache_state &= ~(BLOCK_IO_INPROG);
-			spin_unlock_irq(&dmc->cache_sets[set].set_spin_lock);
-		} else {
-			job->action = READCACHE; /* Fetch data from cache */
-			atomic_inc(&dmc->nr_jobs);
-			dmc->flashcache_stats.ssd_reads++;
-			dm_io_async_bvec(1, &job->job_io_regions.cache, READ,
-					 bio,
-					 flashcache_io_callback, job);
-		}
+		flashcache_read_hit_issue(dmc, bio, index);
 	} else {
 		pjob = flashcache_alloc_pending_job(dmc);
 		if (unlikely(dmc->sysctl_error_inject & READ_HIT_PENDING_JOB_ALLOC_FAIL)) {
@@ -1456,6 +1724,7 @@ flashcache_read_miss(struct cache_c *dmc, struct bio* bio,
 		job->action = READDISK; /* Fetch data from the source device */
 		atomic_inc(&dmc->nr_jobs);
 		dmc->flashcache_stats.disk_reads++;
+		dmc->disk_last_io = jiffies;
 		dm_io_async_bvec(1, &job->job_io_regions.disk, READ,
 				 bio,
 				 flashcache_io_callback, job);
@@ -1464,8 +1733,13 @@ flashcache_read_miss(struct cache_c *dmc, struct bio* bio,
 	}
 }
 
-static void
-flashcache_read(struct cache_c *dmc, struct bio *bio)
+/*
+ * Read bio through the SSD cache. The prefetch buffer has already been
+ * looked up by the caller. Reads that are not a single whole block,
+ * and the parts of them the prefetch buffer did not hold, go to disk.
+ */
+void
+flashcache_read_cache(struct cache_c *dmc, struct bio *bio)
 {
 	int index;
 	int res;
@@ -1473,17 +1747,17 @@ flashcache_read(struct cache_c *dmc, struct bio *bio)
 	int queued;
 	unsigned long flags;
 
-#ifdef PREFETCHD_ON
-	struct pfd_stat_info pfd_stat_info;
-	pfd_stat_update(dmc, bio, &pfd_stat_info);
-	if (pfd_cache_handle_bio(dmc, bio))
+	if (to_sector(bio->bi_iter.bi_size) != dmc->block_size) {
+		flashcache_uncached_io(dmc, bio);
 		return;
-#endif
-	
+	}
+
 	DPRINTK("Got a %s for %llu (%u bytes)",
 	        (bio_rw(bio) == READ ? "READ":"READA"), 
 		bio->bi_iter.bi_sector, bio->bi_iter.bi_size);
 
+	if (flashcache_read_hit_nolock(dmc, bio))
+		return;
 	flashcache_setlocks_multiget(dmc, bio);
 	res = flashcache_lookup(dmc, bio, &index);
 	/* Cache Read Hit case */
@@ -1492,9 +1766,6 @@ flashcache_read(struct cache_c *dmc, struct bio *bio)
 		if ((cacheblk->cache_state & VALID) && 
 		    (cacheblk->dbn == bio->bi_iter.bi_sector)) {
 			flashcache_read_hit(dmc, bio, index);
-#ifdef PREFETCHD_ON
-			pfd_cache_prefetch(dmc, &pfd_stat_info);
-#endif
 			return;
 		}
 	}
@@ -1542,9 +1813,6 @@ flashcache_read(struct cache_c *dmc, struct bio *bio)
 			flashcache_clean_set(dmc, hash_block(dmc, bio->bi_iter.bi_sector), 0);
 		/* Start uncached IO */
 		flashcache_start_uncached_io(dmc, bio);
-#ifdef PREFETCHD_ON
-		pfd_cache_prefetch(dmc, &pfd_stat_info);
-#endif
 		return;
 	} else 
 		spin_unlock_irqrestore(&dmc->ioctl_lock, flags);
@@ -1553,7 +1821,16 @@ flashcache_read(struct cache_c *dmc, struct bio *bio)
 	 * (res == INVALID) Cache Miss 
 	 * And we found cache blocks to replace
 	 * Claim the cache blocks before giving up the spinlock
+	 * Readers may still be on it, even if it is INVALID. Go to
+	 * disk rather than wait for them.
 	 */
+	if (!flashcache_block_claim(dmc, index)) {
+		if (dmc->cache[index].cache_state == INVALID)
+			flashcache_invalid_insert(dmc, index);
+		flashcache_setlocks_multidrop(dmc, bio);
+		flashcache_start_uncached_io(dmc, bio);
+		return;
+	}
 	if (dmc->cache[index].cache_state & VALID) {
 		dmc->flashcache_stats.replace++;
 		/* 
@@ -1567,13 +1844,142 @@ flashcache_read(struct cache_c *dmc, struct bio *bio)
 	dmc->cache[index].cache_state = VALID | DISKREADINPROG;
 	dmc->cache[index].dbn = bio->bi_iter.bi_sector;
 	flashcache_hash_insert(dmc, index);
+	flashcache_block_unclaim(dmc, index);
 	flashcache_setlocks_multidrop(dmc, bio);
 
 	DPRINTK("Cache read: Block %llu(%lu), index = %d:%s",
 		bio->bi_iter.bi_sector, bio->bi_iter.bi_size, index, "CACHE MISS & REPLACE");
 	flashcache_read_miss(dmc, bio, index);
+}
+
 #ifdef PREFETCHD_ON
+/*
+ * Claim a cache block for dbn, which the prefetcher has read from disk,
+ * the same way a read miss does. The caller writes the block to the
+ * SSD and then calls flashcache_pfd_admit_done(). Blocks admitted this
+ * way hold at most pfd_admit_set ways of a set; past that they only
+ * replace each other, so a scan cannot push the working set out.
+ * Returns NULL when the block is not admitted.
+ */
+struct kcached_job *
+flashcache_pfd_admit(struct cache_c *dmc, sector_t dbn)
+{
+	struct bio tmp_bio;
+	struct kcached_job *job;
+	struct cacheblock *cacheblk;
+	struct cache_set *cache_set;
+	int index;
+	int res;
+
+	if (dmc->pfd_admit_set == 0 || dmc->bypass_cache || dmc->write_only_cache)
+		return NULL;
+
+	tmp_bio.bi_iter.bi_sector = dbn;
+	tmp_bio.bi_iter.bi_size = to_bytes(dmc->block_size);
+	flashcache_setlocks_multiget(dmc, &tmp_bio);
+	res = flashcache_lookup(dmc, &tmp_bio, &index);
+	if (res != INVALID) {
+		/* Cached already, or no room */
+		flashcache_setlocks_multidrop(dmc, &tmp_bio);
+		return NULL;
+	}
+	cacheblk = &dmc->cache[index];
+	cache_set = &dmc->cache_sets[index / dmc->assoc];
+	if ((cache_set->nr_pfd_admitted >= dmc->pfd_admit_set &&
+	     !(cacheblk->cache_state & PFD_ADMITTED)) ||
+	    !flashcache_block_claim(dmc, index)) {
+		if (cacheblk->cache_state == INVALID)
+			flashcache_invalid_insert(dmc, index);
+		flashcache_setlocks_multidrop(dmc, &tmp_bio);
+		return NULL;
+	}
+	if (cacheblk->cache_state & VALID) {
+		dmc->flashcache_stats.replace++;
+		flashcache_hash_remove(dmc, index);
+	} else
+		atomic_inc(&dmc->cached_blocks);
+	cacheblk->cache_state = VALID | DISKREADINPROG | PFD_ADMITTED;
+	cacheblk->dbn = dbn;
+	flashcache_hash_insert(dmc, index);
+	flashcache_block_unclaim(dmc, index);
+	cache_set->nr_pfd_admitted++;
+	flashcache_setlocks_multidrop(dmc, &tmp_bio);
+
+	job = new_kcached_job(dmc, NULL, index);
+	if (unlikely(job == NULL)) {
+		DMERR("flashcache: Prefetch admit failed ! Can't allocate memory for cache IO, block %lu", 
+		      cacheblk->dbn);
+		atomic_dec(&dmc->cached_blocks);
+		spin_lock_irq(&cache_set->set_spin_lock);
+		flashcache_hash_remove(dmc, index);
+		cacheblk->cache_state &= ~VALID;
+		cacheblk->cache_state |= INVALID;
+		flashcache_free_pending_jobs(dmc, cacheblk, -EIO);
+		cacheblk->cache_state &= ~(BLOCK_IO_INPROG);
+		flashcache_invalid_insert(dmc, index);
+		spin_unlock_irq(&cache_set->set_spin_lock);
+		return NULL;
+	}
+	job->action = READFILL;
+	atomic_inc(&dmc->nr_jobs);
+	dmc->flashcache_stats.ssd_writes++;
+	return job;
+}
+
+/*
+ * The SSD write of an admitted block is done. On error, or when IO
+ * queued up behind it, the block is dropped and the queued IO sent to
+ * disk, like any read fill with pending jobs. Called from IO completion.
+ */
+void
+flashcache_pfd_admit_done(struct kcached_job *job, int error)
+{
+	struct cache_c *dmc = job->dmc;
+	struct cacheblock *cacheblk = &dmc->cache[job->index];
+	struct cache_set *cache_set = &dmc->cache_sets[job->index / dmc->assoc];
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache_set->set_spin_lock, flags);
+	VERIFY(cacheblk->cache_state & DISKREADINPROG);
+	if (unlikely(error || FLASHCACHE_NR_QUEUED(cacheblk) > 0)) {
+		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+		/* job->error stays 0, flashcache_do_pending_noerror() drops the block */
+		push_pending(job);
+	} else {
+		cacheblk->cache_state &= ~BLOCK_IO_INPROG;
+		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
+		flashcache_free_cache_job(job);
+		if (atomic_dec_and_test(&dmc->nr_jobs))
+			wake_up(&dmc->destroyq);
+	}
+}
+
+/* Called with the cache set lock held */
+void
+flashcache_pfd_clear_admitted(struct cache_c *dmc, int index)
+{
+	struct cacheblock *cacheblk = &dmc->cache[index];
+
+	if (cacheblk->cache_state & PFD_ADMITTED) {
+		cacheblk->cache_state &= ~PFD_ADMITTED;
+		dmc->cache_sets[index / dmc->assoc].nr_pfd_admitted--;
+	}
+}
+#endif
+
+static void
+flashcache_read(struct cache_c *dmc, struct bio *bio)
+{
+#ifdef PREFETCHD_ON
+	struct pfd_stat_info pfd_stat_info;
+
+	pfd_stat_update(dmc, bio, &pfd_stat_info);
+	if (!pfd_cache_handle_bio(dmc, &bio))
+		flashcache_read_cache(dmc, bio);
+	/* The demand read is on its way, now look ahead of it */
 	pfd_cache_prefetch(dmc, &pfd_stat_info);
+#else
+	flashcache_read_cache(dmc, bio);
 #endif
 }
 
@@ -1645,7 +2051,7 @@ flashcache_inval_block_set(struct cache_c *dmc, int set, struct bio *bio, int rw
 			else
 				dmc->flashcache_stats.rd_invalidates++;
 			if (!(cacheblk->cache_state & (BLOCK_IO_INPROG | DIRTY)) &&
-			    (cacheblk->nr_queued == 0)) {
+			    (FLASHCACHE_NR_QUEUED(cacheblk) == 0)) {
 				atomic_dec(&dmc->cached_blocks);
 				DPRINTK("Cache invalidate (!BUSY): Block %llu %lx",
 					start_dbn, cacheblk->cache_state);
@@ -1760,7 +2166,7 @@ flashcache_inval_block_set_v3(struct cache_c *dmc, int set, struct bio *bio,
 		dmc->flashcache_stats.rd_invalidates++;
 	}
 	if (!(cacheblk->cache_state & (BLOCK_IO_INPROG | DIRTY)) &&
-	    (cacheblk->nr_queued == 0)) {
+	    (FLASHCACHE_NR_QUEUED(cacheblk) == 0)) {
 		atomic_dec(&dmc->cached_blocks);
 		DPRINTK("Cache invalidate (!BUSY): Block %llu %lx",
 			start_dbn, cacheblk->cache_state);
@@ -1904,6 +2310,14 @@ flashcache_write_miss(struct cache_c *dmc, struct bio *bio, int index)
 			flashcache_bio_endio(bio, -EIO, dmc, NULL);
 		return;
 	}
+	/* As for a read miss, readers still on the block send us to disk */
+	if (!flashcache_block_claim(dmc, index)) {
+		if (cacheblk->cache_state == INVALID)
+			flashcache_invalid_insert(dmc, index);
+		flashcache_setlocks_multidrop(dmc, bio);
+		flashcache_start_uncached_io(dmc, bio);
+		return;
+	}
 	if (cacheblk->cache_state & VALID) {
 		dmc->flashcache_stats.wr_replace++;
 		/* 
@@ -1917,6 +2331,7 @@ flashcache_write_miss(struct cache_c *dmc, struct bio *bio, int index)
 	cacheblk->cache_state = VALID | CACHEWRITEINPROG;
 	cacheblk->dbn = bio->bi_iter.bi_sector;
 	flashcache_hash_insert(dmc, index);
+	flashcache_block_unclaim(dmc, index);
 	flashcache_setlocks_multidrop(dmc, bio);
 	job = new_kcached_job(dmc, bio, index);
 	if (unlikely(dmc->sysctl_error_inject & WRITE_MISS_JOB_ALLOC_FAIL)) {
@@ -1980,11 +2395,14 @@ flashcache_write_hit(struct cache_c *dmc, struct bio *bio, int index)
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
 	cacheblk = &dmc->cache[index];
-	if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (cacheblk->nr_queued == 0)) {
+	/* Readers still on the block run the IO queued here when they are done */
+	if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (FLASHCACHE_NR_QUEUED(cacheblk) == 0) &&
+	    flashcache_block_claim(dmc, index)) {
 		if (cacheblk->cache_state & DIRTY)
 			dmc->flashcache_stats.dirty_write_hits++;
 		dmc->flashcache_stats.write_hits++;
 		cacheblk->cache_state |= CACHEWRITEINPROG;
+		flashcache_block_unclaim(dmc, index);
 		flashcache_setlocks_multidrop(dmc, bio);
 		job = new_kcached_job(dmc, bio, index);
 		if (unlikely(dmc->sysctl_error_inject & WRITE_HIT_JOB_ALLOC_FAIL)) {
@@ -2133,7 +2551,6 @@ flashcache_map(struct dm_target *ti, struct bio *bio)
 {
 	struct cache_c *dmc = (struct cache_c *) ti->private;
 	int sectors = to_sector(bio->bi_iter.bi_size);
-	int queued;
 	int uncacheable;
 	unsigned long flags;
 	
@@ -2154,6 +2571,12 @@ flashcache_map(struct dm_target *ti, struct bio *bio)
 	else
 		dmc->flashcache_stats.writes++;
 
+#ifdef PREFETCHD_ON
+	/* Writes and discards, whichever path they take below */
+	if (bio_data_dir(bio) == WRITE)
+		pfd_cache_invalidate(dmc, bio->bi_iter.bi_sector, bio_sectors(bio));
+#endif
+
 	spin_lock_irqsave(&dmc->ioctl_lock, flags);
 	if (unlikely(dmc->sysctl_pid_do_expiry && 
 		     (dmc->whitelist_head || dmc->blacklist_head)))
@@ -2169,16 +2592,14 @@ flashcache_map(struct dm_target *ti, struct bio *bio)
 			 flashcache_uncacheable(dmc, bio))));
 	spin_unlock_irqrestore(&dmc->ioctl_lock, flags);
 	if (uncacheable) {
-		flashcache_setlocks_multiget(dmc, bio);
-		queued = flashcache_inval_blocks(dmc, bio);
-		flashcache_setlocks_multidrop(dmc, bio);
-		if (queued) {
-			if (unlikely(queued < 0))
-				flashcache_bio_endio(bio, -EIO, dmc, NULL);
-		} else {
-			/* Start uncached IO */
-			flashcache_start_uncached_io(dmc, bio);
+#ifdef PREFETCHD_ON
+		/* Partial and uncacheable reads train prefetchd too */
+		if (bio_data_dir(bio) == READ && !dmc->bypass_cache) {
+			flashcache_read(dmc, bio);
+			return DM_MAPIO_SUBMITTED;
 		}
+#endif
+		flashcache_uncached_io(dmc, bio);
 	} else {
 		if (bio_data_dir(bio) == READ)
 			flashcache_read(dmc, bio);
@@ -2455,7 +2876,27 @@ flashcache_uncached_io_callback(unsigned long error, void *context)
 	else
 		job->error = 0;
 	push_uncached_io_complete(job);
-	schedule_work(&_kcached_wq);
+}
+
+/*
+ * Send bio straight to disk, once the cache blocks it overlaps have
+ * been invalidated.
+ */
+static void
+flashcache_uncached_io(struct cache_c *dmc, struct bio *bio)
+{
+	int queued;
+
+	flashcache_setlocks_multiget(dmc, bio);
+	queued = flashcache_inval_blocks(dmc, bio);
+	flashcache_setlocks_multidrop(dmc, bio);
+	if (queued) {
+		if (unlikely(queued < 0))
+			flashcache_bio_endio(bio, -EIO, dmc, NULL);
+	} else {
+		/* Start uncached IO */
+		flashcache_start_uncached_io(dmc, bio);
+	}
 }
 
 static void
@@ -2477,6 +2918,7 @@ flashcache_start_uncached_io(struct cache_c *dmc, struct bio *bio)
 		return;
 	}
 	atomic_inc(&dmc->nr_jobs);
+	dmc->disk_last_io = jiffies;
 	dm_io_async_bvec(1, &job->job_io_regions.disk,
 			 ((is_write) ? WRITE : READ), 
 			 bio,
@@ -2495,6 +2937,7 @@ EXPORT_SYMBOL(flashcache_inval_block_set);
 EXPORT_SYMBOL(flashcache_read);
 EXPORT_SYMBOL(flashcache_read_miss);
 EXPORT_SYMBOL(flashcache_clean_set);
+EXPORT_SYMBOL(flashcache_wb_sweep);
 EXPORT_SYMBOL(flashcache_dirty_writeback);
 EXPORT_SYMBOL(flashcache_kcopyd_callback);
 EXPORT_SYMBOL(flashcache_lookup);
@@ -58,6 +58,10 @@
 
 #include "flashcache.h"
 #include "flashcache_ioctl.h"
+#ifdef PREFETCHD_ON
+#include "pfd_stat.h"
+#include "pfd_cache.h"
+#endif
 
 static int fallow_clean_speed_min = FALLOW_SPEED_MIN;
 static int fallow_clean_speed_max = FALLOW_SPEED_MAX;
@@ -128,6 +132,7 @@ flashcache_sync_sysctl(ctl_table *table, int write,
 			dmc->sysctl_stop_sync = 0;
 			cancel_delayed_work(&dmc->delayed_clean);
 			flush_scheduled_work();
+			flush_workqueue(dmc->kcached_wq);
 			flashcache_sync_all(dmc);
 		}
 	}
@@ -233,6 +238,66 @@ flashcache_dirty_thresh_sysctl(ctl_table *table, int write,
 	return 0;
 }
 
+/* 0 leaves the sweep to disk idle time alone */
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_wb_sweep_thresh_sysctl(struct ctl_table *table, int write,
+				  void __user *buffer, 
+				  size_t *length, loff_t *ppos)
+#else
+flashcache_wb_sweep_thresh_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				  struct file *file, 
+#endif
+				  void __user *buffer, 
+				  size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_wb_sweep_thresh > DIRTY_THRESH_MAX)
+			dmc->sysctl_wb_sweep_thresh = DIRTY_THRESH_MAX;
+
+		if (dmc->sysctl_wb_sweep_thresh < 0)
+			dmc->sysctl_wb_sweep_thresh = 0;
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_wb_sweep_idle_sysctl(struct ctl_table *table, int write,
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#else
+flashcache_wb_sweep_idle_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				struct file *file, 
+#endif
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_wb_sweep_idle_ms < 0)
+			dmc->sysctl_wb_sweep_idle_ms = 0;
+	}
+	return 0;
+}
+
 static int
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
 flashcache_lru_hot_pct_sysctl(struct ctl_table *table, int write,
@@ -259,6 +324,223 @@ flashcache_lru_hot_pct_sysctl(ctl_table *table, int write,
 	return 0;
 }
 
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_lru_promote_thresh_sysctl(struct ctl_table *table, int write,
+				     void __user *buffer, 
+				     size_t *length, loff_t *ppos)
+#else
+flashcache_lru_promote_thresh_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				     struct file *file, 
+#endif
+				     void __user *buffer, 
+				     size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		/* A block's use_cnt never counts past FLASHCACHE_LRU_USE_MAX */
+		if (dmc->sysctl_lru_promote_thresh > FLASHCACHE_LRU_USE_MAX)
+			dmc->sysctl_lru_promote_thresh = FLASHCACHE_LRU_USE_MAX;
+
+		if (dmc->sysctl_lru_promote_thresh < 0)
+			dmc->sysctl_lru_promote_thresh = 0;
+	}
+	return 0;
+}
+
+#ifdef PREFETCHD_ON
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_cache_blocks_sysctl(struct ctl_table *table, int write,
+				   void __user *buffer, 
+				   size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_cache_blocks_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				   struct file *file, 
+#endif
+				   void __user *buffer, 
+				   size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_cache_blocks < 0)
+			dmc->sysctl_pfd_cache_blocks = 0;
+
+		if (dmc->sysctl_pfd_cache_blocks > PFD_CACHE_MAX_BLOCKS)
+			dmc->sysctl_pfd_cache_blocks = PFD_CACHE_MAX_BLOCKS;
+
+		return pfd_cache_resize(dmc, dmc->sysctl_pfd_cache_blocks);
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_zerostats_sysctl(struct ctl_table *table, int write,
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_zerostats_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				struct file *file, 
+#endif
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_zerostats)
+			memset(&dmc->pfd_cache_stats, 0, sizeof(struct pfd_cache_stats));
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_admit_pct_sysctl(struct ctl_table *table, int write,
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_admit_pct_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				struct file *file, 
+#endif
+				void __user *buffer, 
+				size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_admit_pct < 0)
+			dmc->sysctl_pfd_admit_pct = 0;
+
+		if (dmc->sysctl_pfd_admit_pct > PFD_CACHE_ADMIT_PCT_MAX)
+			dmc->sysctl_pfd_admit_pct = PFD_CACHE_ADMIT_PCT_MAX;
+
+		dmc->pfd_admit_set = 
+			(dmc->assoc * dmc->sysctl_pfd_admit_pct) / 100;
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_stream_key_sysctl(struct ctl_table *table, int write,
+				 void __user *buffer, 
+				 size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_stream_key_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				 struct file *file, 
+#endif
+				 void __user *buffer, 
+				 size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_stream_key < PFD_STAT_KEY_PID ||
+		    dmc->sysctl_pfd_stream_key > PFD_STAT_KEY_MAX)
+			dmc->sysctl_pfd_stream_key = PFD_STAT_KEY_PID;
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_max_inflight_sysctl(struct ctl_table *table, int write,
+				   void __user *buffer, 
+				   size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_max_inflight_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+				   struct file *file, 
+#endif
+				   void __user *buffer, 
+				   size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_max_inflight < 1)
+			dmc->sysctl_pfd_max_inflight = 1;
+
+		if (dmc->sysctl_pfd_max_inflight > PFD_CACHE_MAX_INFLIGHT)
+			dmc->sysctl_pfd_max_inflight = PFD_CACHE_MAX_INFLIGHT;
+	}
+	return 0;
+}
+
+static int
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+flashcache_pfd_max_rate_sysctl(struct ctl_table *table, int write,
+			       void __user *buffer, 
+			       size_t *length, loff_t *ppos)
+#else
+flashcache_pfd_max_rate_sysctl(ctl_table *table, int write,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+			       struct file *file, 
+#endif
+			       void __user *buffer, 
+			       size_t *length, loff_t *ppos)
+#endif
+{
+	struct cache_c *dmc = (struct cache_c *)table->extra1;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+	proc_dointvec(table, write, file, buffer, length, ppos);
+#else
+	proc_dointvec(table, write, buffer, length, ppos);
+#endif
+	if (write) {
+		if (dmc->sysctl_pfd_max_rate < 0)
+			dmc->sysctl_pfd_max_rate = 0;
+	}
+	return 0;
+}
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
 #define CTL_UNNUMBERED			-2
 #endif
@@ -268,7 +550,11 @@ flashcache_lru_hot_pct_sysctl(ctl_table *table, int write,
  * entries - zero padded at the end ! Therefore the NUM_*_SYSCTLS
  * is 1 more than then number of sysctls.
  */
-#define FLASHCACHE_NUM_WRITEBACK_SYSCTLS	22
+#ifdef PREFETCHD_ON
+#define FLASHCACHE_NUM_WRITEBACK_SYSCTLS	31
+#else
+#define FLASHCACHE_NUM_WRITEBACK_SYSCTLS	24
+#endif
 
 static struct flashcache_writeback_sysctl_table {
 	struct ctl_table_header *sysctl_header;
@@ -485,7 +771,7 @@ static struct flashcache_writeback_sysctl_table {
 			.procname	= "lru_promote_thresh",
 			.maxlen		= sizeof(int),
 			.mode		= 0644,
-			.proc_handler	= &proc_dointvec,
+			.proc_handler	= &flashcache_lru_promote_thresh_sysctl,
 		},
 		{
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
@@ -508,6 +794,116 @@ static struct flashcache_writeback_sysctl_table {
 			.mode		= 0644,
 			.proc_handler	= &proc_dointvec,
 		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "wb_sweep_thresh_pct",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_wb_sweep_thresh_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "wb_sweep_idle_ms",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_wb_sweep_idle_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+#ifdef PREFETCHD_ON
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_blocks",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_cache_blocks_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "zero_prefetch_stats",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_zerostats_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_admit_pct",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_admit_pct_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_stream_key",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_stream_key_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_delta",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &proc_dointvec,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_max_inflight",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_max_inflight_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_max_rate",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_max_rate_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+#endif
 	},
 	.dev = {
 		{
@@ -549,7 +945,11 @@ static struct flashcache_writeback_sysctl_table {
  * entries - zero padded at the end ! Therefore the NUM_*_SYSCTLS
  * is 1 more than then number of sysctls.
  */
+#ifdef PREFETCHD_ON
+#define FLASHCACHE_NUM_WRITETHROUGH_SYSCTLS	18
+#else
 #define FLASHCACHE_NUM_WRITETHROUGH_SYSCTLS	11
+#endif
 
 static struct flashcache_writethrough_sysctl_table {
 	struct ctl_table_header *sysctl_header;
@@ -667,7 +1067,7 @@ static struct flashcache_writethrough_sysctl_table {
 			.procname	= "lru_promote_thresh",
 			.maxlen		= sizeof(int),
 			.mode		= 0644,
-			.proc_handler	= &proc_dointvec,
+			.proc_handler	= &flashcache_lru_promote_thresh_sysctl,
 		},
 		{
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
@@ -681,6 +1081,92 @@ static struct flashcache_writethrough_sysctl_table {
 			.strategy	= &sysctl_intvec,
 #endif
 		},
+#ifdef PREFETCHD_ON
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_blocks",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_cache_blocks_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "zero_prefetch_stats",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_zerostats_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_admit_pct",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_admit_pct_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_stream_key",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_stream_key_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_delta",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &proc_dointvec,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_max_inflight",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_max_inflight_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+		{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.ctl_name	= CTL_UNNUMBERED,
+#endif
+			.procname	= "prefetch_max_rate",
+			.maxlen		= sizeof(int),
+			.mode		= 0644,
+			.proc_handler	= &flashcache_pfd_max_rate_sysctl,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+			.strategy	= &sysctl_intvec,
+#endif
+		},
+#endif
 	},
 	.dev = {
 		{
@@ -768,6 +1254,26 @@ flashcache_find_sysctl_data(struct cache_c *dmc, ctl_table *vars)
 		return &dmc->sysctl_lru_hot_pct;
 	else if (strcmp(vars->procname, "new_style_write_merge") == 0)
 		return &dmc->sysctl_new_style_write_merge;
+	else if (strcmp(vars->procname, "wb_sweep_thresh_pct") == 0)
+		return &dmc->sysctl_wb_sweep_thresh;
+	else if (strcmp(vars->procname, "wb_sweep_idle_ms") == 0)
+		return &dmc->sysctl_wb_sweep_idle_ms;
+#ifdef PREFETCHD_ON
+	else if (strcmp(vars->procname, "prefetch_blocks") == 0)
+		return &dmc->sysctl_pfd_cache_blocks;
+	else if (strcmp(vars->procname, "zero_prefetch_stats") == 0)
+		return &dmc->sysctl_pfd_zerostats;
+	else if (strcmp(vars->procname, "prefetch_admit_pct") == 0)
+		return &dmc->sysctl_pfd_admit_pct;
+	else if (strcmp(vars->procname, "prefetch_stream_key") == 0)
+		return &dmc->sysctl_pfd_stream_key;
+	else if (strcmp(vars->procname, "prefetch_delta") == 0)
+		return &dmc->sysctl_pfd_delta;
+	else if (strcmp(vars->procname, "prefetch_max_inflight") == 0)
+		return &dmc->sysctl_pfd_max_inflight;
+	else if (strcmp(vars->procname, "prefetch_max_rate") == 0)
+		return &dmc->sysctl_pfd_max_rate;
+#endif
 	printk(KERN_ERR "flashcache_find_sysctl_data: Unknown sysctl %s\n", vars->procname);
 	panic("flashcache_find_sysctl_data: Unknown sysctl %s\n", vars->procname);
 	return NULL;
@@ -917,8 +1423,8 @@ flashcache_stats_show(struct seq_file *seq, void *v)
 	}
 	seq_printf(seq, "reads=%lu writes=%lu \n", 
 		   stats->reads, stats->writes);
-	seq_printf(seq, "read_hits=%lu read_hit_percent=%d ", 
-		   stats->read_hits, read_hit_pct);
+	seq_printf(seq, "read_hits=%lu read_hit_percent=%d read_hits_nolock=%lu ", 
+		   stats->read_hits, read_hit_pct, stats->read_hits_nolock);
 	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK || dmc->cache_mode == FLASHCACHE_WRITE_THROUGH) {
 		seq_printf(seq, "write_hits=%lu write_hit_percent=%d ", 
 		   	   stats->write_hits, write_hit_pct);
@@ -952,6 +1458,8 @@ flashcache_stats_show(struct seq_file *seq, void *v)
 			   stats->md_write_batch, stats->md_ssd_writes);
 		seq_printf(seq, "cleanings=%lu fallow_cleanings=%lu ",
 			   stats->cleanings, stats->fallow_cleanings);
+		seq_printf(seq, "sweep_cleanings=%lu sweep_clusters=%lu ",
+			   stats->wb_sweep_ios, stats->wb_sweep_clusters);
 	}
 	seq_printf(seq, "no_room=%lu ",
 		   stats->noroom);
@@ -1097,6 +1605,100 @@ static struct file_operations flashcache_pidlists_operations = {
 	.release	= single_release,
 };
 
+#ifdef PREFETCHD_ON
+static int 
+flashcache_prefetch_streams_show(struct seq_file *seq, void *v)
+{
+	struct cache_c *dmc = seq->private;
+
+	pfd_stat_show_streams(dmc, seq);
+	return 0;
+}
+
+static int 
+flashcache_prefetch_streams_open(struct inode *inode, struct file *file)
+{
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+		return single_open(file, &flashcache_prefetch_streams_show, PDE(inode)->data);
+	#endif
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+		return single_open(file, &flashcache_prefetch_streams_show, PDE_DATA(inode));
+	#endif
+}
+
+static struct file_operations flashcache_prefetch_streams_operations = {
+	.open		= flashcache_prefetch_streams_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int 
+flashcache_prefetch_stats_show(struct seq_file *seq, void *v)
+{
+	struct cache_c *dmc = seq->private;
+	struct pfd_cache_stats *stats;
+	unsigned long lookups;
+	int hit_pct, useful_pct;
+	int seq_streams, stride_streams, delta_streams, random_streams;
+	long tokens;
+	int inflight, global_inflight, global_max;
+
+	stats = &dmc->pfd_cache_stats;
+	lookups = stats->hits + stats->partial_hits + stats->misses;
+	if (lookups > 0)
+		hit_pct = (stats->hits + stats->partial_hits) * 100 / lookups;
+	else
+		hit_pct = 0;
+	if (stats->completed > 0)
+		useful_pct = (stats->completed - min(stats->evicted_unused, stats->completed)) * 100 / stats->completed;
+	else
+		useful_pct = 0;
+	pfd_stat_count_streams(dmc, &seq_streams, &stride_streams,
+			       &delta_streams, &random_streams);
+	pfd_cache_budget(dmc, &tokens, &inflight, &global_inflight, &global_max);
+
+	seq_printf(seq, "issued=%lu delta_issued=%lu completed=%lu failed=%lu queue_drops=%lu cancelled=%lu \n",
+		   stats->issued, stats->delta_issued, stats->completed,
+		   stats->failed, stats->queue_drops, stats->cancelled);
+	seq_printf(seq, "from_ssd=%lu from_hdd=%lu skipped_dirty=%lu \n",
+		   stats->from_ssd, stats->from_hdd, stats->skipped_dirty);
+	seq_printf(seq, "hits=%lu partial_hits=%lu misses=%lu hit_percent=%d \n",
+		   stats->hits, stats->partial_hits, stats->misses, hit_pct);
+	seq_printf(seq, "bytes_served=%lu parked=%lu \n",
+		   stats->bytes_served, stats->parked);
+	seq_printf(seq, "evicted_unused=%lu useful_percent=%d invalidates=%lu \n",
+		   stats->evicted_unused, useful_pct, stats->invalidates);
+	seq_printf(seq, "admitted=%lu admit_skipped=%lu \n",
+		   stats->admitted, stats->admit_skipped);
+	seq_printf(seq, "seq_streams=%d stride_streams=%d delta_streams=%d random_streams=%d\n",
+		   seq_streams, stride_streams, delta_streams, random_streams);
+	seq_printf(seq, "max_rate_kb=%d tokens=%ld inflight=%d max_inflight=%d global_inflight=%d global_max_inflight=%d throttled=%lu\n",
+		   dmc->sysctl_pfd_max_rate, tokens, inflight,
+		   dmc->sysctl_pfd_max_inflight, global_inflight, global_max,
+		   stats->throttled);
+	return 0;
+}
+
+static int 
+flashcache_prefetch_stats_open(struct inode *inode, struct file *file)
+{
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+		return single_open(file, &flashcache_prefetch_stats_show, PDE(inode)->data);
+	#endif
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+		return single_open(file, &flashcache_prefetch_stats_show, PDE_DATA(inode));
+	#endif
+}
+
+static struct file_operations flashcache_prefetch_stats_operations = {
+	.open		= flashcache_prefetch_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 extern char *flashcache_sw_version;
 
 static int 
@@ -1265,6 +1867,34 @@ flashcache_ctr_procfs(struct cache_c *dmc)
 	#endif
 	kfree(s);
 
+#ifdef PREFETCHD_ON
+	s = flashcache_cons_procfs_cachename(dmc, "prefetch_streams");
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+		entry = create_proc_entry(s, 0, NULL);
+		if (entry) {
+			entry->proc_fops =  &flashcache_prefetch_streams_operations;
+			entry->data = dmc;
+		}
+	#endif
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+		entry = proc_create_data(s, 0, NULL, &flashcache_prefetch_streams_operations, dmc);
+	#endif
+	kfree(s);
+
+	s = flashcache_cons_procfs_cachename(dmc, "prefetch_stats");
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
+		entry = create_proc_entry(s, 0, NULL);
+		if (entry) {
+			entry->proc_fops =  &flashcache_prefetch_stats_operations;
+			entry->data = dmc;
+		}
+	#endif
+	#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
+		entry = proc_create_data(s, 0, NULL, &flashcache_prefetch_stats_operations, dmc);
+	#endif
+	kfree(s);
+#endif
+
 	if (dmc->cache_mode == FLASHCACHE_WRITE_BACK)
 		flashcache_writeback_sysctl_register(dmc);
 	else
@@ -1292,6 +1922,16 @@ flashcache_dtr_procfs(struct cache_c *dmc)
 	remove_proc_entry(s, NULL);
 	kfree(s);
 
+#ifdef PREFETCHD_ON
+	s = flashcache_cons_procfs_cachename(dmc, "prefetch_streams");
+	remove_proc_entry(s, NULL);
+	kfree(s);
+
+	s = flashcache_cons_procfs_cachename(dmc, "prefetch_stats");
+	remove_proc_entry(s, NULL);
+	kfree(s);
+#endif
+
 	s = flashcache_cons_procfs_cachename(dmc, "");
 	remove_proc_entry(s, NULL);
 	kfree(s);
@@ -98,7 +98,7 @@ flashcache_reclaim_rebalance_lru(struct cache_c *dmc, int new_lru_hot_pct)
 	int new_hot_blocks, old_hot_blocks;
 	int set, index;
 	struct cache_set *cache_set;
-	struct cacheblock *cacheblk;
+	struct cacheblock_cold *coldblk;
 	int blocks_to_move, moved;
 	int start_index;
 	
@@ -114,14 +114,14 @@ flashcache_reclaim_rebalance_lru(struct cache_c *dmc, int new_lru_hot_pct)
 			cache_set = &dmc->cache_sets[set];
 			spin_lock_irq(&cache_set->set_spin_lock);
 			moved = 0;
-			while ((cache_set->warmlist_lru_head != FLASHCACHE_NULL) &&
+			while ((cache_set->warmlist_lru_head != FLASHCACHE_LRU_NULL) &&
 			       (moved < blocks_to_move)) {
 				index = cache_set->warmlist_lru_head + start_index;
 				flashcache_reclaim_remove_block_from_list(dmc, index);
-				cacheblk = &dmc->cache[index];
-				cacheblk->lru_state &= ~LRU_WARM;
-				cacheblk->lru_state |= LRU_HOT;
-				cacheblk->use_cnt = 0;
+				coldblk = &dmc->cache_cold[index];
+				coldblk->lru_state &= ~LRU_WARM;
+				coldblk->lru_state |= LRU_HOT;
+				coldblk->use_cnt = 0;
 				flashcache_reclaim_add_block_to_list_lru(dmc, index);
 				moved++;
 			}
@@ -135,14 +135,14 @@ flashcache_reclaim_rebalance_lru(struct cache_c *dmc, int new_lru_hot_pct)
 			cache_set = &dmc->cache_sets[set];
 			spin_lock_irq(&cache_set->set_spin_lock);
 			moved = 0;
-			while ((cache_set->hotlist_lru_head != FLASHCACHE_NULL) &&
+			while ((cache_set->hotlist_lru_head != FLASHCACHE_LRU_NULL) &&
 			       (moved < blocks_to_move)) {
 				index = cache_set->hotlist_lru_head + start_index;
 				flashcache_reclaim_remove_block_from_list(dmc, index);
-				cacheblk = &dmc->cache[index];
-				cacheblk->lru_state &= ~LRU_HOT;
-				cacheblk->lru_state |= LRU_WARM;
-				cacheblk->use_cnt = 0;
+				coldblk = &dmc->cache_cold[index];
+				coldblk->lru_state &= ~LRU_HOT;
+				coldblk->lru_state |= LRU_WARM;
+				coldblk->use_cnt = 0;
 				flashcache_reclaim_add_block_to_list_lru(dmc,index);
 				moved++;
 			}
@@ -160,7 +160,7 @@ flashcache_reclaim_init_lru_lists(struct cache_c *dmc)
 	int set, j, block_index;
 	struct cache_set *cache_set;
 	int start_index;
-	struct cacheblock *cacheblk;
+	struct cacheblock_cold *coldblk;
 
 	hot_blocks_set = (dmc->assoc * atomic_read(&dmc->hot_list_pct)) / 100;
 	for (set = 0 ; set < (dmc->size >> dmc->assoc_shift) ; set++) {
@@ -169,17 +169,18 @@ flashcache_reclaim_init_lru_lists(struct cache_c *dmc)
 		start_index = set * dmc->assoc;
 		for (j = 0 ; j < hot_blocks_set ; j++) {
 			block_index = start_index + j;
-			cacheblk = &dmc->cache[block_index];
-			cacheblk->lru_prev = FLASHCACHE_NULL;
-			cacheblk->lru_next = FLASHCACHE_NULL;
-			cacheblk->lru_state = LRU_HOT;
+			coldblk = &dmc->cache_cold[block_index];
+			coldblk->lru_prev = FLASHCACHE_LRU_NULL;
+			coldblk->lru_next = FLASHCACHE_LRU_NULL;
+			coldblk->lru_state = LRU_HOT;
 			flashcache_reclaim_add_block_to_list_lru(dmc, block_index);
 		}
 		for ( ; j < dmc->assoc; j++) {
 			block_index = start_index + j;
-			cacheblk = &dmc->cache[block_index];
-			cacheblk->lru_prev = cacheblk->lru_next = FLASHCACHE_NULL;
-			cacheblk->lru_state = LRU_WARM;
+			coldblk = &dmc->cache_cold[block_index];
+			coldblk->lru_prev = FLASHCACHE_LRU_NULL;
+			coldblk->lru_next = FLASHCACHE_LRU_NULL;
+			coldblk->lru_state = LRU_WARM;
 			flashcache_reclaim_add_block_to_list_lru(dmc, block_index);
 		}
 		spin_unlock_irq(&cache_set->set_spin_lock);
@@ -192,68 +193,68 @@ flashcache_reclaim_remove_block_from_list(struct cache_c *dmc, int index)
 {
 	int set = index / dmc->assoc;
 	int start_index = set * dmc->assoc;
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
 	/* At least one should be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
 	/* Both should not be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
-	if (unlikely((cacheblk->lru_prev == FLASHCACHE_NULL) && 
-		     (cacheblk->lru_next == FLASHCACHE_NULL))) {
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
+	if (unlikely((coldblk->lru_prev == FLASHCACHE_LRU_NULL) && 
+		     (coldblk->lru_next == FLASHCACHE_LRU_NULL))) {
 		/* 
 		 * Is this the only member on the list ? Or is this not on the list 
 		 * at all ?
 		 */
-		if (cacheblk->lru_state & LRU_WARM) {
-			if (cache_set->warmlist_lru_head == FLASHCACHE_NULL &&
-			    cache_set->warmlist_lru_tail == FLASHCACHE_NULL)
+		if (coldblk->lru_state & LRU_WARM) {
+			if (cache_set->warmlist_lru_head == FLASHCACHE_LRU_NULL &&
+			    cache_set->warmlist_lru_tail == FLASHCACHE_LRU_NULL)
 				return;
 		} else {
-			if (cache_set->hotlist_lru_head == FLASHCACHE_NULL &&
-			    cache_set->hotlist_lru_tail == FLASHCACHE_NULL)
+			if (cache_set->hotlist_lru_head == FLASHCACHE_LRU_NULL &&
+			    cache_set->hotlist_lru_tail == FLASHCACHE_LRU_NULL)
 				return;			
 		}
 	}
-	if (cacheblk->lru_prev != FLASHCACHE_NULL)
-		dmc->cache[cacheblk->lru_prev + start_index].lru_next = 
-			cacheblk->lru_next;
+	if (coldblk->lru_prev != FLASHCACHE_LRU_NULL)
+		dmc->cache_cold[coldblk->lru_prev + start_index].lru_next = 
+			coldblk->lru_next;
 	else {
-		if (cacheblk->lru_state & LRU_WARM)
-			cache_set->warmlist_lru_head = cacheblk->lru_next;
+		if (coldblk->lru_state & LRU_WARM)
+			cache_set->warmlist_lru_head = coldblk->lru_next;
 		else
-			cache_set->hotlist_lru_head = cacheblk->lru_next;
+			cache_set->hotlist_lru_head = coldblk->lru_next;
 	}
-	if (cacheblk->lru_next != FLASHCACHE_NULL)
-		dmc->cache[cacheblk->lru_next + start_index].lru_prev = 
-			cacheblk->lru_prev;
+	if (coldblk->lru_next != FLASHCACHE_LRU_NULL)
+		dmc->cache_cold[coldblk->lru_next + start_index].lru_prev = 
+			coldblk->lru_prev;
 	else {
-		if (cacheblk->lru_state & LRU_WARM)
-			cache_set->warmlist_lru_tail = cacheblk->lru_prev;
+		if (coldblk->lru_state & LRU_WARM)
+			cache_set->warmlist_lru_tail = coldblk->lru_prev;
 		else
-			cache_set->hotlist_lru_tail = cacheblk->lru_prev;
+			cache_set->hotlist_lru_tail = coldblk->lru_prev;
 	}
-	if (cacheblk->lru_state & LRU_WARM) {
+	if (coldblk->lru_state & LRU_WARM) {
 		dmc->lru_warm_blocks--;
 		cache_set->lru_warm_blocks--;
 		if (cache_set->lru_warm_blocks == 0) {
-			VERIFY(cache_set->warmlist_lru_head == FLASHCACHE_NULL);
-			VERIFY(cache_set->warmlist_lru_tail == FLASHCACHE_NULL);
+			VERIFY(cache_set->warmlist_lru_head == FLASHCACHE_LRU_NULL);
+			VERIFY(cache_set->warmlist_lru_tail == FLASHCACHE_LRU_NULL);
 		}
-		if (cache_set->warmlist_lru_head != FLASHCACHE_NULL)
+		if (cache_set->warmlist_lru_head != FLASHCACHE_LRU_NULL)
 			VERIFY(cache_set->lru_warm_blocks > 0);
-		if (cache_set->warmlist_lru_tail != FLASHCACHE_NULL)
+		if (cache_set->warmlist_lru_tail != FLASHCACHE_LRU_NULL)
 			VERIFY(cache_set->lru_warm_blocks > 0);		
 	} else {
 		dmc->lru_hot_blocks--;
 		cache_set->lru_hot_blocks--;
 		if (cache_set->lru_hot_blocks == 0) {
-			VERIFY(cache_set->hotlist_lru_head == FLASHCACHE_NULL);
-			VERIFY(cache_set->hotlist_lru_tail == FLASHCACHE_NULL);
+			VERIFY(cache_set->hotlist_lru_head == FLASHCACHE_LRU_NULL);
+			VERIFY(cache_set->hotlist_lru_tail == FLASHCACHE_LRU_NULL);
 		}
-		if (cache_set->hotlist_lru_head != FLASHCACHE_NULL)
+		if (cache_set->hotlist_lru_head != FLASHCACHE_LRU_NULL)
 			VERIFY(cache_set->lru_hot_blocks > 0);
-		if (cache_set->hotlist_lru_tail != FLASHCACHE_NULL)
+		if (cache_set->hotlist_lru_tail != FLASHCACHE_LRU_NULL)
 			VERIFY(cache_set->lru_hot_blocks > 0);		
 	}
 }
@@ -265,32 +266,32 @@ flashcache_reclaim_add_block_to_list_mru(struct cache_c *dmc, int index)
 	int set = index / dmc->assoc;
 	int start_index = set * dmc->assoc;
 	int my_index = index - start_index;
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
 	/* At least one should be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
 	/* Both should not be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
-	cacheblk->lru_next = FLASHCACHE_NULL;
-	if (cacheblk->lru_state & LRU_WARM) {
-		cacheblk->lru_prev = cache_set->warmlist_lru_tail;
-		if (cache_set->warmlist_lru_tail == FLASHCACHE_NULL)
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
+	coldblk->lru_next = FLASHCACHE_LRU_NULL;
+	if (coldblk->lru_state & LRU_WARM) {
+		coldblk->lru_prev = cache_set->warmlist_lru_tail;
+		if (cache_set->warmlist_lru_tail == FLASHCACHE_LRU_NULL)
 			cache_set->warmlist_lru_head = my_index;
 		else
-			dmc->cache[cache_set->warmlist_lru_tail + start_index].lru_next = 
+			dmc->cache_cold[cache_set->warmlist_lru_tail + start_index].lru_next = 
 				my_index;
 		cache_set->warmlist_lru_tail = my_index;
 	} else {
-		cacheblk->lru_prev = cache_set->hotlist_lru_tail;
-		if (cache_set->hotlist_lru_tail == FLASHCACHE_NULL)
+		coldblk->lru_prev = cache_set->hotlist_lru_tail;
+		if (cache_set->hotlist_lru_tail == FLASHCACHE_LRU_NULL)
 			cache_set->hotlist_lru_head = my_index;
 		else
-			dmc->cache[cache_set->hotlist_lru_tail + start_index].lru_next = 
+			dmc->cache_cold[cache_set->hotlist_lru_tail + start_index].lru_next = 
 				my_index;
 		cache_set->hotlist_lru_tail = my_index;
 	}
-	if (cacheblk->lru_state & LRU_WARM) {
+	if (coldblk->lru_state & LRU_WARM) {
 		dmc->lru_warm_blocks++;
 		cache_set->lru_warm_blocks++;
 	} else {
@@ -306,32 +307,32 @@ flashcache_reclaim_add_block_to_list_lru(struct cache_c *dmc, int index)
 	int set = index / dmc->assoc;
 	int start_index = set * dmc->assoc;
 	int my_index = index - start_index;
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
 	/* At least one should be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
 	/* Both should not be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
-	cacheblk->lru_prev = FLASHCACHE_NULL;
-	if (cacheblk->lru_state & LRU_WARM) {
-		cacheblk->lru_next = cache_set->warmlist_lru_head;
-		if (cache_set->warmlist_lru_head == FLASHCACHE_NULL)
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
+	coldblk->lru_prev = FLASHCACHE_LRU_NULL;
+	if (coldblk->lru_state & LRU_WARM) {
+		coldblk->lru_next = cache_set->warmlist_lru_head;
+		if (cache_set->warmlist_lru_head == FLASHCACHE_LRU_NULL)
 			cache_set->warmlist_lru_tail = my_index;
 		else
-			dmc->cache[cache_set->warmlist_lru_head + start_index].lru_prev = 
+			dmc->cache_cold[cache_set->warmlist_lru_head + start_index].lru_prev = 
 				my_index;
 		cache_set->warmlist_lru_head = my_index;
 	} else {
-		cacheblk->lru_next = cache_set->hotlist_lru_head;
-		if (cache_set->hotlist_lru_head == FLASHCACHE_NULL)
+		coldblk->lru_next = cache_set->hotlist_lru_head;
+		if (cache_set->hotlist_lru_head == FLASHCACHE_LRU_NULL)
 			cache_set->hotlist_lru_tail = my_index;
 		else
-			dmc->cache[cache_set->hotlist_lru_head + start_index].lru_prev = 
+			dmc->cache_cold[cache_set->hotlist_lru_head + start_index].lru_prev = 
 				my_index;
 		cache_set->hotlist_lru_head = my_index;
 	}
-	if (cacheblk->lru_state & LRU_WARM) {
+	if (coldblk->lru_state & LRU_WARM) {
 		cache_set->lru_warm_blocks++;
 		dmc->lru_warm_blocks++;
 	} else {
@@ -344,12 +345,12 @@ flashcache_reclaim_add_block_to_list_lru(struct cache_c *dmc, int index)
 void
 flashcache_reclaim_move_to_mru(struct cache_c *dmc, int index)
 {
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 
 	/* At least one should be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != 0);
 	/* Both should not be set */
-	VERIFY((cacheblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
+	VERIFY((coldblk->lru_state & (LRU_WARM | LRU_HOT)) != (LRU_HOT | LRU_WARM));
 	/* Remove from its list */
 	flashcache_reclaim_remove_block_from_list(dmc, index);
 	/* And add it to LRU Tail (MRU side) of its list */
@@ -360,15 +361,15 @@ flashcache_reclaim_move_to_mru(struct cache_c *dmc, int index)
 static int
 flashcache_reclaim_promote_block(struct cache_c *dmc, int index)
 {
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 	int hot_block;
 	int set = index / dmc->assoc;
 	int start_index = set * dmc->assoc;
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
-	VERIFY(cacheblk->lru_state & LRU_WARM);
+	VERIFY(coldblk->lru_state & LRU_WARM);
 	hot_block = cache_set->hotlist_lru_head;
-	if (hot_block == FLASHCACHE_NULL)
+	if (hot_block == FLASHCACHE_LRU_NULL)
 		/* We cannot swap this block into the hot list */
 		return 0;
 	hot_block += start_index;
@@ -377,15 +378,15 @@ flashcache_reclaim_promote_block(struct cache_c *dmc, int index)
 	/* Remove hot block identified above from its list */
 	flashcache_reclaim_remove_block_from_list(dmc, hot_block);
 	/* Swap the 2 blocks */
-	cacheblk->lru_state &= ~LRU_WARM;
-	cacheblk->lru_state |= LRU_HOT;
-	cacheblk->use_cnt = 0;
+	coldblk->lru_state &= ~LRU_WARM;
+	coldblk->lru_state |= LRU_HOT;
+	coldblk->use_cnt = 0;
 	flashcache_reclaim_add_block_to_list_lru(dmc, index);
-	cacheblk = &dmc->cache[hot_block];
-	VERIFY(cacheblk->lru_state & LRU_HOT);
-	cacheblk->lru_state &= ~LRU_HOT;
-	cacheblk->lru_state |= LRU_WARM;
-	cacheblk->use_cnt = 0;
+	coldblk = &dmc->cache_cold[hot_block];
+	VERIFY(coldblk->lru_state & LRU_HOT);
+	coldblk->lru_state &= ~LRU_HOT;
+	coldblk->lru_state |= LRU_WARM;
+	coldblk->use_cnt = 0;
 	flashcache_reclaim_add_block_to_list_mru(dmc, hot_block);
 	dmc->flashcache_stats.lru_promotions++;
 	return 1;
@@ -395,15 +396,15 @@ flashcache_reclaim_promote_block(struct cache_c *dmc, int index)
 static int
 flashcache_reclaim_demote_block(struct cache_c *dmc, int index)
 {
-	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 	int warm_block;
 	int set = index / dmc->assoc;
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 	int start_index = set * dmc->assoc;
 
-	VERIFY(cacheblk->lru_state & LRU_HOT);
+	VERIFY(coldblk->lru_state & LRU_HOT);
 	warm_block = cache_set->warmlist_lru_tail;
-	if (warm_block == FLASHCACHE_NULL)
+	if (warm_block == FLASHCACHE_LRU_NULL)
 		/* We cannot swap this block into the warm list */
 		return 0;
 	warm_block += start_index;
@@ -412,15 +413,15 @@ flashcache_reclaim_demote_block(struct cache_c *dmc, int index)
 	/* Remove warm block identified above from its list */
 	flashcache_reclaim_remove_block_from_list(dmc, warm_block);
 	/* Swap the 2 blocks */
-	cacheblk->lru_state &= ~LRU_HOT;
-	cacheblk->lru_state |= LRU_WARM;
-	cacheblk->use_cnt = 0;
+	coldblk->lru_state &= ~LRU_HOT;
+	coldblk->lru_state |= LRU_WARM;
+	coldblk->use_cnt = 0;
 	flashcache_reclaim_add_block_to_list_mru(dmc, index);
-	cacheblk = &dmc->cache[warm_block];
-	VERIFY(cacheblk->lru_state & LRU_WARM);
-	cacheblk->lru_state &= ~LRU_WARM;
-	cacheblk->lru_state |= LRU_HOT;
-	cacheblk->use_cnt = 0;
+	coldblk = &dmc->cache_cold[warm_block];
+	VERIFY(coldblk->lru_state & LRU_WARM);
+	coldblk->lru_state &= ~LRU_WARM;
+	coldblk->lru_state |= LRU_HOT;
+	coldblk->use_cnt = 0;
 	flashcache_reclaim_add_block_to_list_lru(dmc, warm_block);
 	dmc->flashcache_stats.lru_demotions++;
 	return 1;
@@ -441,23 +442,25 @@ flashcache_reclaim_lru_get_old_block(struct cache_c *dmc, int start_index, int *
 {
 	int lru_rel_index;
 	struct cacheblock *cacheblk;
+	struct cacheblock_cold *coldblk;
 	int set = start_index / dmc->assoc;
 	struct cache_set *cache_set = &dmc->cache_sets[set];
 
 	*index = -1;
 	lru_rel_index = cache_set->warmlist_lru_head;
-	while (lru_rel_index != FLASHCACHE_NULL) {
+	while (lru_rel_index != FLASHCACHE_LRU_NULL) {
 		cacheblk = &dmc->cache[lru_rel_index + start_index];
 		if (cacheblk->cache_state == VALID) {
 			*index = cacheblk - &dmc->cache[0];
+			coldblk = &dmc->cache_cold[*index];
 			VERIFY((cacheblk->cache_state & FALLOW_DOCLEAN) == 0);
-			VERIFY(cacheblk->lru_state & LRU_WARM);
-			VERIFY((cacheblk->lru_state & LRU_HOT) == 0);
-			cacheblk->use_cnt = 0;
+			VERIFY(coldblk->lru_state & LRU_WARM);
+			VERIFY((coldblk->lru_state & LRU_HOT) == 0);
+			coldblk->use_cnt = 0;
 			flashcache_reclaim_move_to_mru(dmc, *index);
 			break;
 		}
-		lru_rel_index = cacheblk->lru_next;
+		lru_rel_index = dmc->cache_cold[lru_rel_index + start_index].lru_next;
 	}
 	if (likely(*index != -1))
 		return;
@@ -466,14 +469,15 @@ flashcache_reclaim_lru_get_old_block(struct cache_c *dmc, int start_index, int *
 	 * a block from the "hot" LRU list.
 	 */
 	lru_rel_index = cache_set->hotlist_lru_head;
-	while (lru_rel_index != FLASHCACHE_NULL) {
+	while (lru_rel_index != FLASHCACHE_LRU_NULL) {
 		cacheblk = &dmc->cache[lru_rel_index + start_index];
 		if (cacheblk->cache_state == VALID) {
 			*index = cacheblk - &dmc->cache[0];
+			coldblk = &dmc->cache_cold[*index];
 			VERIFY((cacheblk->cache_state & FALLOW_DOCLEAN) == 0);
-			VERIFY(cacheblk->lru_state & LRU_HOT);
-			VERIFY((cacheblk->lru_state & LRU_WARM) == 0);
-			VERIFY(cacheblk->use_cnt == 0);
+			VERIFY(coldblk->lru_state & LRU_HOT);
+			VERIFY((coldblk->lru_state & LRU_WARM) == 0);
+			VERIFY(coldblk->use_cnt == 0);
 			/* 
 			 * Swap this block with the MRU block in the warm list.
 			 * To maintain equilibrium between the lists
@@ -489,7 +493,7 @@ flashcache_reclaim_lru_get_old_block(struct cache_c *dmc, int start_index, int *
 				flashcache_reclaim_move_to_mru(dmc, *index);
 			break;
 		}
-		lru_rel_index = cacheblk->lru_next;
+		lru_rel_index = dmc->cache_cold[lru_rel_index + start_index].lru_next;
 	}
 }
 
@@ -514,8 +518,9 @@ void
 flashcache_lru_accessed(struct cache_c *dmc, int index)
 {
 	struct cacheblock *cacheblk = &dmc->cache[index];
+	struct cacheblock_cold *coldblk = &dmc->cache_cold[index];
 
-	if (cacheblk->lru_state & LRU_HOT)
+	if (coldblk->lru_state & LRU_HOT)
 		flashcache_reclaim_move_to_mru(dmc, index);
 	else {
 		/*
@@ -523,9 +528,12 @@ flashcache_lru_accessed(struct cache_c *dmc, int index)
 		 * position and leave it there. If haven't hit the use count
 		 * threshold, move it to the MRU position and leave it there.
 		 */
-		VERIFY(cacheblk->lru_state & LRU_WARM);
+		VERIFY(coldblk->lru_state & LRU_WARM);
+		if (cacheblk->cache_state != INVALID &&
+		    coldblk->use_cnt < FLASHCACHE_LRU_USE_MAX)
+			coldblk->use_cnt++;
 		if (cacheblk->cache_state == INVALID ||
-		    ++cacheblk->use_cnt < dmc->sysctl_lru_promote_thresh) {
+		    coldblk->use_cnt < dmc->sysctl_lru_promote_thresh) {
 			flashcache_reclaim_move_to_mru(dmc, index);
 			return;
 		}
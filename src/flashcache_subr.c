@@ -58,7 +58,10 @@
 #endif
 #include "flashcache.h"
 
-static DEFINE_SPINLOCK(_job_lock);
+#ifdef PREFETCHD_ON
+#include "pfd_stat.h"
+#include "pfd_cache.h"
+#endif
 
 extern mempool_t *_job_pool;
 extern mempool_t *_pending_job_pool;
@@ -66,57 +69,6 @@ extern mempool_t *_pending_job_pool;
 extern atomic_t nr_cache_jobs;
 extern atomic_t nr_pending_jobs;
 
-LIST_HEAD(_pending_jobs);
-LIST_HEAD(_io_jobs);
-LIST_HEAD(_md_io_jobs);
-LIST_HEAD(_md_complete_jobs);
-LIST_HEAD(_uncached_io_complete_jobs);
-
-LIST_HEAD(_cleaning_read_complete_jobs);
-LIST_HEAD(_cleaning_write_complete_jobs);
-
-int
-flashcache_cleaning_read_empty(void)
-{
-	return list_empty(&_cleaning_read_complete_jobs);
-}
-
-int
-flashcache_cleaning_write_empty(void)
-{
-	return list_empty(&_cleaning_write_complete_jobs);
-}
-
-int
-flashcache_pending_empty(void)
-{
-	return list_empty(&_pending_jobs);
-}
-
-int
-flashcache_io_empty(void)
-{
-	return list_empty(&_io_jobs);
-}
-
-int
-flashcache_md_io_empty(void)
-{
-	return list_empty(&_md_io_jobs);
-}
-
-int
-flashcache_md_complete_empty(void)
-{
-	return list_empty(&_md_complete_jobs);
-}
-
-int
-flashcache_uncached_io_complete_empty(void)
-{
-	return list_empty(&_uncached_io_complete_jobs);
-}
-
 struct kcached_job *
 flashcache_alloc_cache_job(void)
 {
@@ -155,6 +107,27 @@ flashcache_free_pending_job(struct pending_job *job)
 	atomic_dec(&nr_pending_jobs);
 }
 
+/*
+ * The hash chains and the invalid list are singly linked through
+ * hash_next, so that struct cacheblock stays small. Unlinking walks
+ * the chain from its head. Hash chains are a block or two long, and
+ * blocks only come off the invalid list at its head.
+ */
+static void
+flashcache_chain_unlink(struct cache_c *dmc, int start_index, u_int16_t *head, 
+			u_int16_t set_ix)
+{
+	struct cacheblock *cacheblk = &dmc->cache[start_index + set_ix];
+	u_int16_t *link = head;
+
+	while (*link != set_ix) {
+		VERIFY(*link != FLASHCACHE_NULL);
+		link = &dmc->cache[start_index + *link].hash_next;
+	}
+	*link = cacheblk->hash_next;
+	cacheblk->hash_next = FLASHCACHE_NULL;
+}
+
 int
 flashcache_invalid_get(struct cache_c *dmc, int set)
 {
@@ -179,7 +152,6 @@ flashcache_invalid_insert(struct cache_c *dmc, int index)
 	struct cache_set *cache_set;
 	struct cacheblock *cacheblk;
 	int set = index / dmc->assoc;
-	int start_index = set * dmc->assoc;
 	int set_ix = index % dmc->assoc;
 	
 	/* index validity checks */
@@ -189,13 +161,11 @@ flashcache_invalid_insert(struct cache_c *dmc, int index)
 	/* It has to be an INVALID block */
 	VERIFY(cacheblk->cache_state == INVALID);
 	/* It cannot be on the per-set hash */
-	VERIFY(cacheblk->hash_prev == FLASHCACHE_NULL);
 	VERIFY(cacheblk->hash_next == FLASHCACHE_NULL);
 	/* Insert this block at the head of the invalid list */
 	cache_set = &dmc->cache_sets[set];
+	VERIFY(cache_set->invalid_head != set_ix);
 	cacheblk->hash_next = cache_set->invalid_head;
-	if (cache_set->invalid_head != FLASHCACHE_NULL)
-		dmc->cache[start_index + cache_set->invalid_head].hash_prev = set_ix;
 	cache_set->invalid_head = set_ix;
 }
 
@@ -215,18 +185,8 @@ flashcache_invalid_remove(struct cache_c *dmc, int index)
 	set = index / dmc->assoc;
 	start_index = set * dmc-> assoc;
 	cache_set = &dmc->cache_sets[set];
-	if (cacheblk->hash_prev != FLASHCACHE_NULL) {
-		dmc->cache[start_index + cacheblk->hash_prev].hash_next = 
-			cacheblk->hash_next;
-	} else
-		cache_set->invalid_head = cacheblk->hash_next;
-	if (cacheblk->hash_next != FLASHCACHE_NULL) {
-		dmc->cache[start_index + cacheblk->hash_next].hash_prev = 
-			cacheblk->hash_prev;
-	}
-	cacheblk->hash_prev = FLASHCACHE_NULL;
-	cacheblk->hash_next = FLASHCACHE_NULL;
-	
+	flashcache_chain_unlink(dmc, start_index, &cache_set->invalid_head, 
+				index - start_index);
 }
 
 /* Cache set block hash management */
@@ -271,19 +231,12 @@ flashcache_hash_remove(struct cache_c *dmc, int index)
 	cache_set = &dmc->cache_sets[set];
 	cacheblk = &dmc->cache[index];
 	VERIFY(cacheblk->cache_state & VALID);
+#ifdef PREFETCHD_ON
+	flashcache_pfd_clear_admitted(dmc, index);
+#endif
 	start_index = set * dmc-> assoc;
 	hash_bucket = flashcache_get_hash_bucket(dmc, cache_set, cacheblk->dbn);
-	if (cacheblk->hash_prev != FLASHCACHE_NULL) {
-		dmc->cache[start_index + cacheblk->hash_prev].hash_next = 
-			cacheblk->hash_next;
-	} else
-		*hash_bucket = cacheblk->hash_next;
-	if (cacheblk->hash_next != FLASHCACHE_NULL) {
-		dmc->cache[start_index + cacheblk->hash_next].hash_prev = 
-			cacheblk->hash_prev;
-	}
-	cacheblk->hash_prev = FLASHCACHE_NULL;
-	cacheblk->hash_next = FLASHCACHE_NULL;
+	flashcache_chain_unlink(dmc, start_index, hash_bucket, index - start_index);
 }
 
 /* Must return -1 if not found ! */
@@ -332,6 +285,93 @@ flashcache_hash_lookup(struct cache_c *dmc,
 	return -1;
 }
 
+/*
+ * flashcache_hash_lookup() without the set lock, for read hits. The
+ * chain can change under us, so this may miss a block that is there,
+ * or return one that no longer holds dbn. The caller pins the block
+ * and checks it again. Bounded by assoc in case we follow a block
+ * onto another chain while it is being moved.
+ */
+int
+flashcache_hash_lookup_nolock(struct cache_c *dmc, 
+			      int set,
+			      sector_t dbn)
+{
+	struct cache_set *cache_set = &dmc->cache_sets[set];
+	struct cacheblock *cacheblk;
+	u_int16_t set_ix;
+	int index;
+	int i;
+
+	set_ix = ACCESS_ONCE(*flashcache_get_hash_bucket(dmc, cache_set, dbn));
+	for (i = 0 ; set_ix != FLASHCACHE_NULL && i < dmc->assoc ; i++) {
+		index = set * dmc->assoc + set_ix;
+		cacheblk = &dmc->cache[index];
+		if (dbn == ACCESS_ONCE(cacheblk->dbn))
+			return index;
+		set_ix = ACCESS_ONCE(cacheblk->hash_next);
+	}
+	return -1;
+}
+
+/*
+ * Read hits pin a block in its refs instead of marking it
+ * CACHEREADINPROG, so they do not serialize on a hot block and can pin
+ * it without the set lock (flashcache_read_hit_nolock()). A pinned
+ * block may still be invalidated or cleaned, neither of which touches
+ * its data on the SSD. Writing it, or giving it a new identity, needs
+ * the readers gone : the set lock holder claims the block, swapping a
+ * zero pin count for FLASHCACHE_BLOCK_CLAIMED, and unclaims it once the
+ * new state is set. Claims never outlive the set lock. The queued job
+ * count in the high half of refs only changes under the set lock, so
+ * only a racing pin can make the swap fail.
+ */
+int
+flashcache_block_claim(struct cache_c *dmc, int index)
+{
+	atomic_t *refs = &dmc->cache[index].refs;
+	int old = atomic_read(refs);
+
+	if (old & FLASHCACHE_PIN_MASK)
+		return 0;
+	return atomic_cmpxchg(refs, old, old | FLASHCACHE_BLOCK_CLAIMED) == old;
+}
+
+void
+flashcache_block_unclaim(struct cache_c *dmc, int index)
+{
+	/* Anyone who pins the block next must see its new state */
+	smp_wmb();
+	atomic_sub(FLASHCACHE_BLOCK_CLAIMED, &dmc->cache[index].refs);
+}
+
+/* 
+ * Fails while the block is claimed, which the set lock holder never
+ * sees, or with FLASHCACHE_PIN_MAX readers already on it.
+ */
+int
+flashcache_block_pin(struct cache_c *dmc, int index)
+{
+	atomic_t *refs = &dmc->cache[index].refs;
+	int old, prev;
+
+	old = atomic_read(refs);
+	while ((old & FLASHCACHE_PIN_MASK) < FLASHCACHE_PIN_MAX) {
+		prev = atomic_cmpxchg(refs, old, old + 1);
+		if (prev == old)
+			return 1;
+		old = prev;
+	}
+	return 0;
+}
+
+/* Drop a pin, returns 1 if it was the last */
+int
+flashcache_block_unpin(struct cache_c *dmc, int index)
+{
+	return (atomic_dec_return(&dmc->cache[index].refs) & FLASHCACHE_PIN_MASK) == 0;
+}
+
 /*
  * Cacheblock should be VALID and should NOT be on a hash bucket already.
  */
@@ -343,17 +383,13 @@ flashcache_hash_insert(struct cache_c *dmc,
 	struct cacheblock *cacheblk;
 	u_int16_t *hash_bucket;
 	u_int16_t set_ix = index % dmc->assoc;
-	int start_index = (index / dmc->assoc) * dmc->assoc;
 	
 	cacheblk = &dmc->cache[index];
 	VERIFY(cacheblk->cache_state & VALID);
 	hash_bucket = flashcache_get_hash_bucket(dmc, cache_set, cacheblk->dbn);
-	VERIFY(cacheblk->hash_prev == FLASHCACHE_NULL);
 	VERIFY(cacheblk->hash_next == FLASHCACHE_NULL);
-	cacheblk->hash_prev = FLASHCACHE_NULL;
+	VERIFY(*hash_bucket != set_ix);
 	cacheblk->hash_next = *hash_bucket;
-	if (*hash_bucket != FLASHCACHE_NULL)
-		dmc->cache[start_index + *hash_bucket].hash_prev = set_ix;
 	*hash_bucket = set_ix;
 }
 
@@ -387,7 +423,7 @@ flashcache_enq_pending(struct cache_c *dmc, struct bio* bio,
 	*head = job;
 	atomic_inc(&dmc->pending_jobs_count);
 	spin_unlock_irqrestore(&dmc->cache_pending_q_spinlock, flags);
-	dmc->cache[index].nr_queued++;
+	atomic_add(FLASHCACHE_QUEUED_ONE, &dmc->cache[index].refs);
 	dmc->flashcache_stats.enqueues++;
 }
 
@@ -460,7 +496,7 @@ flashcache_read_compute_checksum(struct cache_c *dmc, int index, void *block)
 		sum += *idx++;
 		cnt -= sizeof(u_int64_t);		
 	}
-	dmc->cache[index].checksum = sum;
+	dmc->cache_cold[index].checksum = sum;
 	return 0;
 }
 
@@ -500,7 +536,7 @@ flashcache_store_checksum(struct kcached_job *job)
 	
 	sum = flashcache_compute_checksum(job->bio);
 	spin_lock_irqsave(&dmc->cache_sets[set].set_spin_lock, flags);
-	job->dmc->cache[job->index].checksum = sum;
+	job->dmc->cache_cold[job->index].checksum = sum;
 	spin_unlock_irqrestore(&dmc->cache_sets[set].set_spin_lock, flags);
 }
 
@@ -514,7 +550,7 @@ flashcache_validate_checksum(struct kcached_job *job)
 	
 	sum = flashcache_compute_checksum(job->bio);
 	spin_lock_irqsave(&dmc->cache_sets[set].set_spin_lock, flags);
-	if (likely(job->dmc->cache[job->index].checksum == sum)) {
+	if (likely(job->dmc->cache_cold[job->index].checksum == sum)) {
 		job->dmc->flashcache_stats.checksum_valid++;		
 		retval = 0;
 	} else {
@@ -528,145 +564,190 @@ flashcache_validate_checksum(struct kcached_job *job)
 
 /*
  * Functions to push and pop a job onto the head of a given job list.
+ * A job goes on the lists of the CPU that completed the I/O before it,
+ * and the work item of those lists is queued on that CPU.
  */
-struct kcached_job *
-pop(struct list_head *jobs)
+static void
+push(struct cache_c *dmc, int list, struct list_head *entry)
 {
-	struct kcached_job *job = NULL;
+	struct flashcache_job_queue *q;
+	unsigned long flags;
 
-	spin_lock_irq(&_job_lock);
-	if (!list_empty(jobs)) {
-		job = list_entry(jobs->next, struct kcached_job, list);
-		list_del(&job->list);
-	}
-	spin_unlock_irq(&_job_lock);
-	return job;
+	q = per_cpu_ptr(dmc->job_queues, get_cpu());
+	spin_lock_irqsave(&q->lock, flags);
+	list_add_tail(entry, &q->jobs[list]);
+	spin_unlock_irqrestore(&q->lock, flags);
+	queue_work(dmc->kcached_wq, &q->work);
+	put_cpu();
 }
 
-void 
-push(struct list_head *jobs, struct kcached_job *job)
+static struct list_head *
+pop(struct flashcache_job_queue *q, int list)
 {
-	unsigned long flags;
+	struct list_head *entry = NULL;
 
-	spin_lock_irqsave(&_job_lock, flags);
-	list_add_tail(&job->list, jobs);
-	spin_unlock_irqrestore(&_job_lock, flags);
+	spin_lock_irq(&q->lock);
+	if (!list_empty(&q->jobs[list])) {
+		entry = q->jobs[list].next;
+		list_del(entry);
+	}
+	spin_unlock_irq(&q->lock);
+	return entry;
 }
 
 void
 push_pending(struct kcached_job *job)
 {
-	push(&_pending_jobs, job);	
+	push(job->dmc, FLASHCACHE_JOBS_PENDING, &job->list);
 }
 
 void
 push_io(struct kcached_job *job)
 {
-	push(&_io_jobs, job);	
+	push(job->dmc, FLASHCACHE_JOBS_IO, &job->list);
 }
 
 void
 push_uncached_io_complete(struct kcached_job *job)
 {
-	push(&_uncached_io_complete_jobs, job);	
+	push(job->dmc, FLASHCACHE_JOBS_UNCACHED_IO_COMPLETE, &job->list);
 }
 
 void
 push_md_io(struct kcached_job *job)
 {
-	push(&_md_io_jobs, job);	
+	push(job->dmc, FLASHCACHE_JOBS_MD_IO, &job->list);
 }
 
 void
 push_md_complete(struct kcached_job *job)
 {
-	push(&_md_complete_jobs, job);	
-}
-
-void 
-push_cleaning(struct list_head *jobs, struct flashcache_copy_job *job)
-{
-	unsigned long flags;
-
-	spin_lock_irqsave(&_job_lock, flags);
-	list_add_tail(&job->list, jobs);
-	spin_unlock_irqrestore(&_job_lock, flags);
-}
-
-struct flashcache_copy_job *
-pop_cleaning(struct list_head *jobs)
-{
-	struct flashcache_copy_job *job = NULL;
-
-	spin_lock_irq(&_job_lock);
-	if (!list_empty(jobs)) {
-		job = list_entry(jobs->next, struct flashcache_copy_job, list);
-		list_del(&job->list);
-	}
-	spin_unlock_irq(&_job_lock);
-	return job;
+	push(job->dmc, FLASHCACHE_JOBS_MD_COMPLETE, &job->list);
 }
 
 void
 push_cleaning_read_complete(struct flashcache_copy_job *job)
 {
-	push_cleaning(&_cleaning_read_complete_jobs, job);
+	push(job->dmc, FLASHCACHE_JOBS_CLEANING_READ_COMPLETE, &job->list);
 }
 
 void
 push_cleaning_write_complete(struct flashcache_copy_job *job)
 {
-	push_cleaning(&_cleaning_write_complete_jobs, job);
+	push(job->dmc, FLASHCACHE_JOBS_CLEANING_WRITE_COMPLETE, &job->list);
 }
 
 #define FLASHCACHE_YIELD	32
 
 static void
-process_jobs(struct list_head *jobs,
+process_jobs(struct flashcache_job_queue *q, int list,
 	     void (*fn) (struct kcached_job *))
 {
-	struct kcached_job *job;
+	struct list_head *entry;
 	int done = 0;
 
-	while ((job = pop(jobs))) {
+	while ((entry = pop(q, list))) {
 		if (done++ >= FLASHCACHE_YIELD) {
 			yield();
 			done = 0;
 		}
-		(void)fn(job);
+		(void)fn(list_entry(entry, struct kcached_job, list));
 	}
 }
 
 static void
-process_clean_jobs(struct list_head *jobs,
+process_clean_jobs(struct flashcache_job_queue *q, int list,
 		   void (*fn) (struct flashcache_copy_job *))
 {
-	struct flashcache_copy_job *job;
+	struct list_head *entry;
 	int done = 0;
 
-	while ((job = pop_cleaning(jobs))) {
+	while ((entry = pop(q, list))) {
 		if (done++ >= FLASHCACHE_YIELD) {
 			yield();
 			done = 0;
 		}
-		(void)fn(job);
+		(void)fn(list_entry(entry, struct flashcache_copy_job, list));
 	}
 }
 
 void 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
-do_work(void *unused)
+do_work(void *data)
+{
+	struct flashcache_job_queue *q = data;
+#else
+do_work(struct work_struct *work)
+{
+	struct flashcache_job_queue *q = 
+		container_of(work, struct flashcache_job_queue, work);
+#endif
+
+	process_jobs(q, FLASHCACHE_JOBS_MD_COMPLETE, flashcache_md_write_done);
+	process_jobs(q, FLASHCACHE_JOBS_PENDING, flashcache_do_pending);
+	process_jobs(q, FLASHCACHE_JOBS_MD_IO, flashcache_md_write_kickoff);
+	process_jobs(q, FLASHCACHE_JOBS_IO, flashcache_do_io);
+	process_jobs(q, FLASHCACHE_JOBS_UNCACHED_IO_COMPLETE, 
+		     flashcache_uncached_io_complete);
+	process_clean_jobs(q, FLASHCACHE_JOBS_CLEANING_READ_COMPLETE, 
+			   flashcache_clean_write_kickoff);
+	process_clean_jobs(q, FLASHCACHE_JOBS_CLEANING_WRITE_COMPLETE, 
+			   flashcache_clean_md_write_kickoff);
+}
+
+int
+flashcache_job_queues_init(struct cache_c *dmc)
+{
+	struct flashcache_job_queue *q;
+	int cpu, i;
+
+	dmc->job_queues = alloc_percpu(struct flashcache_job_queue);
+	if (dmc->job_queues == NULL)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		q = per_cpu_ptr(dmc->job_queues, cpu);
+		spin_lock_init(&q->lock);
+		for (i = 0 ; i < FLASHCACHE_NR_JOB_LISTS ; i++)
+			INIT_LIST_HEAD(&q->jobs[i]);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+		INIT_WORK(&q->work, do_work, q);
+#else
+		INIT_WORK(&q->work, do_work);
+#endif
+		q->dmc = dmc;
+	}
+	/* 
+	 * Bound to CPUs, so the work runs where it was queued. Jobs are on 
+	 * the path that frees memory, so keep a rescuer.
+	 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
+	dmc->kcached_wq = create_workqueue("kcached");
 #else
-do_work(struct work_struct *unused)
+	dmc->kcached_wq = alloc_workqueue("kcached", WQ_MEM_RECLAIM, 0);
 #endif
+	if (dmc->kcached_wq == NULL) {
+		free_percpu(dmc->job_queues);
+		dmc->job_queues = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void
+flashcache_job_queues_destroy(struct cache_c *dmc)
 {
-	process_jobs(&_md_complete_jobs, flashcache_md_write_done);
-	process_jobs(&_pending_jobs, flashcache_do_pending);
-	process_jobs(&_md_io_jobs, flashcache_md_write_kickoff);
-	process_jobs(&_io_jobs, flashcache_do_io);
-	process_jobs(&_uncached_io_complete_jobs, flashcache_uncached_io_complete);
-	process_clean_jobs(&_cleaning_read_complete_jobs, flashcache_clean_write_kickoff);
-	process_clean_jobs(&_cleaning_write_complete_jobs, flashcache_clean_md_write_kickoff);	
+	int cpu, i;
+
+	if (dmc->job_queues == NULL)
+		return;
+	/* Runs all the queued work first */
+	destroy_workqueue(dmc->kcached_wq);
+	for_each_possible_cpu(cpu)
+		for (i = 0 ; i < FLASHCACHE_NR_JOB_LISTS ; i++)
+			VERIFY(list_empty(&per_cpu_ptr(dmc->job_queues, cpu)->jobs[i]));
+	free_percpu(dmc->job_queues);
+	dmc->job_queues = NULL;
+	dmc->kcached_wq = NULL;
 }
 
 struct kcached_job *
@@ -734,6 +815,10 @@ flashcache_bio_endio(struct bio *bio, int error,
 		     start_time != NULL && 
 		     start_time->tv_sec != 0))
 		flashcache_record_latency(dmc, start_time);
+#ifdef PREFETCHD_ON
+	if (bio_data_dir(bio) == WRITE)
+		pfd_cache_invalidate(dmc, bio->bi_iter.bi_sector, bio_sectors(bio));
+#endif
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 	bio_endio(bio, bio->bi_iter.bi_size, error);
 #elif LINUX_VERSION_CODE < KERNEL_VERSION(4,3,0)
@@ -1068,8 +1153,8 @@ EXPORT_SYMBOL(flashcache_alloc_cache_job);
 EXPORT_SYMBOL(flashcache_free_cache_job);
 EXPORT_SYMBOL(flashcache_alloc_pending_job);
 EXPORT_SYMBOL(flashcache_free_pending_job);
-EXPORT_SYMBOL(pop);
-EXPORT_SYMBOL(push);
+EXPORT_SYMBOL(flashcache_job_queues_init);
+EXPORT_SYMBOL(flashcache_job_queues_destroy);
 EXPORT_SYMBOL(push_pending);
 EXPORT_SYMBOL(push_io);
 EXPORT_SYMBOL(push_md_io);
@@ -1,8 +1,14 @@
 #include <linux/version.h>
+#include <linux/module.h>
 #include <linux/types.h>
 #include <linux/spinlock.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
 #include <linux/bio.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
 #include <stdbool.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,26)
@@ -34,114 +40,456 @@ enum pfd_cache_meta_status {
 	valid,
 };
 
-struct pfd_cache_set;
+enum pfd_cache_copy_status {
+	copy_miss = 1,
+	copy_hit,
+	copy_parked,
+};
+
 struct pfd_cache;
 struct pfd_cache_meta;
 
+/*
+ * dbn, status, used, fresh, stamp and waiters of a meta are protected
+ * by the lock of the set the meta belongs to.
+ */
 struct pfd_cache_meta {
 	struct pfd_cache *cache;
 
-	struct semaphore prepare_lock;
-	spinlock_t lock;
-	spinlock_t lock_interrupt;
+	/* Demand bios parked until the prefetch lands, see complete_meta() */
+	struct bio_list waiters;
 
 	sector_t dbn;
 	enum pfd_cache_meta_status status;
 	atomic_t hold_count;
 
+	/* Read by a demand bio since it was prefetched */
+	bool used;
+	/* Prefetched and not yet passed over by the replacement */
+	bool fresh;
+	/* Overwritten while the prefetch was in flight */
+	bool stale;
+	unsigned long stamp;
+
+	/* Stream the block was prefetched for, see pfd_stat_feedback() */
+	unsigned int stream;
+	unsigned int stream_gen;
+
 	int ssd_index;
+
+	/* Pending SSD admission, see admit_meta() */
+	struct pfd_cache_meta *admit_next;
+	struct kcached_job *admit_job;
 };
 
+/*
+ * The buffer is PFD_CACHE_ASSOC-way set-associative. A dbn may live in
+ * any way of the set it hashes to, so streams that collide on a set no
+ * longer throw each other out on every prefetch.
+ */
+struct pfd_cache_set {
+	spinlock_t lock;
+	unsigned long tick;
+} ____cacheline_aligned_in_smp;
+
 struct pfd_cache {
-	struct pfd_cache_set *cache_set;
 	struct cache_c *dmc;
-	struct pfd_cache_meta metas[PFD_CACHE_BLOCK_COUNT];
+	struct pfd_cache_meta *metas;
+	struct pfd_cache_set *sets;
+	int nr_blocks;
+	int nr_sets;
+	int assoc;
+
+	/*
+	 * When a block is a whole number of pages its data lives in
+	 * separate pages, chained per block in pl so that a block can be
+	 * handed to dm_io as is. Otherwise all blocks share one vmalloc
+	 * area at data.
+	 */
+	struct page_list *pl;
+	int nr_pages;
 	void *data;
 	spinlock_t lock;
+	struct list_head list;
+
+	/*
+	 * One reference is held by the device while dmc->pfd_cache points
+	 * here, one by every lookup in progress, one by queued
+	 * prefetch_work or resubmit_work, one by every meta in prepare
+	 * and one by every meta queued for or in SSD admission. The buffer is
+	 * freed once it has been detached and the count drops to zero.
+	 */
+	atomic_t ref;
+	wait_queue_head_t ref_wait;
+
+	/* Metas in prepare, bounded by dmc->sysctl_pfd_max_inflight */
+	atomic_t nr_inflight;
+
+	/*
+	 * Token bucket of dmc->sysctl_pfd_max_rate, in blocks, holding at
+	 * most a second worth. prefetch_work may run on several CPUs at
+	 * once, so it takes its tokens under tokens_lock.
+	 */
+	spinlock_t tokens_lock;
+	long tokens;
+	unsigned long tokens_stamp;
+
+	/*
+	 * Prefetch requests handed over by the read path. They are issued
+	 * by prefetch_work on pfd_wq, so the demand read never pays for
+	 * the speculative IO. A stream has at most one request queued,
+	 * a newer one replaces it. When the ring is full new requests are
+	 * dropped.
+	 */
+	spinlock_t queue_lock;
+	struct pfd_stat_info queue[PFD_CACHE_QUEUE_DEPTH];
+	int queue_head;
+	int queue_count;
+	struct work_struct prefetch_work;
+
+	/*
+	 * Parked bios the landed prefetch could not finish, because it
+	 * failed or the bio spans other blocks. resubmit_work hands them
+	 * back to the read path from process context.
+	 */
+	spinlock_t resubmit_lock;
+	struct bio_list resubmit;
+	struct work_struct resubmit_work;
+
+	/*
+	 * Blocks read from disk that admit_work writes to the SSD as well,
+	 * when dmc->sysctl_pfd_admit_pct is set. Each queued meta is held
+	 * until its SSD write is done. At most PFD_CACHE_MAX_ADMIT are
+	 * queued, more are not admitted.
+	 */
+	spinlock_t admit_lock;
+	struct pfd_cache_meta *admit_head;
+	struct pfd_cache_meta *admit_tail;
+	int admit_count;
+	struct work_struct admit_work;
 };
 
-enum cache_set_init_status {
-	set_empty = 1,
-	set_prepare,
-	set_valid,
-};
-
-struct pfd_cache_set {
-	int count;
-	enum cache_set_init_status status_arr[PFD_CACHE_COUNT_PER_SET];
-	struct cache_c *dmc_arr[PFD_CACHE_COUNT_PER_SET];
-	struct pfd_cache *caches[PFD_CACHE_COUNT_PER_SET];
-	spinlock_t lock;
-};
-
-static struct pfd_cache_set main_cache_set;
+static int pfd_cache_blocks = PFD_CACHE_DEFAULT_BLOCKS;
+module_param(pfd_cache_blocks, int, 0444);
+MODULE_PARM_DESC(pfd_cache_blocks, "Default number of prefetch buffer blocks per cache device");
+
+/* Prefetched blocks in flight on all devices, bounded by pfd_global_inflight */
+static atomic_t pfd_inflight_all = ATOMIC_INIT(0);
+static int pfd_global_inflight = PFD_CACHE_GLOBAL_INFLIGHT;
+module_param(pfd_global_inflight, int, 0644);
+MODULE_PARM_DESC(pfd_global_inflight, "Most blocks prefetched at once on all cache devices, 0 for no limit");
+
+/*
+ * dmc->pfd_cache and the list of live buffers are protected by
+ * pfd_caches_lock. Resizes are serialized by pfd_cache_resize_mutex.
+ */
+static LIST_HEAD(pfd_caches);
+static DEFINE_SPINLOCK(pfd_caches_lock);
+static DEFINE_MUTEX(pfd_cache_resize_mutex);
 static struct dm_io_client *hdd_client;
 static struct dm_io_client *ssd_client;
+static struct workqueue_struct *pfd_wq;
+static struct bio_set *pfd_bio_set;
 
-inline int
-dbn_to_cache_index(
+static void pfd_cache_do_work(struct work_struct *work);
+static void pfd_cache_do_resubmit(struct work_struct *work);
+static void pfd_cache_do_admit(struct work_struct *work);
+
+static inline int
+dbn_to_set(
 		struct pfd_cache *cache,
 		sector_t dbn) {
 	return (int)
-		((dbn >> cache->dmc->block_shift) % PFD_CACHE_BLOCK_COUNT);
+		((dbn >> cache->dmc->block_shift) % cache->nr_sets);
 }
 
-static struct pfd_cache *
-find_cache_in_cache_set(
-		struct cache_c *dmc,
-		struct pfd_cache_set *cache_set) {
+static inline int
+meta_to_index(struct pfd_cache_meta *meta) {
+	return (int)(meta - meta->cache->metas);
+}
+
+static inline int
+pages_per_block(struct cache_c *dmc) {
+	return (int)(((unsigned long)dmc->block_size << SECTOR_SHIFT) >> PAGE_SHIFT);
+}
+
+static inline bool
+block_is_whole_pages(struct cache_c *dmc) {
+	return (((unsigned long)dmc->block_size << SECTOR_SHIFT) & ~PAGE_MASK) == 0;
+}
+
+/* Only for buffers backed by the vmalloc area */
+static inline void *
+meta_to_data(struct pfd_cache_meta *meta) {
+	struct pfd_cache *cache = meta->cache;
+
+	return cache->data + ((unsigned long)meta_to_index(meta) <<
+			(SECTOR_SHIFT + cache->dmc->block_shift));
+}
+
+/* Only for buffers backed by pages */
+static inline struct page_list *
+meta_to_pl(struct pfd_cache_meta *meta) {
+	struct pfd_cache *cache = meta->cache;
+
+	return &(cache->pl[meta_to_index(meta) * pages_per_block(cache->dmc)]);
+}
+
+static struct page *
+meta_to_page(struct pfd_cache_meta *meta, int i) {
+	if (meta->cache->pl != NULL)
+		return meta_to_pl(meta)[i].page;
+	return vmalloc_to_page(meta_to_data(meta) + i * PAGE_SIZE);
+}
+
+static void
+copy_from_meta(
+		struct pfd_cache_meta *meta,
+		unsigned int offset,
+		void *dest,
+		unsigned int len) {
+	struct page_list *pl;
+	unsigned int page_offset;
+	unsigned int chunk;
+	void *src;
+
+	if (meta->cache->pl == NULL) {
+		memcpy(dest, meta_to_data(meta) + offset, len);
+		return;
+	}
+
+	pl = meta_to_pl(meta) + (offset >> PAGE_SHIFT);
+	page_offset = offset & ~PAGE_MASK;
+	while (len > 0) {
+		chunk = min(len, (unsigned int)PAGE_SIZE - page_offset);
+		src = kmap_atomic(pl->page);
+		memcpy(dest, src + page_offset, chunk);
+		kunmap_atomic(src);
+		dest += chunk;
+		len -= chunk;
+		page_offset = 0;
+		pl++;
+	}
+}
 
+/* Round a requested size down to whole sets */
+static int
+pfd_cache_round_blocks(int nr_blocks) {
+	if (nr_blocks <= PFD_CACHE_ASSOC)
+		return nr_blocks;
+	return nr_blocks - nr_blocks % PFD_CACHE_ASSOC;
+}
+
+/*
+ * Find the way of set set_idx holding dbn. Called with the set lock
+ * held.
+ */
+static struct pfd_cache_meta *
+lookup_meta(
+		struct pfd_cache *cache,
+		int set_idx,
+		sector_t dbn) {
+	struct pfd_cache_meta *meta = &(cache->metas[set_idx * cache->assoc]);
 	int i;
 
-	for (i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		if (cache_set->status_arr[i] == set_valid && cache_set->dmc_arr[i] == dmc)
-			return cache_set->caches[i];
+	for (i = 0; i < cache->assoc; i++, meta++) {
+		if (meta->status != empty && meta->dbn == dbn)
+			return meta;
 	}
 
 	return NULL;
 }
 
+/*
+ * Pick the way of set set_idx a new prefetch goes to. Empty ways come
+ * first, then the least recently used of the blocks that were already
+ * read, then the least recently used of the unread blocks that were
+ * passed over once. Unread blocks are protected on the first pass:
+ * when nothing else can be evicted they lose their fresh mark and the
+ * new prefetch is dropped. Called with the set lock held.
+ */
+static struct pfd_cache_meta *
+find_victim(
+		struct pfd_cache *cache,
+		int set_idx) {
+	struct pfd_cache_meta *base = &(cache->metas[set_idx * cache->assoc]);
+	struct pfd_cache_meta *meta;
+	struct pfd_cache_meta *used = NULL;
+	struct pfd_cache_meta *stale = NULL;
+	int i;
+
+	for (i = 0; i < cache->assoc; i++) {
+		meta = &base[i];
+		if (meta->status == prepare ||
+				atomic_read(&(meta->hold_count)) > 0)
+			continue;
+		if (meta->status == empty)
+			return meta;
+		if (meta->used) {
+			if (used == NULL || meta->stamp < used->stamp)
+				used = meta;
+		} else if (!meta->fresh) {
+			if (stale == NULL || meta->stamp < stale->stamp)
+				stale = meta;
+		}
+	}
+
+	if (used != NULL)
+		return used;
+	if (stale != NULL) {
+		cache->dmc->pfd_cache_stats.evicted_unused++;
+		pfd_stat_feedback(cache->dmc, stale->stream,
+				stale->stream_gen, PFD_STAT_WASTED);
+		return stale;
+	}
+
+	for (i = 0; i < cache->assoc; i++) {
+		if (base[i].status == valid)
+			base[i].fresh = false;
+	}
+	return NULL;
+}
+
+static struct pfd_cache *
+get_pfd_cache(struct cache_c *dmc) {
+	struct pfd_cache *cache;
+	long flags;
+
+	spin_lock_irqsave(&pfd_caches_lock, flags);
+	cache = dmc->pfd_cache;
+	if (cache != NULL)
+		atomic_inc(&(cache->ref));
+	spin_unlock_irqrestore(&pfd_caches_lock, flags);
+
+	return cache;
+}
+
+static inline void
+put_pfd_cache(struct pfd_cache *cache) {
+	if (atomic_dec_and_test(&(cache->ref)))
+		wake_up(&(cache->ref_wait));
+}
+
+static void
+free_pfd_cache(struct pfd_cache *cache) {
+	int i;
+
+	if (cache->pl != NULL) {
+		for (i = 0; i < cache->nr_pages; i++) {
+			if (cache->pl[i].page != NULL)
+				__free_page(cache->pl[i].page);
+		}
+		vfree((void *)cache->pl);
+	}
+	vfree(cache->data);
+	vfree((void *)cache->sets);
+	vfree((void *)cache->metas);
+	kfree(cache);
+}
+
 static struct pfd_cache *
-init_pfd_cache(
+alloc_pfd_cache(
 		struct cache_c *dmc,
-		struct pfd_cache_set *cache_set,
-		int idx) {
+		int nr_blocks) {
 
 	struct pfd_cache *cache;
 	struct pfd_cache_meta *meta;
+	int nr_pages = pages_per_block(dmc);
 	int i;
 
-	cache = (struct pfd_cache *)vmalloc(sizeof(struct pfd_cache));
+	cache = kzalloc(sizeof(struct pfd_cache), GFP_KERNEL);
 	if (cache == NULL)
 		return NULL;
-	cache->data = vmalloc(
-			PFD_CACHE_BLOCK_COUNT << (SECTOR_SHIFT + dmc->block_shift));
-	if (cache->data == NULL)
+	cache->assoc = nr_blocks < PFD_CACHE_ASSOC ? nr_blocks : PFD_CACHE_ASSOC;
+	cache->nr_sets = nr_blocks / cache->assoc;
+	cache->nr_blocks = cache->nr_sets * cache->assoc;
+	cache->metas = vzalloc(cache->nr_blocks * sizeof(struct pfd_cache_meta));
+	cache->sets = vzalloc(cache->nr_sets * sizeof(struct pfd_cache_set));
+	if (cache->metas == NULL || cache->sets == NULL)
 		goto free_cache;
 
-	cache_set->caches[idx] = cache;
-	cache->cache_set = cache_set;
+	if (block_is_whole_pages(dmc)) {
+		cache->nr_pages = cache->nr_blocks * nr_pages;
+		cache->pl = vzalloc(cache->nr_pages * sizeof(struct page_list));
+		if (cache->pl == NULL)
+			goto free_cache;
+		for (i = 0; i < cache->nr_pages; i++) {
+			cache->pl[i].page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+			if (cache->pl[i].page == NULL)
+				goto free_cache;
+			cache->pl[i].next = (i + 1) % nr_pages == 0 ?
+				NULL : &(cache->pl[i + 1]);
+		}
+	} else {
+		cache->data = vmalloc(
+				(unsigned long)cache->nr_blocks << (SECTOR_SHIFT + dmc->block_shift));
+		if (cache->data == NULL)
+			goto free_cache;
+	}
+
 	cache->dmc = dmc;
-	for (i = 0; i < PFD_CACHE_BLOCK_COUNT; i++) {
+	for (i = 0; i < cache->nr_blocks; i++) {
 		meta = &(cache->metas[i]);
 		meta->cache = cache;
 		meta->status = empty;
 		atomic_set(&(meta->hold_count), 0);
-		spin_lock_init(&(meta->lock));
-		spin_lock_init(&(meta->lock_interrupt));
+		bio_list_init(&(meta->waiters));
 	}
+	for (i = 0; i < cache->nr_sets; i++)
+		spin_lock_init(&(cache->sets[i].lock));
 	spin_lock_init(&(cache->lock));
+	INIT_LIST_HEAD(&(cache->list));
+	atomic_set(&(cache->ref), 1);
+	atomic_set(&(cache->nr_inflight), 0);
+	spin_lock_init(&(cache->tokens_lock));
+	cache->tokens = 0;
+	cache->tokens_stamp = jiffies;
+	init_waitqueue_head(&(cache->ref_wait));
+	spin_lock_init(&(cache->queue_lock));
+	cache->queue_head = 0;
+	cache->queue_count = 0;
+	INIT_WORK(&(cache->prefetch_work), pfd_cache_do_work);
+	spin_lock_init(&(cache->resubmit_lock));
+	bio_list_init(&(cache->resubmit));
+	INIT_WORK(&(cache->resubmit_work), pfd_cache_do_resubmit);
+	spin_lock_init(&(cache->admit_lock));
+	cache->admit_head = NULL;
+	cache->admit_tail = NULL;
+	cache->admit_count = 0;
+	INIT_WORK(&(cache->admit_work), pfd_cache_do_admit);
 
 	return cache;
 
 free_cache:
-	vfree((void *)cache);
+	free_pfd_cache(cache);
 	return NULL;
 }
 
-int pfd_cache_init() {
-	int i;
+/*
+ * Unhook the buffer of dmc and free it once queued work and in-flight
+ * prefetches are done with it. Called with pfd_cache_resize_mutex held.
+ */
+static void
+detach_pfd_cache(struct cache_c *dmc) {
+	struct pfd_cache *cache;
+	long flags;
+
+	spin_lock_irqsave(&pfd_caches_lock, flags);
+	cache = dmc->pfd_cache;
+	dmc->pfd_cache = NULL;
+	if (cache != NULL)
+		list_del(&(cache->list));
+	spin_unlock_irqrestore(&pfd_caches_lock, flags);
+
+	if (cache == NULL)
+		return;
 
+	put_pfd_cache(cache);
+	wait_event(cache->ref_wait, atomic_read(&(cache->ref)) == 0);
+	free_pfd_cache(cache);
+}
+
+int pfd_cache_init() {
 	hdd_client = dm_io_client_create();
 	if (IS_ERR(hdd_client))
 		return -1;
@@ -150,16 +498,20 @@ int pfd_cache_init() {
 	if (IS_ERR(ssd_client))
 		goto free_hdd_client;
 
-	main_cache_set.count = 0;
-	spin_lock_init(&(main_cache_set.lock));
-	for (i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		main_cache_set.status_arr[i] = set_empty;
-		main_cache_set.dmc_arr[i] = NULL;
-		main_cache_set.caches[i] = NULL;
-	}
+	pfd_wq = alloc_workqueue("kprefetchd", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (pfd_wq == NULL)
+		goto free_ssd_client;
+
+	pfd_bio_set = bioset_create(BIO_POOL_SIZE, 0);
+	if (pfd_bio_set == NULL)
+		goto free_wq;
 
 	return 0;
 
+free_wq:
+	destroy_workqueue(pfd_wq);
+free_ssd_client:
+	dm_io_client_destroy(ssd_client);
 free_hdd_client:
 	dm_io_client_destroy(hdd_client);
 
@@ -167,168 +519,526 @@ free_hdd_client:
 }
 
 void pfd_cache_exit() {
-	int i;
-	struct pfd_cache *cache;
-
+	destroy_workqueue(pfd_wq);
+	bioset_free(pfd_bio_set);
 	dm_io_client_destroy(hdd_client);
 	dm_io_client_destroy(ssd_client);
-	for (i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		cache = main_cache_set.caches[i];
-		if (cache != NULL) {
-			vfree((void *)(cache->data));
-			vfree((void *)cache);
-		}
-	}
 }
 
-void pfd_cache_add(struct cache_c *dmc) {
-	struct pfd_cache *cache = NULL;
-	int i;
+/*
+ * Replace the prefetch buffer of dmc with one of nr_blocks blocks. The
+ * old buffer is freed before the new one is allocated, so a resize
+ * never needs both at once. nr_blocks == 0 turns prefetching off for
+ * the device.
+ */
+int pfd_cache_resize(struct cache_c *dmc, int nr_blocks) {
+	struct pfd_cache *cache;
 	long flags;
 
-	spin_lock_irqsave(&(main_cache_set.lock), flags);
+	if (nr_blocks < 0 || nr_blocks > PFD_CACHE_MAX_BLOCKS)
+		return -EINVAL;
+	nr_blocks = pfd_cache_round_blocks(nr_blocks);
 
-	for (i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		if (main_cache_set.status_arr[i] != set_empty &&
-				main_cache_set.dmc_arr[i] == dmc) {
-			spin_unlock_irqrestore(&(main_cache_set.lock), flags);
-			MPPRINTK("pfd_cache already exist.");
-			return;
-		}
-	}
+	mutex_lock(&pfd_cache_resize_mutex);
 
-	if (main_cache_set.count == PFD_CACHE_COUNT_PER_SET) {
-		spin_unlock_irqrestore(&(main_cache_set.lock), flags);
-		MPPRINTK("\033[0;32;31mNo room to add pfd_cache.");
-		return;
+	cache = dmc->pfd_cache;
+	if ((cache == NULL && nr_blocks == 0) ||
+			(cache != NULL && cache->nr_blocks == nr_blocks)) {
+		mutex_unlock(&pfd_cache_resize_mutex);
+		return 0;
 	}
 
-	for(i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		if (main_cache_set.status_arr[i] == set_empty) {
-			main_cache_set.status_arr[i] = set_prepare;
-			main_cache_set.dmc_arr[i] = dmc;
-			main_cache_set.count += 1;
-			break;
-		}
-	}
-	spin_unlock_irqrestore(&(main_cache_set.lock), flags);
-
-	if (i < PFD_CACHE_COUNT_PER_SET) {
-		cache = init_pfd_cache(dmc, &main_cache_set, i);
-		spin_lock_irqsave(&(main_cache_set.lock), flags);
-		if (cache == NULL) {
-			main_cache_set.status_arr[i] = set_empty;
-			main_cache_set.dmc_arr[i] = NULL;
-			main_cache_set.count -= 1;
-		} else {
-			main_cache_set.status_arr[i] = set_valid;
-		}
-		spin_unlock_irqrestore(&(main_cache_set.lock), flags);
+	detach_pfd_cache(dmc);
+	dmc->sysctl_pfd_cache_blocks = 0;
+
+	if (nr_blocks == 0) {
+		mutex_unlock(&pfd_cache_resize_mutex);
+		MPPRINTK("pfd_cache disabled.");
+		return 0;
 	}
 
+	cache = alloc_pfd_cache(dmc, nr_blocks);
 	if (cache == NULL) {
-		MPPRINTK("\033[0;32;31mCan't alloc new pfd_cache.");
-	} else {
-		MPPRINTK("\033[0;32;32mNew pfd_cache created.");
+		mutex_unlock(&pfd_cache_resize_mutex);
+		MPPRINTK("\033[0;32;31mCan't alloc pfd_cache of %d blocks.", nr_blocks);
+		return -ENOMEM;
 	}
+
+	spin_lock_irqsave(&pfd_caches_lock, flags);
+	dmc->pfd_cache = cache;
+	list_add_tail(&(cache->list), &pfd_caches);
+	spin_unlock_irqrestore(&pfd_caches_lock, flags);
+	dmc->sysctl_pfd_cache_blocks = nr_blocks;
+
+	mutex_unlock(&pfd_cache_resize_mutex);
+
+	MPPRINTK("\033[0;32;32mpfd_cache of %d blocks (%d-way) created.",
+			nr_blocks, cache->assoc);
+	return 0;
 }
 
-bool pfd_cache_handle_bio(
-		struct cache_c *dmc,
-		struct bio *bio) {
+void pfd_cache_add(struct cache_c *dmc) {
+	int nr_blocks = pfd_cache_blocks;
+
+	if (nr_blocks < 0)
+		nr_blocks = 0;
+	if (nr_blocks > PFD_CACHE_MAX_BLOCKS)
+		nr_blocks = PFD_CACHE_MAX_BLOCKS;
+
+	dmc->pfd_cache = NULL;
+	dmc->sysctl_pfd_cache_blocks = 0;
+	dmc->sysctl_pfd_max_inflight = PFD_CACHE_DEFAULT_INFLIGHT;
+	dmc->sysctl_pfd_max_rate = 0;
+	pfd_cache_resize(dmc, nr_blocks);
+}
+
+void pfd_cache_remove(struct cache_c *dmc) {
+	mutex_lock(&pfd_cache_resize_mutex);
+	detach_pfd_cache(dmc);
+	mutex_unlock(&pfd_cache_resize_mutex);
+}
+
+/*
+ * Copy bytes of meta, starting offset bytes into the block, to the bio
+ * at iter. Safe in interrupt context. The caller holds the meta.
+ */
+static void
+copy_meta_to_bio(
+		struct pfd_cache_meta *meta,
+		unsigned int offset,
+		unsigned int bytes,
+		struct bio *bio,
+		struct bvec_iter *iter) {
+
+	struct bio_vec bvec;
+	void *data_dest;
+	unsigned int len;
+
+	while (bytes > 0) {
+		bvec = bio_iter_iovec(bio, *iter);
+		len = min(bytes, bvec.bv_len);
+		data_dest = kmap_atomic(bvec.bv_page);
+		copy_from_meta(meta, offset, data_dest + bvec.bv_offset, len);
+		kunmap_atomic(data_dest);
+		offset += len;
+		bytes -= len;
+		bio_advance_iter(bio, iter, len);
+	}
+}
+
+/*
+ * Copy bytes of block dbn, starting offset bytes into the block, to
+ * the bio at iter. iter is advanced whether the block is in the
+ * buffer or not. When the block is still being prefetched the bio is
+ * parked on it instead, and complete_meta() takes it over.
+ */
+static enum pfd_cache_copy_status
+copy_block_to_bio(
+		struct pfd_cache *cache,
+		sector_t dbn,
+		unsigned int offset,
+		unsigned int bytes,
+		struct bio *bio,
+		struct bvec_iter *iter) {
 
 	long flags;
-	struct pfd_cache *cache;
 	struct pfd_cache_meta *meta;
-	sector_t dbn = bio->bi_iter.bi_sector;
-	int index;
-	void *data_src;
-	void *data_dest;
-	struct bio_vec bvec;
-	struct bvec_iter iter;
+	struct pfd_cache_set *set;
 
+	set = &(cache->sets[dbn_to_set(cache, dbn)]);
 
-	spin_lock_irqsave(&(main_cache_set.lock), flags);
-	cache = find_cache_in_cache_set(dmc, &main_cache_set);
-	spin_unlock_irqrestore(&(main_cache_set.lock), flags);
+	spin_lock_irqsave(&(set->lock), flags);
 
-	if (cache == NULL) {
-		MPPRINTK("\033[0;32;31mCan't find pfd_cache.");
-		return false;
+	meta = lookup_meta(cache, set - cache->sets, dbn);
+	if (meta == NULL) {
+		spin_unlock_irqrestore(&(set->lock), flags);
+		goto miss;
 	}
 
-	index = dbn_to_cache_index(cache, dbn);
-	meta = &(cache->metas[index]);
+	if (!meta->used)
+		pfd_stat_feedback(cache->dmc, meta->stream,
+				meta->stream_gen, PFD_STAT_CONSUMED);
+	meta->used = true;
+	meta->stamp = ++set->tick;
 
-	spin_lock_irqsave(&(meta->lock), flags);
-
-	if (meta->status == empty || meta->dbn != dbn)
-		goto cache_miss_unlock;
+	if (meta->status == prepare) {
+		bio_list_add(&(meta->waiters), bio);
+		spin_unlock_irqrestore(&(set->lock), flags);
+		cache->dmc->pfd_cache_stats.parked++;
+		return copy_parked;
+	}
 
 	atomic_inc(&(meta->hold_count));
-	spin_unlock_irqrestore(&(meta->lock), flags);
+	spin_unlock_irqrestore(&(set->lock), flags);
 
-	if (meta->status == prepare) {
-		down_interruptible(&(meta->prepare_lock));
-		up(&(meta->prepare_lock));
+	copy_meta_to_bio(meta, offset, bytes, bio, iter);
+
+	atomic_dec(&(meta->hold_count));
+	return copy_hit;
+
+miss:
+	bio_advance_iter(bio, iter, bytes);
+	return copy_miss;
+}
+
+/*
+ * Serve what the buffer holds of *biop. The bio may start mid-block and
+ * span several blocks. Returns true when the whole bio was completed
+ * from memory, or parked on a block that is still being prefetched.
+ * Never sleeps waiting for the prefetch. Otherwise the resident head
+ * and tail are split off and completed, and *biop is left pointing at
+ * the part in between, which the caller sends down the normal path.
+ * The pieces are chained to the original bio, so it completes once
+ * that part does.
+ */
+bool pfd_cache_handle_bio(
+		struct cache_c *dmc,
+		struct bio **biop) {
+
+	struct bio *bio = *biop;
+	struct bio *split;
+	struct pfd_cache *cache;
+	struct bvec_iter iter = bio->bi_iter;
+	sector_t start = bio->bi_iter.bi_sector;
+	sector_t end = bio_end_sector(bio);
+	sector_t sect = start;
+	sector_t dbn;
+	sector_t miss_start = end;
+	sector_t miss_end = start;
+	unsigned int offset;
+	unsigned int bytes;
+	enum pfd_cache_copy_status status;
+
+	cache = get_pfd_cache(dmc);
+	if (cache == NULL)
+		return false;
+
+	while (sect < end) {
+		dbn = sect & ~((sector_t)dmc->block_size - 1);
+		offset = (unsigned int)(sect - dbn) << SECTOR_SHIFT;
+		bytes = min((unsigned int)(end - sect) << SECTOR_SHIFT,
+				((unsigned int)dmc->block_size << SECTOR_SHIFT) - offset);
+
+		status = copy_block_to_bio(cache, dbn, offset, bytes, bio, &iter);
+		if (status == copy_parked) {
+			put_pfd_cache(cache);
+			DPPRINTK("\033[1;33mcache parked: %lu", start);
+			return true;
+		}
+		if (status == copy_miss) {
+			if (miss_start == end)
+				miss_start = sect;
+			miss_end = sect + (bytes >> SECTOR_SHIFT);
+		}
+		sect += bytes >> SECTOR_SHIFT;
 	}
-	if (meta->status != valid) {
-		atomic_dec(&(meta->hold_count));
+
+	put_pfd_cache(cache);
+
+	if (miss_start == start && miss_end == end)
 		goto cache_miss;
-	}
 
-	data_src = cache->data + 
-		((unsigned long)index << (SECTOR_SHIFT + dmc->block_shift));
-	bio_for_each_segment(bvec, bio, iter) {
-		data_dest = kmap(bvec.bv_page) + bvec.bv_offset;
-		memcpy(data_dest, data_src, bvec.bv_len);
-		kunmap(bvec.bv_page);
-		data_src += bvec.bv_len;
+	if (miss_start == end) {
+		dmc->pfd_cache_stats.hits++;
+		dmc->pfd_cache_stats.bytes_served +=
+			(unsigned long)(end - start) << SECTOR_SHIFT;
+		bio_endio(bio);
+		DPPRINTK("\033[1;33mcache hit: %lu +%u",
+				start, (unsigned int)(end - start));
+		return true;
 	}
 
-	bio_endio(bio);
-	atomic_dec(&(meta->hold_count));
+	dmc->pfd_cache_stats.partial_hits++;
+	if (miss_start > start) {
+		split = bio_split(bio, miss_start - start, GFP_NOIO, pfd_bio_set);
+		if (split == NULL)
+			return false;
+		bio_chain(split, bio);
+		bio_endio(split);
+		dmc->pfd_cache_stats.bytes_served +=
+			(unsigned long)(miss_start - start) << SECTOR_SHIFT;
+	}
 
-	DPPRINTK("\033[1;33mcache hit: %lu", dbn);
-	return true;
+	if (miss_end < end) {
+		split = bio_split(bio, miss_end - miss_start, GFP_NOIO, pfd_bio_set);
+		if (split == NULL)
+			return false;
+		bio_chain(split, bio);
+		bio_endio(bio);
+		*biop = split;
+		dmc->pfd_cache_stats.bytes_served +=
+			(unsigned long)(end - miss_end) << SECTOR_SHIFT;
+	}
 
-cache_miss_unlock:
-	spin_unlock_irqrestore(&(meta->lock), flags);
+	DPPRINTK("\033[0;32;34mcache partial hit: %lu +%u, miss %lu +%lu",
+			start, (unsigned int)(end - start),
+			miss_start, miss_end - miss_start);
+	return false;
 
 cache_miss:
-	DPPRINTK("\033[0;32;34mcache miss: %lu", dbn);
+	dmc->pfd_cache_stats.misses++;
+	DPPRINTK("\033[0;32;34mcache miss: %lu", start);
 	return false;
 }
 
+/* Hand a parked bio back to the read path, see pfd_cache_do_resubmit() */
 static void
-io_callback(unsigned long error, void *context) {
-	struct pfd_cache_meta *meta =
-		(struct pfd_cache_meta *)context;
+resubmit_bio(
+		struct pfd_cache *cache,
+		struct bio *bio) {
+
+	long flags;
+
+	spin_lock_irqsave(&(cache->resubmit_lock), flags);
+	bio_list_add(&(cache->resubmit), bio);
+	spin_unlock_irqrestore(&(cache->resubmit_lock), flags);
+
+	/* The caller holds a reference, as for prefetch_work */
+	if (queue_work(pfd_wq, &(cache->resubmit_work)))
+		atomic_inc(&(cache->ref));
+}
+
+/*
+ * Queue meta, which holds a block just read from disk, for admission
+ * into the SSD. Called with a hold on meta, released once it is done.
+ */
+static void
+queue_admit(struct pfd_cache_meta *meta) {
+	struct pfd_cache *cache = meta->cache;
+	long flags;
+
+	spin_lock_irqsave(&(cache->admit_lock), flags);
+	if (cache->admit_count == PFD_CACHE_MAX_ADMIT) {
+		spin_unlock_irqrestore(&(cache->admit_lock), flags);
+		cache->dmc->pfd_cache_stats.admit_skipped++;
+		atomic_dec(&(meta->hold_count));
+		return;
+	}
+	meta->admit_next = NULL;
+	if (cache->admit_tail != NULL)
+		cache->admit_tail->admit_next = meta;
+	else
+		cache->admit_head = meta;
+	cache->admit_tail = meta;
+	cache->admit_count += 1;
+	atomic_inc(&(cache->ref));
+	spin_unlock_irqrestore(&(cache->admit_lock), flags);
+
+	if (queue_work(pfd_wq, &(cache->admit_work)))
+		atomic_inc(&(cache->ref));
+}
+
+/*
+ * Finish the bios parked on meta. A bio that lies within the block is
+ * completed from it right here; the rest go back through the read
+ * path, which serves what it can from the buffer.
+ */
+static void
+complete_waiters(
+		struct pfd_cache_meta *meta,
+		struct bio_list *waiters,
+		bool valid_data) {
+
 	struct pfd_cache *cache = meta->cache;
 	struct cache_c *dmc = cache->dmc;
+	struct bvec_iter iter;
+	struct bio *bio;
+	sector_t start;
+
+	while ((bio = bio_list_pop(waiters)) != NULL) {
+		start = bio->bi_iter.bi_sector;
+		if (!valid_data || start < meta->dbn ||
+				bio_end_sector(bio) > meta->dbn + dmc->block_size) {
+			resubmit_bio(cache, bio);
+			continue;
+		}
+		iter = bio->bi_iter;
+		copy_meta_to_bio(meta,
+				(unsigned int)(start - meta->dbn) << SECTOR_SHIFT,
+				bio->bi_iter.bi_size, bio, &iter);
+		dmc->pfd_cache_stats.hits++;
+		dmc->pfd_cache_stats.bytes_served += bio->bi_iter.bi_size;
+		bio_endio(bio);
+	}
+}
+
+static void
+complete_meta(struct pfd_cache_meta *meta, unsigned long error) {
+	struct pfd_cache *cache = meta->cache;
+	struct cache_c *dmc = cache->dmc;
+	struct pfd_cache_set *set =
+		&(cache->sets[meta_to_index(meta) / cache->assoc]);
 	struct cache_set *cache_set;
 	struct cacheblock *cacheblk;
-	long flags1, flags2;
-	enum pfd_cache_meta_status status = error == 0 ?
-		valid : empty;
-
-	spin_lock_irqsave(&(meta->lock_interrupt), flags1);
-	meta->status = status;
-	up(&(meta->prepare_lock));
+	struct bio_list waiters;
+	int ssd_index = meta->ssd_index;
+	bool valid_data;
+	bool admit;
+	long flags;
 
-	if (meta->ssd_index >= 0) {
-		cacheblk = &(dmc->cache[meta->ssd_index]);
-		cache_set = &(dmc->cache_sets[meta->ssd_index / dmc->assoc]);
-		spin_lock_irqsave(&cache_set->set_spin_lock, flags2);
+	spin_lock_irqsave(&(set->lock), flags);
+	meta->status = error == 0 && !meta->stale ? valid : empty;
+	valid_data = meta->status == valid;
+	bio_list_init(&waiters);
+	bio_list_merge(&waiters, &(meta->waiters));
+	bio_list_init(&(meta->waiters));
+	if (valid_data && !bio_list_empty(&waiters))
+		atomic_inc(&(meta->hold_count));
+	/* Blocks that came from the SSD are there already */
+	admit = valid_data && ssd_index < 0 && dmc->pfd_admit_set > 0;
+	if (admit)
+		atomic_inc(&(meta->hold_count));
+	spin_unlock_irqrestore(&(set->lock), flags);
+	atomic_dec(&(cache->nr_inflight));
+	atomic_dec(&pfd_inflight_all);
+
+	if (!bio_list_empty(&waiters)) {
+		complete_waiters(meta, &waiters, valid_data);
+		if (valid_data)
+			atomic_dec(&(meta->hold_count));
+	}
+	if (admit)
+		queue_admit(meta);
+
+	if (error == 0)
+		dmc->pfd_cache_stats.completed++;
+	else
+		dmc->pfd_cache_stats.failed++;
+
+	/* Outside the set lock, no flashcache lock is ever taken under it */
+	if (ssd_index >= 0) {
+		cacheblk = &(dmc->cache[ssd_index]);
+		cache_set = &(dmc->cache_sets[ssd_index / dmc->assoc]);
+		spin_lock_irqsave(&cache_set->set_spin_lock, flags);
 		cacheblk->cache_state &= ~BLOCK_IO_INPROG;
-		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags2);
+		spin_unlock_irqrestore(&cache_set->set_spin_lock, flags);
 	}
 
-	spin_unlock_irqrestore(&(meta->lock_interrupt), flags1);
-
 	DPPRINTK("%sio_callback. (%lu)",
 			error ? "\033[0;32;31m" : "",
 			meta->dbn);
+
+	put_pfd_cache(cache);
+}
+
+static void
+io_callback(unsigned long error, void *context) {
+	complete_meta((struct pfd_cache_meta *)context, error);
+}
+
+/*
+ * A run of HDD blocks with contiguous dbns, read with a single dm_io.
+ * The slots of the run need not be adjacent in the buffer, the pages
+ * backing them are chained in pl in ascending dbn order.
+ */
+struct pfd_cache_io {
+	struct pfd_cache *cache;
+	sector_t first_dbn;
+	sector_t last_dbn;
+	int nr_metas;
+	int dir;
+	struct pfd_cache_meta *metas[PFD_CACHE_MAX_RUN];
+	struct page_list pl[0];
+};
+
+static struct pfd_cache_io *
+alloc_pfd_cache_io(struct pfd_cache *cache) {
+	struct pfd_cache_io *io;
+	int nr_pages = PFD_CACHE_MAX_RUN * pages_per_block(cache->dmc);
+
+	/* Runs are only built when slots are made of whole pages */
+	if (!block_is_whole_pages(cache->dmc))
+		return NULL;
+
+	io = kmalloc(sizeof(struct pfd_cache_io) +
+			nr_pages * sizeof(struct page_list), GFP_NOIO);
+	if (io == NULL)
+		return NULL;
+
+	io->cache = cache;
+	io->nr_metas = 0;
+	io->dir = 0;
+	return io;
+}
+
+static bool
+pfd_cache_io_add(
+		struct pfd_cache_io *io,
+		struct pfd_cache_meta *meta) {
+	sector_t block_size = io->cache->dmc->block_size;
+
+	if (io->nr_metas == 0) {
+		io->first_dbn = meta->dbn;
+		io->last_dbn = meta->dbn;
+	} else if (io->nr_metas == PFD_CACHE_MAX_RUN) {
+		return false;
+	} else if (io->dir >= 0 && meta->dbn == io->last_dbn + block_size) {
+		io->dir = 1;
+		io->last_dbn = meta->dbn;
+	} else if (io->dir <= 0 && meta->dbn + block_size == io->first_dbn) {
+		io->dir = -1;
+		io->first_dbn = meta->dbn;
+	} else {
+		return false;
+	}
+
+	io->metas[io->nr_metas] = meta;
+	io->nr_metas += 1;
+	return true;
+}
+
+static void
+io_run_callback(unsigned long error, void *context) {
+	struct pfd_cache_io *io = (struct pfd_cache_io *)context;
+	int i;
+
+	for (i = 0; i < io->nr_metas; i++)
+		complete_meta(io->metas[i], error);
+	kfree(io);
+}
+
+static void
+dispatch_io_run(struct pfd_cache_io *io) {
+	struct pfd_cache *cache = io->cache;
+	struct cache_c *dmc = cache->dmc;
+	struct dm_io_request req;
+	struct dm_io_region region;
+	struct pfd_cache_meta *meta;
+	int nr_pages = pages_per_block(dmc);
+	int i, j, k;
+	int dm_io_ret;
+
+	/* Chain the slot pages in ascending dbn order */
+	k = 0;
+	for (i = 0; i < io->nr_metas; i++) {
+		meta = io->metas[io->dir < 0 ? io->nr_metas - 1 - i : i];
+		for (j = 0; j < nr_pages; j++, k++) {
+			io->pl[k].page = meta_to_page(meta, j);
+			io->pl[k].next = &io->pl[k + 1];
+		}
+	}
+	io->pl[k - 1].next = NULL;
+
+	req.bi_op = READ;
+	req.bi_op_flags = REQ_RAHEAD;
+	req.notify.fn = (io_notify_fn)io_run_callback;
+	req.notify.context = (void *)io;
+	req.client = hdd_client;
+	req.mem.type = DM_IO_PAGE_LIST;
+	req.mem.offset = 0;
+	req.mem.ptr.pl = &io->pl[0];
+
+	region.bdev = dmc->disk_dev->bdev;
+	region.sector = io->first_dbn;
+	region.count = (sector_t)io->nr_metas * dmc->block_size;
+
+	DPPRINTK("dispatch io run: %lu +%d on HDD",
+			io->first_dbn,
+			io->nr_metas);
+
+	dm_io_ret = dm_io(&req, 1, &region, NULL);
+	if (dm_io_ret != 0)
+		io_run_callback(1, io);
 }
 
 static void
@@ -339,19 +1049,22 @@ dispatch_io_request(struct pfd_cache_meta *meta) {
 	struct dm_io_region region;
 	int dm_io_ret;
 	bool from_ssd = meta->ssd_index < 0 ? false : true;
-	int meta_idx = dbn_to_cache_index(cache, meta->dbn);
-	long flags;
 
+	/* Speculative, so the disk may serve demand reads first */
 	req.bi_op = READ;
-	req.bi_op_flags = 0;
+	req.bi_op_flags = REQ_RAHEAD;
 	req.notify.fn = (io_notify_fn)io_callback;
 	req.notify.context = (void *)meta;
 	req.client = from_ssd ?
 		ssd_client : hdd_client;
-	req.mem.type = DM_IO_VMA;
 	req.mem.offset = 0;
-	req.mem.ptr.vma =cache->data +
-		((unsigned long)meta_idx << (dmc->block_shift + SECTOR_SHIFT));
+	if (cache->pl != NULL) {
+		req.mem.type = DM_IO_PAGE_LIST;
+		req.mem.ptr.pl = meta_to_pl(meta);
+	} else {
+		req.mem.type = DM_IO_VMA;
+		req.mem.ptr.vma = meta_to_data(meta);
+	}
 
 	region.bdev = from_ssd ?
 		dmc->cache_dev->bdev :
@@ -361,24 +1074,77 @@ dispatch_io_request(struct pfd_cache_meta *meta) {
 		meta->dbn;
 	region.count = dmc->block_size;
 
+	DPPRINTK("dispatch io: %lu on %s",
+			meta->dbn,
+			from_ssd ? "SSD" : "HDD");
+
 	dm_io_ret = dm_io(&req, 1, &region, NULL);
-	if (dm_io_ret != 0) {
-		spin_lock_irqsave(&(meta->lock), flags);
-		meta->status = empty;
-		up(&(meta->prepare_lock));
-		spin_unlock_irqrestore(&(meta->lock), flags);
+	if (dm_io_ret != 0)
+		complete_meta(meta, 1);
+}
+
+/*
+ * The prefetch rate limit in blocks per second, 0 when it is not
+ * limited.
+ */
+static long
+pfd_cache_rate(struct cache_c *dmc) {
+	long rate = (long)dmc->sysctl_pfd_max_rate >> (dmc->block_shift - 1);
+
+	if (dmc->sysctl_pfd_max_rate <= 0)
+		return 0;
+	if (rate < 1)
+		rate = 1;
+	return rate;
+}
+
+/*
+ * Top up the token bucket for the time since the last refill, and take
+ * up to want tokens out of it. Returns the number taken.
+ */
+static long
+take_tokens(struct pfd_cache *cache, long rate, long want) {
+	unsigned long elapsed;
+	long gained;
+
+	spin_lock(&(cache->tokens_lock));
+	elapsed = min(jiffies - cache->tokens_stamp, (unsigned long)HZ);
+	gained = rate * (long)elapsed / HZ;
+	if (gained > 0) {
+		cache->tokens += gained;
+		if (cache->tokens > rate)
+			cache->tokens = rate;
+		cache->tokens_stamp = jiffies;
 	}
+	if (want > cache->tokens)
+		want = cache->tokens;
+	cache->tokens -= want;
+	spin_unlock(&(cache->tokens_lock));
+	return want;
+}
 
-	DPPRINTK("%sdispatch io: %lu on %s",
-			dm_io_ret ? "\033[0;32;31m" : "",
-			meta->dbn,
-			from_ssd ? "SSD" : "HDD");
+/* Give back the tokens take_tokens() handed out but were not used */
+static void
+put_tokens(struct pfd_cache *cache, long rate, long unused) {
+	spin_lock(&(cache->tokens_lock));
+	cache->tokens += unused;
+	if (cache->tokens > rate)
+		cache->tokens = rate;
+	spin_unlock(&(cache->tokens_lock));
 }
 
+/*
+ * Look dbn up in the flashcache set. When claim is set and the block
+ * can be read from the SSD it is marked CACHEREADINPROG and its index
+ * is returned. Returns PFD_CACHE_SSD_MISS when the disk copy is good to
+ * read, and PFD_CACHE_SSD_STALE when the SSD holds a dirty block or IO
+ * is in flight on it, so the disk copy may be out of date.
+ */
 static int
 get_ssd_cache_index(
 		struct pfd_cache_meta *meta,
-		sector_t dbn) {
+		sector_t dbn,
+		bool claim) {
 
 	struct bio tmp_bio;
 	int lookup_res;
@@ -396,20 +1162,23 @@ get_ssd_cache_index(
 			dmc,
 			&tmp_bio,
 			&lookup_index);
+	ret = PFD_CACHE_SSD_MISS;
 	if (lookup_res > 0) {
 		cacheblk = &dmc->cache[lookup_index];
 		if ((cacheblk->cache_state & VALID) && 
 				(cacheblk->dbn == dbn)) {
-			if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (cacheblk->nr_queued == 0)) {
-				cacheblk->cache_state |= CACHEREADINPROG;
-				ex_flashcache_setlocks_multidrop(dmc, &tmp_bio);
-
-				return lookup_index;
-			}
+			if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (FLASHCACHE_NR_QUEUED(cacheblk) == 0)) {
+				if (claim) {
+					cacheblk->cache_state |= CACHEREADINPROG;
+					ret = lookup_index;
+				} else if (cacheblk->cache_state & DIRTY)
+					ret = PFD_CACHE_SSD_STALE;
+			} else
+				ret = PFD_CACHE_SSD_STALE;
 		}
 	}
 	ex_flashcache_setlocks_multidrop(dmc, &tmp_bio);
-	return -1;
+	return ret;
 }
 
 static bool
@@ -441,28 +1210,44 @@ update_seq_status(
 	return false;
 }
 
-void pfd_cache_prefetch(
-		struct cache_c *dmc,
+static void
+do_prefetch(
+		struct pfd_cache *cache,
 		struct pfd_stat_info *info) {
 
 	long flags;
-	struct pfd_cache *cache;
+	struct cache_c *dmc = cache->dmc;
 	struct pfd_cache_meta *meta;
-	int meta_idx;
+	struct pfd_cache_set *set;
+	int set_idx;
 	sector_t dbn_arr[PFD_CACHE_MAX_STEP];
 	int dbn_arr_count = pfd_stat_get_prefetch_dbns(
-			dmc, info, dbn_arr);
+			dmc, info, cache->nr_blocks, dbn_arr);
 	int i, i_end, i_step;
 	sector_t dbn;
 	long ssd_seq_status_start = -1;
-	int ssd_seq_status_count;
+	int ssd_seq_status_count = 0;
 	int ssd_count = 0;
 	int ssd_max = dbn_arr_count >> PFD_CACHE_MAX_SSD_SHIFT;
 	int ssd_index;
+	int max_inflight = dmc->sysctl_pfd_max_inflight;
+	int global_inflight = pfd_global_inflight;
+	long rate = pfd_cache_rate(dmc);
+	long budget;
+	struct pfd_cache_io *io = NULL;
 
 	if (dbn_arr_count == 0)
 		return;
-	else if (dbn_arr_count > 0) {
+
+	/* The share of the stream, of the bucket or of the in-flight limit */
+	budget = (rate > 0 ? rate : max_inflight) * info->share /
+		PFD_STAT_SHARE_ONE;
+	if (budget < PFD_CACHE_THRESHOLD_STEP)
+		budget = PFD_CACHE_THRESHOLD_STEP;
+	if (rate > 0)
+		budget = take_tokens(cache, rate, budget);
+
+	if (dbn_arr_count > 0) {
 		i = 0;
 		i_end = dbn_arr_count;
 		i_step = 1;
@@ -472,98 +1257,439 @@ void pfd_cache_prefetch(
 		i_step = -1;
 	}
 
-	spin_lock_irqsave(&(main_cache_set.lock), flags);
-	cache = find_cache_in_cache_set(dmc, &main_cache_set);
-	spin_unlock_irqrestore(&(main_cache_set.lock), flags);
-
-	if (cache == NULL) {
-		MPPRINTK("\033[0;32;31mCan't find pfd_cache.");
-		return;
-	}
-
 	for (; i != i_end; i += i_step) {
+		if (budget <= 0) {
+			dmc->pfd_cache_stats.throttled++;
+			break;
+		}
+		if (atomic_read(&(cache->nr_inflight)) >= max_inflight ||
+		    (global_inflight > 0 &&
+		     atomic_read(&pfd_inflight_all) >= global_inflight)) {
+			// the disk is not keeping up
+			pfd_stat_feedback(dmc, info->stream,
+					info->stream_gen, PFD_STAT_CONGESTED);
+			break;
+		}
+
 		dbn = dbn_arr[i];
-		meta_idx = dbn_to_cache_index(cache, dbn);
-		meta = &(cache->metas[meta_idx]);
+		set_idx = dbn_to_set(cache, dbn);
+		set = &(cache->sets[set_idx]);
 
-		spin_lock_irqsave(&(meta->lock), flags);
+		spin_lock_irqsave(&(set->lock), flags);
 
-		if (meta->status != empty && meta->dbn == dbn) {
+		if (lookup_meta(cache, set_idx, dbn) != NULL) {
 			// exist
-			spin_unlock_irqrestore(&(meta->lock), flags);
+			spin_unlock_irqrestore(&(set->lock), flags);
 			continue;
 		}
 
-		if (meta->status == prepare ||
-				atomic_read(&(meta->hold_count)) > 0) {
-			// busy
-			spin_unlock_irqrestore(&(meta->lock), flags);
+		meta = find_victim(cache, set_idx);
+		if (meta == NULL) {
+			// busy or protected
+			spin_unlock_irqrestore(&(set->lock), flags);
 			continue;
 		}
 
-		// setup meta
+		// setup meta, it holds the cache until complete_meta()
 		meta->dbn = dbn;
 		meta->status = prepare;
-		sema_init(&(meta->prepare_lock), 0);
+		meta->used = false;
+		meta->fresh = true;
+		meta->stale = false;
+		meta->stamp = ++set->tick;
+		meta->stream = info->stream;
+		meta->stream_gen = info->stream_gen;
+		atomic_inc(&(cache->ref));
+		atomic_inc(&(cache->nr_inflight));
+		atomic_inc(&pfd_inflight_all);
+
+		spin_unlock_irqrestore(&(set->lock), flags);
+
+		budget--;
+		dmc->pfd_cache_stats.issued++;
+		if (info->delta_len > 0)
+			dmc->pfd_cache_stats.delta_issued++;
+		ssd_index = get_ssd_cache_index(meta, dbn, ssd_count < ssd_max);
+		if (ssd_index >= 0) {
+			// ssd
+			dmc->pfd_cache_stats.from_ssd++;
+			meta->ssd_index = ssd_index;
+			dispatch_io_request(meta);
+			if (update_seq_status(
+						dmc, dbn,
+						&ssd_seq_status_start,
+						&ssd_seq_status_count)) {
+				ssd_count += 1;
+			}
+			continue;
+		}
+
+		meta->ssd_index = -1;
+		if (ssd_index == PFD_CACHE_SSD_STALE) {
+			// the disk copy is older than the SSD one
+			dmc->pfd_cache_stats.skipped_dirty++;
+			complete_meta(meta, 1);
+			continue;
+		}
 
-		spin_unlock_irqrestore(&(meta->lock), flags);
+		dmc->pfd_cache_stats.from_hdd++;
 
-		if (ssd_count < ssd_max) {
-			// ssd
-			ssd_index = get_ssd_cache_index(meta, dbn);
-			if (ssd_index >= 0) {
-				meta->ssd_index = ssd_index;
+		if (io != NULL && !pfd_cache_io_add(io, meta)) {
+			dispatch_io_run(io);
+			io = NULL;
+		}
+		if (io == NULL) {
+			io = alloc_pfd_cache_io(cache);
+			if (io == NULL) {
 				dispatch_io_request(meta);
-				if (update_seq_status(
-							dmc, dbn,
-							&ssd_seq_status_start,
-							&ssd_seq_status_count)) {
-					ssd_count += 1;
-				}
 				continue;
 			}
+			pfd_cache_io_add(io, meta);
 		}
+	}
 
-		meta->ssd_index = -1;
-		dispatch_io_request(meta);
+	if (io != NULL)
+		dispatch_io_run(io);
+	if (rate > 0 && budget > 0)
+		put_tokens(cache, rate, budget);
+}
+
+static void
+pfd_cache_do_work(struct work_struct *work) {
+	struct pfd_cache *cache =
+		container_of(work, struct pfd_cache, prefetch_work);
+	struct pfd_stat_info info;
+	long flags;
+
+	while (1) {
+		spin_lock_irqsave(&(cache->queue_lock), flags);
+		if (cache->queue_count == 0) {
+			spin_unlock_irqrestore(&(cache->queue_lock), flags);
+			break;
+		}
+		info = cache->queue[cache->queue_head];
+		cache->queue_head =
+			(cache->queue_head + 1) % PFD_CACHE_QUEUE_DEPTH;
+		cache->queue_count -= 1;
+		spin_unlock_irqrestore(&(cache->queue_lock), flags);
+
+		do_prefetch(cache, &info);
+		cond_resched();
+	}
+
+	put_pfd_cache(cache);
+}
+
+static void
+admit_callback(unsigned long error, void *context) {
+	struct pfd_cache_meta *meta = (struct pfd_cache_meta *)context;
+	struct pfd_cache *cache = meta->cache;
+	struct cache_c *dmc = cache->dmc;
+
+	if (error)
+		dmc->flashcache_errors.ssd_write_errors++;
+	else
+		dmc->pfd_cache_stats.admitted++;
+	flashcache_pfd_admit_done(meta->admit_job, error ? -EIO : 0);
+	atomic_dec(&(meta->hold_count));
+	put_pfd_cache(cache);
+}
+
+/*
+ * Write the block of meta to the SSD. The SSD block is claimed before
+ * meta is checked again, so a write that dropped meta in between is
+ * seen here, and one that comes later queues up behind the claimed
+ * block.
+ */
+static void
+admit_meta(struct pfd_cache_meta *meta) {
+	struct pfd_cache *cache = meta->cache;
+	struct cache_c *dmc = cache->dmc;
+	struct pfd_cache_set *set =
+		&(cache->sets[meta_to_index(meta) / cache->assoc]);
+	struct dm_io_request req;
+	struct dm_io_region region;
+	struct kcached_job *job;
+	bool valid_data;
+	long flags;
+
+	job = flashcache_pfd_admit(dmc, meta->dbn);
+	if (job == NULL) {
+		dmc->pfd_cache_stats.admit_skipped++;
+		goto out;
+	}
+
+	spin_lock_irqsave(&(set->lock), flags);
+	valid_data = meta->status == valid;
+	spin_unlock_irqrestore(&(set->lock), flags);
+	if (!valid_data) {
+		dmc->pfd_cache_stats.admit_skipped++;
+		flashcache_pfd_admit_done(job, -EIO);
+		goto out;
+	}
+
+	meta->admit_job = job;
+	req.bi_op = WRITE;
+	req.bi_op_flags = 0;
+	req.notify.fn = (io_notify_fn)admit_callback;
+	req.notify.context = (void *)meta;
+	req.client = ssd_client;
+	req.mem.offset = 0;
+	if (cache->pl != NULL) {
+		req.mem.type = DM_IO_PAGE_LIST;
+		req.mem.ptr.pl = meta_to_pl(meta);
+	} else {
+		req.mem.type = DM_IO_VMA;
+		req.mem.ptr.vma = meta_to_data(meta);
+	}
+	region = job->job_io_regions.cache;
+
+	if (dm_io(&req, 1, &region, NULL) != 0)
+		admit_callback(1, meta);
+	return;
+
+out:
+	atomic_dec(&(meta->hold_count));
+	put_pfd_cache(cache);
+}
+
+static void
+pfd_cache_do_admit(struct work_struct *work) {
+	struct pfd_cache *cache =
+		container_of(work, struct pfd_cache, admit_work);
+	struct pfd_cache_meta *meta;
+	long flags;
+
+	while (1) {
+		spin_lock_irqsave(&(cache->admit_lock), flags);
+		meta = cache->admit_head;
+		if (meta == NULL) {
+			spin_unlock_irqrestore(&(cache->admit_lock), flags);
+			break;
+		}
+		cache->admit_head = meta->admit_next;
+		if (cache->admit_head == NULL)
+			cache->admit_tail = NULL;
+		cache->admit_count -= 1;
+		spin_unlock_irqrestore(&(cache->admit_lock), flags);
+
+		admit_meta(meta);
+		cond_resched();
 	}
+
+	put_pfd_cache(cache);
+}
+
+static void
+pfd_cache_do_resubmit(struct work_struct *work) {
+	struct pfd_cache *cache =
+		container_of(work, struct pfd_cache, resubmit_work);
+	struct bio *bio;
+	long flags;
+
+	while (1) {
+		spin_lock_irqsave(&(cache->resubmit_lock), flags);
+		bio = bio_list_pop(&(cache->resubmit));
+		spin_unlock_irqrestore(&(cache->resubmit_lock), flags);
+		if (bio == NULL)
+			break;
+
+		if (!pfd_cache_handle_bio(cache->dmc, &bio))
+			flashcache_read_cache(cache->dmc, bio);
+		cond_resched();
+	}
+
+	put_pfd_cache(cache);
+}
+
+/*
+ * Find the queued request of the stream of info, or drop it when cancel
+ * is set. Returns its ring index, or -1. Called with queue_lock held.
+ */
+static int
+find_queued(
+		struct pfd_cache *cache,
+		struct pfd_stat_info *info,
+		bool cancel) {
+	int i, idx, next;
+
+	for (i = 0; i < cache->queue_count; i++) {
+		idx = (cache->queue_head + i) % PFD_CACHE_QUEUE_DEPTH;
+		if (cache->queue[idx].stream != info->stream ||
+		    cache->queue[idx].stream_gen != info->stream_gen)
+			continue;
+		if (!cancel)
+			return idx;
+
+		/* Close the gap, keeping the order of the others */
+		for (; i < cache->queue_count - 1; i++) {
+			next = (idx + 1) % PFD_CACHE_QUEUE_DEPTH;
+			cache->queue[idx] = cache->queue[next];
+			idx = next;
+		}
+		cache->queue_count -= 1;
+		cache->dmc->pfd_cache_stats.cancelled++;
+		return -1;
+	}
+	return -1;
+}
+
+/*
+ * Called from the read path. Only records the request; the prefetch
+ * itself is issued from pfd_wq. A request still queued for a stream
+ * that changed pattern is cancelled.
+ */
+void pfd_cache_prefetch(
+		struct cache_c *dmc,
+		struct pfd_stat_info *info) {
+
+	long flags;
+	struct pfd_cache *cache;
+	int tail;
+	bool prefetch;
+
+	prefetch = info->seq_total_count * info->stride_count +
+		info->seq_count >= PFD_CACHE_THRESHOLD_STEP ||
+		info->delta_len > 0;
+	if (!prefetch && !info->cancel)
+		return;
+
+	cache = get_pfd_cache(dmc);
+	if (cache == NULL)
+		return;
+
+	spin_lock_irqsave(&(cache->queue_lock), flags);
+	if (info->cancel)
+		find_queued(cache, info, true);
+	if (!prefetch) {
+		spin_unlock_irqrestore(&(cache->queue_lock), flags);
+		put_pfd_cache(cache);
+		return;
+	}
+	tail = find_queued(cache, info, false);
+	if (tail >= 0) {
+		/* The work is already queued */
+		cache->queue[tail] = *info;
+		spin_unlock_irqrestore(&(cache->queue_lock), flags);
+		put_pfd_cache(cache);
+		return;
+	}
+	if (cache->queue_count == PFD_CACHE_QUEUE_DEPTH) {
+		dmc->pfd_cache_stats.queue_drops++;
+		spin_unlock_irqrestore(&(cache->queue_lock), flags);
+		pfd_stat_feedback(dmc, info->stream,
+				info->stream_gen, PFD_STAT_CONGESTED);
+		put_pfd_cache(cache);
+		return;
+	}
+	tail = (cache->queue_head + cache->queue_count) % PFD_CACHE_QUEUE_DEPTH;
+	cache->queue[tail] = *info;
+	cache->queue_count += 1;
+	spin_unlock_irqrestore(&(cache->queue_lock), flags);
+
+	/* A queued work item keeps the cache until it has run */
+	if (queue_work(pfd_wq, &(cache->prefetch_work)))
+		atomic_inc(&(cache->ref));
+	put_pfd_cache(cache);
+}
+
+void pfd_cache_budget(
+		struct cache_c *dmc,
+		long *tokens,
+		int *inflight,
+		int *global_inflight,
+		int *global_max) {
+
+	struct pfd_cache *cache = get_pfd_cache(dmc);
+
+	*tokens = 0;
+	*inflight = 0;
+	if (cache != NULL) {
+		*tokens = cache->tokens;
+		*inflight = atomic_read(&(cache->nr_inflight));
+		put_pfd_cache(cache);
+	}
+	*global_inflight = atomic_read(&pfd_inflight_all);
+	*global_max = pfd_global_inflight;
+}
+
+/*
+ * Drop the buffered blocks overlapping [sector, sector + count). A block
+ * still being prefetched is marked stale, and complete_meta() discards
+ * it. Writes call this when they are mapped and again when they
+ * complete, so a prefetch that read the disk before the write landed
+ * is never served.
+ */
+void pfd_cache_invalidate(
+		struct cache_c *dmc,
+		sector_t sector,
+		sector_t count) {
+
+	long flags;
+	struct pfd_cache *cache;
+	struct pfd_cache_meta *meta;
+	struct pfd_cache_set *set;
+	sector_t dbn = sector & ~((sector_t)dmc->block_size - 1);
+	sector_t end = sector + count;
+	int set_idx;
+
+	cache = get_pfd_cache(dmc);
+	if (cache == NULL)
+		return;
+
+	for (; dbn < end; dbn += dmc->block_size) {
+		set_idx = dbn_to_set(cache, dbn);
+		set = &(cache->sets[set_idx]);
+
+		spin_lock_irqsave(&(set->lock), flags);
+		meta = lookup_meta(cache, set_idx, dbn);
+		if (meta != NULL) {
+			dmc->pfd_cache_stats.invalidates++;
+			if (meta->status == prepare)
+				meta->stale = true;
+			else
+				meta->status = empty;
+		}
+		spin_unlock_irqrestore(&(set->lock), flags);
+	}
+
+	put_pfd_cache(cache);
 }
 
 int pfd_cache_reset() {
 	long flags1, flags2;
-	int i, j;
+	int j;
 	struct pfd_cache *cache;
 	struct pfd_cache_meta *meta;
+	struct pfd_cache_set *set;
 
 	MPPRINTK("\033[1;33mpfd_cache reseting...");
 
-	spin_lock_irqsave(&(main_cache_set.lock), flags1);
-
-	for (i = 0; i < PFD_CACHE_COUNT_PER_SET; i++) {
-		if (main_cache_set.status_arr[i] == set_prepare) {
-			goto fail;
-		}
-		cache = main_cache_set.caches[i];
-		if (cache != NULL) {
-			for (j = 0; j < PFD_CACHE_BLOCK_COUNT; j++) {
-				meta = &(cache->metas[j]);
-				spin_lock_irqsave(&(meta->lock), flags2);
-				if (meta->status == prepare || atomic_read(&(meta->hold_count)) > 0) {
-					spin_unlock_irqrestore(&(meta->lock), flags2);
-					goto fail;
-				}
-				meta->status = empty;
-				spin_unlock_irqrestore(&(meta->lock), flags2);
+	spin_lock_irqsave(&pfd_caches_lock, flags1);
+
+	list_for_each_entry(cache, &pfd_caches, list) {
+		spin_lock_irqsave(&(cache->queue_lock), flags2);
+		cache->queue_count = 0;
+		spin_unlock_irqrestore(&(cache->queue_lock), flags2);
+		for (j = 0; j < cache->nr_blocks; j++) {
+			meta = &(cache->metas[j]);
+			set = &(cache->sets[j / cache->assoc]);
+			spin_lock_irqsave(&(set->lock), flags2);
+			if (meta->status == prepare || atomic_read(&(meta->hold_count)) > 0) {
+				spin_unlock_irqrestore(&(set->lock), flags2);
+				goto fail;
 			}
+			meta->status = empty;
+			spin_unlock_irqrestore(&(set->lock), flags2);
 		}
 	}
 
-	spin_unlock_irqrestore(&(main_cache_set.lock), flags1);
+	spin_unlock_irqrestore(&pfd_caches_lock, flags1);
 	MPPRINTK("\033[0;32;32mpfd_cache reseted.");
 	return 0;
 
 fail:
-	spin_unlock_irqrestore(&(main_cache_set.lock), flags1);
+	spin_unlock_irqrestore(&pfd_caches_lock, flags1);
 
 	MPPRINTK("\033[0;32;31mcan't reset pfd_cache");
 	return -1;
@@ -1,18 +1,40 @@
-#define PFD_CACHE_COUNT_PER_SET 4
-#define PFD_CACHE_BLOCK_COUNT 16384
+#define PFD_CACHE_DEFAULT_BLOCKS 16384
+#define PFD_CACHE_MAX_BLOCKS 1048576
+#define PFD_CACHE_ASSOC 8
 #define PFD_CACHE_MAX_STEP 256
 #define PFD_CACHE_MAX_SSD_SHIFT 3
 #define PFD_CACHE_THRESHOLD_STEP 4
+#define PFD_CACHE_QUEUE_DEPTH 64
+#define PFD_CACHE_MAX_RUN 64
+#define PFD_CACHE_DEFAULT_INFLIGHT 256
+#define PFD_CACHE_MAX_INFLIGHT 1024
+#define PFD_CACHE_GLOBAL_INFLIGHT 4096
+#define PFD_CACHE_SSD_MISS -1
+#define PFD_CACHE_SSD_STALE -2
+#define PFD_CACHE_MAX_ADMIT 256
+#define PFD_CACHE_ADMIT_PCT_MAX 50
 
 #include <stdbool.h>
 
 int pfd_cache_init(void);
 void pfd_cache_exit(void);
 void pfd_cache_add(struct cache_c *dmc);
+void pfd_cache_remove(struct cache_c *dmc);
+int pfd_cache_resize(struct cache_c *dmc, int nr_blocks);
 bool pfd_cache_handle_bio(
 		struct cache_c *dmc,
-		struct bio *bio);
+		struct bio **biop);
 void pfd_cache_prefetch(
 		struct cache_c *dmc,
 		struct pfd_stat_info *info);
+void pfd_cache_invalidate(
+		struct cache_c *dmc,
+		sector_t sector,
+		sector_t count);
+void pfd_cache_budget(
+		struct cache_c *dmc,
+		long *tokens,
+		int *inflight,
+		int *global_inflight,
+		int *global_max);
 int pfd_cache_reset(void);
@@ -1,8 +1,15 @@
 #include <linux/version.h>
+#include <linux/module.h>
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 #include <linux/spinlock.h>
 #include <linux/semaphore.h>
 #include <linux/bio.h>
+#include <linux/seq_file.h>
 #include <stdbool.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,26)
@@ -28,6 +35,10 @@
 #include "prefetchd_log.h"
 #include "pfd_cache.h"
 
+static int pfd_stat_streams = PFD_STAT_DEFAULT_STREAMS;
+module_param(pfd_stat_streams, int, 0444);
+MODULE_PARM_DESC(pfd_stat_streams, "Number of streams tracked per cache device");
+
 struct pfd_seq_stat {
 	sector_t start;
 	long count;
@@ -42,15 +53,16 @@ inline bool
 is_bio_fit_seq_stat(
 		struct cache_c *dmc,
 		struct pfd_seq_stat *seq_stat,
-		struct bio *bio) {
+		sector_t sector) {
 	return seq_stat->start +
 		(sector_t)seq_stat->count *
 		(sector_t)dmc->block_size
-		== bio->bi_iter.bi_sector ? true : false;
+		== sector ? true : false;
 }
 
 struct pfd_stat {
-	struct dm_target *tgt;
+	/* Owner, see pfd_stat_key(), and the last process that read */
+	u64 key;
 	int pid;
 
 	long stride;
@@ -58,14 +70,61 @@ struct pfd_stat {
 	struct pfd_seq_stat seq_stats[2];
 	struct pfd_seq_stat *curr_seq_stat;
 	struct pfd_seq_stat *prev_seq_stat;
+
+	/*
+	 * Prefetch depth, adjusted once per window of depth prefetched
+	 * blocks that were either consumed or wasted.
+	 */
+	long depth;
+	long win_consumed;
+	long win_wasted;
+	unsigned long consumed;
+	unsigned long wasted;
+
+	/* Prefetch was asked for on the last read, and with what stride */
+	int prefetching;
+	long prefetch_stride;
+
+	/*
+	 * Percentage of the last depth window that was read, and the
+	 * weight it gives the stream in table->weight_total.
+	 */
+	int useful_pct;
+	int weight;
+
+	/*
+	 * Delta correlation: the last block deltas of the stream, oldest
+	 * first from delta_head, the delta predicted for the next read and
+	 * how many predictions in a row were right.
+	 */
+	long delta_last;
+	int deltas[PFD_STAT_DELTA_HISTORY];
+	int delta_head;
+	int delta_nr;
+	int delta_next;
+	int delta_hits;
 };
 
 inline void
 reset_pfd_stat(struct pfd_stat *target) {
-	target->tgt = NULL;
+	target->key = ~0ULL;
 	target->pid = -1;
 	target->stride = 0;
 	target->stride_count = 0;
+	target->depth = PFD_STAT_DEPTH_INIT;
+	target->win_consumed = 0;
+	target->win_wasted = 0;
+	target->consumed = 0;
+	target->wasted = 0;
+	target->prefetching = 0;
+	target->prefetch_stride = 0;
+	target->useful_pct = PFD_STAT_USEFUL_INIT;
+	target->weight = 0;
+	target->delta_last = -1;
+	target->delta_head = 0;
+	target->delta_nr = 0;
+	target->delta_next = 0;
+	target->delta_hits = 0;
 	reset_pfd_seq_stat(&target->seq_stats[0]);
 	reset_pfd_seq_stat(&target->seq_stats[1]);
 	target->curr_seq_stat = &(target->seq_stats[0]);
@@ -81,129 +140,580 @@ swap_pfd_stat_curr_prev(struct pfd_stat *target) {
 	target->curr_seq_stat = tmp;
 }
 
+/*
+ * Streams are tracked per cache device and split into shards by a hash
+ * of the pid, so readers of different devices (or different processes
+ * on the same device) mostly take different locks. Each shard keeps its
+ * own hash table for O(1) lookup and its own LRU list for recycling.
+ * A process may own up to PFD_STAT_PID_STREAMS streams, and no more than
+ * half its shard, all in the same bucket; a read goes to the one whose
+ * next sector it is closest to.
+ */
 struct pfd_stat_elm {
 	struct pfd_stat stat;
-	struct pfd_stat_elm *next;
-	struct pfd_stat_elm *prev;
+	struct hlist_node hash;
+	struct list_head lru;
+	unsigned long stamp;
+
+	/*
+	 * Outcomes of this stream's prefetches, reported without the
+	 * shard lock by pfd_stat_feedback(), possibly from interrupt
+	 * context, and folded into stat by the next pfd_stat_update().
+	 * gen changes whenever the element is handed to another stream,
+	 * so late reports for the previous owner are ignored.
+	 */
+	unsigned int gen;
+	atomic_t consumed;
+	atomic_t wasted;
+	atomic_t congested;
 };
 
-inline void
-reset_pfd_stat_elm(struct pfd_stat_elm *target) {
-	reset_pfd_stat(&target->stat);
-	target->next = NULL;
-	target->prev = NULL;
-}
+struct pfd_stat_shard {
+	spinlock_t lock;
+	unsigned long tick;
+	struct list_head lru;
+	struct hlist_head *buckets;
+	unsigned int bucket_mask;
+	struct pfd_stat_elm *elms;
+	int nr_elms;
+	/* Streams a key may own, so one key cannot take over the shard */
+	int key_streams;
+} ____cacheline_aligned_in_smp;
+
+struct pfd_stat_table {
+	struct cache_c *dmc;
+	unsigned int shard_shift;
+	unsigned int nr_shards;
+	struct pfd_stat_shard *shards;
+	struct list_head list;
 
-struct pfd_stat_queue {
-	struct pfd_stat_elm stat_elms[PFD_STAT_COUNT];
-	struct pfd_stat_elm *head;
-	struct pfd_stat_elm *tail;
+	/*
+	 * Sum of the weights of the streams asking for prefetch. The
+	 * prefetch budget of the device is split in proportion to them.
+	 */
+	atomic_t weight_total;
 };
 
+static LIST_HEAD(pfd_stat_tables);
+static DEFINE_SPINLOCK(pfd_stat_tables_lock);
+
+/*
+ * The stream a read belongs to. Thread pools reading one file share a
+ * tgid. A region key is the tgid and the region of the disk read, in the
+ * high 32 bits, so the threads of a pool working on different parts of
+ * the disk keep separate streams, and other processes keep theirs.
+ * Streams are hashed by owner alone, so a stream can follow its reads
+ * into the next region, see pfd_stat_shard_search().
+ */
+#define PFD_STAT_KEY_OWNER(key) ((u_int32_t)(key))
+#define PFD_STAT_KEY_REGION_ONE (1ULL << 32)
+
+static inline u_int32_t
+pfd_stat_hash(u64 key) {
+	return jhash_1word(PFD_STAT_KEY_OWNER(key), 0xfeed);
+}
+
+static inline u64
+pfd_stat_key(
+		struct cache_c *dmc,
+		struct bio *bio) {
+	switch (dmc->sysctl_pfd_stream_key) {
+	case PFD_STAT_KEY_TGID:
+		return current->tgid;
+	case PFD_STAT_KEY_REGION:
+		return ((u64)(bio->bi_iter.bi_sector >> PFD_STAT_REGION_SHIFT) << 32) |
+			(u_int32_t)current->tgid;
+	default:
+		return current->pid;
+	}
+}
+
 static void
-reset_pfd_stat_queue(struct pfd_stat_queue *target) {
+reset_pfd_stat_shard(
+		struct pfd_stat_table *table,
+		struct pfd_stat_shard *shard) {
 	int i;
 	struct pfd_stat_elm *elm;
 
-	for (i = 0; i < PFD_STAT_COUNT; i++) {
-		elm = &target->stat_elms[i];
-		reset_pfd_stat_elm(elm);
-		if (i != 0)
-			elm->prev = &target->stat_elms[i - 1];
-		if (i != PFD_STAT_COUNT - 1)
-			elm->next = &target->stat_elms[i + 1];
+	INIT_LIST_HEAD(&shard->lru);
+	for (i = 0; i <= shard->bucket_mask; i++)
+		INIT_HLIST_HEAD(&shard->buckets[i]);
+	for (i = 0; i < shard->nr_elms; i++) {
+		elm = &shard->elms[i];
+		atomic_sub(elm->stat.weight, &table->weight_total);
+		reset_pfd_stat(&elm->stat);
+		elm->gen++;
+		atomic_set(&elm->consumed, 0);
+		atomic_set(&elm->wasted, 0);
+		atomic_set(&elm->congested, 0);
+		INIT_HLIST_NODE(&elm->hash);
+		list_add_tail(&elm->lru, &shard->lru);
 	}
-
-	target->head = &target->stat_elms[0];
-	target->tail = &target->stat_elms[PFD_STAT_COUNT - 1];
 }
 
-static void
-pfd_stat_elm_to_head(
-		struct pfd_stat_queue *q,
-		struct pfd_stat_elm *elm) {
-	if (q->head == elm) return;
-	if (elm->next)
-		elm->next->prev = elm->prev;
-	if (elm->prev)
-		elm->prev->next = elm->next;
-	if (q->tail == elm)
-		q->tail = elm->prev;
-	q->head->prev = elm;
-	elm->next = q->head;
-	elm->prev = NULL;
-	q->head = elm;
+/*
+ * Distance in sectors from sector to where stat expects its next read:
+ * the end of the current run, or one stride past its start.
+ */
+static long
+pfd_stat_distance(
+		struct cache_c *dmc,
+		struct pfd_stat *stat,
+		sector_t sector) {
+	struct pfd_seq_stat *curr = stat->curr_seq_stat;
+	long dist;
+	long stride_dist;
+
+	dist = (long)sector - (long)(curr->start +
+			(sector_t)curr->count * (sector_t)dmc->block_size);
+	dist = dist < 0 ? -dist : dist;
+	if (stat->stride != 0) {
+		stride_dist = (long)sector - ((long)curr->start + stat->stride);
+		stride_dist = stride_dist < 0 ? -stride_dist : stride_dist;
+		if (stride_dist < dist)
+			dist = stride_dist;
+	}
+
+	return dist;
 }
 
+/*
+ * Find the stream of key that a read of sector continues, that is the
+ * closest one within PFD_STAT_MATCH_BLOCKS of its expected next read.
+ * A stream of prev_key, the same owner's previous region, may continue
+ * too, when its next read crosses into this region. Also return the
+ * most and least recently used streams of the owner and their number.
+ * Called with the shard lock held.
+ */
 static struct pfd_stat_elm *
-pfd_stat_queue_search(
-		struct pfd_stat_queue *q,
+pfd_stat_shard_search(
 		struct cache_c *dmc,
-		int pid) {
-	struct pfd_stat_elm *elm = q->head;
-	struct pfd_stat *pfd_stat;
+		struct hlist_head *bucket,
+		u64 key,
+		u64 prev_key,
+		sector_t sector,
+		struct pfd_stat_elm **mru,
+		struct pfd_stat_elm **lru,
+		int *nr_streams) {
+	struct pfd_stat_elm *elm;
+	struct pfd_stat_elm *best = NULL;
+	long best_dist = (long)PFD_STAT_MATCH_BLOCKS << dmc->block_shift;
+	long dist;
 
-	while (elm != NULL) {
-		pfd_stat = &elm->stat;
+	*mru = NULL;
+	*lru = NULL;
+	*nr_streams = 0;
+	hlist_for_each_entry(elm, bucket, hash) {
+		if (PFD_STAT_KEY_OWNER(elm->stat.key) != PFD_STAT_KEY_OWNER(key))
+			continue;
+		*nr_streams += 1;
+		if (*mru == NULL || elm->stamp > (*mru)->stamp)
+			*mru = elm;
+		if (*lru == NULL || elm->stamp < (*lru)->stamp)
+			*lru = elm;
+		if (elm->stat.key != key && elm->stat.key != prev_key)
+			continue;
+		dist = pfd_stat_distance(dmc, &elm->stat, sector);
+		if (dist <= best_dist) {
+			best = elm;
+			best_dist = dist;
+		}
+	}
 
-		if (pfd_stat->tgt == dmc->tgt && pfd_stat->pid == pid)
-			return elm;
-		else if (pfd_stat->tgt == NULL)
-			return NULL;
+	return best;
+}
 
-		elm = elm->next;
+/*
+ * Shard arrays are mostly a few hundred bytes to a few KB, and only
+ * large stream counts need vmalloc.
+ */
+static void *
+pfd_stat_zalloc(size_t n, size_t size) {
+	if (n * size <= PAGE_SIZE)
+		return kcalloc(n, size, GFP_KERNEL);
+	return vzalloc(n * size);
+}
+
+static void
+pfd_stat_free(void *addr) {
+	if (is_vmalloc_addr(addr))
+		vfree(addr);
+	else
+		kfree(addr);
+}
+
+static void
+free_pfd_stat_table(struct pfd_stat_table *table) {
+	int i;
+
+	for (i = 0; i < table->nr_shards; i++) {
+		pfd_stat_free(table->shards[i].elms);
+		pfd_stat_free(table->shards[i].buckets);
+	}
+	kfree(table->shards);
+	kfree(table);
+}
+
+static struct pfd_stat_table *
+alloc_pfd_stat_table(struct cache_c *dmc, int streams) {
+	struct pfd_stat_table *table;
+	struct pfd_stat_shard *shard;
+	int per_shard;
+	int i;
+
+	table = kzalloc(sizeof(*table), GFP_KERNEL);
+	if (table == NULL)
+		return NULL;
+
+	table->dmc = dmc;
+	/* Fewer shards rather than shards too small for their LRU to work */
+	table->shard_shift = PFD_STAT_SHARD_SHIFT;
+	while (table->shard_shift > 0 &&
+			(streams >> table->shard_shift) < PFD_STAT_SHARD_MIN_STREAMS)
+		table->shard_shift--;
+	table->nr_shards = 1 << table->shard_shift;
+	per_shard = DIV_ROUND_UP(streams, table->nr_shards);
+
+	table->shards = kcalloc(table->nr_shards, sizeof(struct pfd_stat_shard),
+			GFP_KERNEL);
+	if (table->shards == NULL)
+		goto free_table;
+
+	for (i = 0; i < table->nr_shards; i++) {
+		shard = &table->shards[i];
+		spin_lock_init(&shard->lock);
+		shard->nr_elms = per_shard;
+		shard->key_streams = min(PFD_STAT_PID_STREAMS,
+				max(per_shard / 2, 1));
+		shard->bucket_mask = roundup_pow_of_two(per_shard) - 1;
+		shard->elms = pfd_stat_zalloc(per_shard, sizeof(struct pfd_stat_elm));
+		shard->buckets = pfd_stat_zalloc(shard->bucket_mask + 1,
+				sizeof(struct hlist_head));
+		if (shard->elms == NULL || shard->buckets == NULL)
+			goto free_table;
+		reset_pfd_stat_shard(table, shard);
 	}
 
+	return table;
+
+free_table:
+	if (table->shards != NULL)
+		free_pfd_stat_table(table);
+	else
+		kfree(table);
 	return NULL;
 }
 
-DEFINE_SPINLOCK(global_lock);
-static struct pfd_stat_queue main_queue;
-
 void pfd_stat_init() {
-	spin_lock(&global_lock);
-	reset_pfd_stat_queue(&main_queue);
-	spin_unlock(&global_lock);
 	MPPRINTK("\033[0;32;32mpfd_stat initialized");
 }
 
+int pfd_stat_add(struct cache_c *dmc) {
+	struct pfd_stat_table *table;
+	int streams = pfd_stat_streams;
+
+	if (streams < 1)
+		streams = 1;
+	if (streams > PFD_STAT_MAX_STREAMS)
+		streams = PFD_STAT_MAX_STREAMS;
+
+	table = alloc_pfd_stat_table(dmc, streams);
+	if (table == NULL) {
+		MPPRINTK("\033[0;32;31mCan't alloc pfd_stat table.");
+		return -ENOMEM;
+	}
+
+	spin_lock(&pfd_stat_tables_lock);
+	list_add_tail(&table->list, &pfd_stat_tables);
+	spin_unlock(&pfd_stat_tables_lock);
+
+	dmc->pfd_stat_table = table;
+	return 0;
+}
+
+void pfd_stat_remove(struct cache_c *dmc) {
+	struct pfd_stat_table *table = dmc->pfd_stat_table;
+
+	if (table == NULL)
+		return;
+
+	spin_lock(&pfd_stat_tables_lock);
+	list_del(&table->list);
+	spin_unlock(&pfd_stat_tables_lock);
+
+	dmc->pfd_stat_table = NULL;
+	free_pfd_stat_table(table);
+}
+
+void pfd_stat_reset() {
+	struct pfd_stat_table *table;
+	struct pfd_stat_shard *shard;
+	int i;
+
+	spin_lock(&pfd_stat_tables_lock);
+	list_for_each_entry(table, &pfd_stat_tables, list) {
+		for (i = 0; i < table->nr_shards; i++) {
+			shard = &table->shards[i];
+			spin_lock(&shard->lock);
+			reset_pfd_stat_shard(table, shard);
+			spin_unlock(&shard->lock);
+		}
+	}
+	spin_unlock(&pfd_stat_tables_lock);
+	MPPRINTK("\033[0;32;32mpfd_stat reseted");
+}
+
+static inline unsigned int
+pfd_stat_stream_id(
+		struct pfd_stat_table *table,
+		struct pfd_stat_shard *shard,
+		struct pfd_stat_elm *elm) {
+	return (unsigned int)((shard - table->shards) * shard->nr_elms +
+			(elm - shard->elms));
+}
+
+/*
+ * AIMD on the prefetch depth: grow by PFD_STAT_DEPTH_INC after a window
+ * of mostly consumed blocks, halve it after a window where more than
+ * 1/2^PFD_STAT_WASTE_SHIFT was evicted unread, or at once when the
+ * prefetch queue or the disk is saturated. Called with the shard lock
+ * held.
+ */
+static void
+update_pfd_stat_depth(struct pfd_stat_elm *elm) {
+	struct pfd_stat *stat = &elm->stat;
+	long consumed = atomic_xchg(&elm->consumed, 0);
+	long wasted = atomic_xchg(&elm->wasted, 0);
+	long congested = atomic_xchg(&elm->congested, 0);
+	long window;
+
+	stat->consumed += consumed;
+	stat->wasted += wasted;
+	stat->win_consumed += consumed;
+	stat->win_wasted += wasted;
+	window = stat->win_consumed + stat->win_wasted;
+
+	if (congested == 0 && window < stat->depth)
+		return;
+
+	if (window > 0)
+		stat->useful_pct = (int)(stat->win_consumed * 100 / window);
+
+	if (congested > 0 ||
+			stat->win_wasted > (window >> PFD_STAT_WASTE_SHIFT)) {
+		stat->depth >>= 1;
+		if (stat->depth < PFD_CACHE_THRESHOLD_STEP)
+			stat->depth = PFD_CACHE_THRESHOLD_STEP;
+	} else {
+		stat->depth += PFD_STAT_DEPTH_INC;
+		if (stat->depth > PFD_CACHE_MAX_STEP)
+			stat->depth = PFD_CACHE_MAX_STEP;
+	}
+	stat->win_consumed = 0;
+	stat->win_wasted = 0;
+}
+
+/*
+ * Record the delta from the previous read of the stream, and look for
+ * the last two deltas earlier in the history. When they are found, the
+ * deltas that followed them then are the predicted pattern, which is
+ * handed to the prefetcher once PFD_STAT_DELTA_CONFIDENCE predictions
+ * in a row were right. This catches repeating irregular patterns such
+ * as +1,+1,+7. Called with the shard lock held.
+ */
+static void
+update_pfd_stat_delta(
+		struct cache_c *dmc,
+		struct pfd_stat *stat,
+		sector_t sector,
+		struct pfd_stat_info *result) {
+	int hist[PFD_STAT_DELTA_HISTORY];
+	long delta;
+	int nr = stat->delta_nr;
+	int i, j;
+
+	result->delta_base = sector;
+	result->delta_len = 0;
+
+	if (stat->delta_last < 0) {
+		stat->delta_last = (long)sector;
+		return;
+	}
+	delta = ((long)sector - stat->delta_last) / (long)dmc->block_size;
+	if (delta == 0)
+		return;
+	stat->delta_last = (long)sector;
+
+	if (nr > 0 && delta == stat->delta_next)
+		stat->delta_hits++;
+	else
+		stat->delta_hits = 0;
+
+	stat->deltas[(stat->delta_head + nr) % PFD_STAT_DELTA_HISTORY] = (int)delta;
+	if (nr < PFD_STAT_DELTA_HISTORY)
+		stat->delta_nr = ++nr;
+	else
+		stat->delta_head = (stat->delta_head + 1) % PFD_STAT_DELTA_HISTORY;
+
+	for (i = 0; i < nr; i++)
+		hist[i] = stat->deltas[(stat->delta_head + i) % PFD_STAT_DELTA_HISTORY];
+
+	stat->delta_next = 0;
+	for (i = nr - 3; i >= 1; i--) {
+		if (hist[i - 1] != hist[nr - 2] || hist[i] != hist[nr - 1])
+			continue;
+		stat->delta_next = hist[i + 1];
+		if (stat->delta_hits < PFD_STAT_DELTA_CONFIDENCE)
+			break;
+		for (j = i + 1; j < nr; j++)
+			result->delta_blocks[j - i - 1] = hist[j];
+		result->delta_len = nr - i - 1;
+		break;
+	}
+}
+
 void pfd_stat_update(
 		struct cache_c *dmc,
 		struct bio *bio,
 		struct pfd_stat_info *result) {
 
+	struct pfd_stat_table *table = dmc->pfd_stat_table;
+	struct pfd_stat_shard *shard;
+	struct hlist_head *bucket;
 	struct pfd_stat_elm *elm;
 	struct pfd_stat *pfd_stat;
-	int pid = current->pid;
+	u64 key = pfd_stat_key(dmc, bio);
+	u64 prev_key = key;
+	u_int32_t hash = pfd_stat_hash(key);
+	struct pfd_stat_elm *mru;
+	struct pfd_stat_elm *lru;
+	int nr_streams;
 	struct pfd_seq_stat *curr;
 	struct pfd_seq_stat *prev;
+	struct pfd_seq_stat from;
 	long new_stride_abs;
+	sector_t next;
+	int prefetching;
+	int weight, total;
+	/* Reads need not be whole blocks, the detector works on blocks */
+	sector_t sector = bio->bi_iter.bi_sector &
+		~((sector_t)dmc->block_size - 1);
+	long blocks = (long)((bio_end_sector(bio) - sector +
+		dmc->block_size - 1) >> dmc->block_shift);
 
-	spin_lock(&global_lock);
+	if (table == NULL) {
+		result->last_sect = bio->bi_iter.bi_sector;
+		result->seq_count = 0;
+		result->seq_total_count = 0;
+		result->stride_distance_sect = 0;
+		result->stride_count = 0;
+		result->stream = PFD_STAT_NO_STREAM;
+		result->stream_gen = 0;
+		result->depth = 0;
+		result->delta_len = 0;
+		result->cancel = 0;
+		result->share = PFD_STAT_SHARE_ONE;
+		return;
+	}
 
-	elm = pfd_stat_queue_search(&main_queue, dmc, pid);
+	shard = &table->shards[hash & (table->nr_shards - 1)];
+	bucket = &shard->buckets[(hash >> table->shard_shift) & shard->bucket_mask];
+
+	spin_lock(&shard->lock);
+
+	if (dmc->sysctl_pfd_stream_key == PFD_STAT_KEY_REGION &&
+			key >= PFD_STAT_KEY_REGION_ONE)
+		prev_key = key - PFD_STAT_KEY_REGION_ONE;
+	elm = pfd_stat_shard_search(dmc, bucket, key, prev_key, sector,
+			&mru, &lru, &nr_streams);
 	if (elm != NULL) {
 		pfd_stat = &elm->stat;
+		/* Carry the stream over into the region it continues in */
+		pfd_stat->key = key;
+		elm->stamp = ++shard->tick;
+		list_move(&elm->lru, &shard->lru);
+		update_pfd_stat_depth(elm);
 	} else {
-		elm = main_queue.tail;
+		/*
+		 * A new stream of key. It starts out as if it had jumped
+		 * from the last stream of key, so a strided scan is still
+		 * seen as one stream.
+		 */
+		from.count = 0;
+		if (mru != NULL)
+			from = *mru->stat.curr_seq_stat;
+		if (nr_streams < shard->key_streams)
+			elm = list_last_entry(&shard->lru, struct pfd_stat_elm, lru);
+		else
+			elm = lru;
+		hlist_del_init(&elm->hash);
 		pfd_stat = &elm->stat;
+		atomic_sub(pfd_stat->weight, &table->weight_total);
 		reset_pfd_stat(pfd_stat);
-		pfd_stat->pid = pid;
-		pfd_stat->tgt = dmc->tgt;
+		pfd_stat->key = key;
+		elm->gen++;
+		elm->stamp = ++shard->tick;
+		atomic_set(&elm->consumed, 0);
+		atomic_set(&elm->wasted, 0);
+		atomic_set(&elm->congested, 0);
+		hlist_add_head(&elm->hash, bucket);
+		list_move(&elm->lru, &shard->lru);
+
+		curr = pfd_stat->curr_seq_stat;
+		prev = pfd_stat->prev_seq_stat;
+		curr->start = sector;
+		curr->count = blocks;
+		new_stride_abs = (long)sector - (long)from.start;
+		new_stride_abs = new_stride_abs < 0 ? -new_stride_abs : new_stride_abs;
+		if (from.count > 0 &&
+				(new_stride_abs >> dmc->block_shift) >= from.count) {
+			*prev = from;
+			pfd_stat->stride =
+				(long)sector -
+				(long)prev->start;
+			pfd_stat->stride_count = 1;
+		}
+		goto end;
 	}
-	pfd_stat_elm_to_head(&main_queue, elm);
 
 	curr = pfd_stat->curr_seq_stat;
 	prev = pfd_stat->prev_seq_stat;
 
 	if (curr->count == 0) {
-		curr->count += 1;
-		curr->start = bio->bi_iter.bi_sector;
+		curr->count += blocks;
+		curr->start = sector;
 		goto end;
 	}
 
-	if (is_bio_fit_seq_stat(dmc, curr, bio)) {
-		curr->count += 1;
+	/*
+	 * A read that starts in the last block of the run, such as the
+	 * rest of a block read in pieces, continues the run. Streams
+	 * shared by several readers also see their blocks slightly out of
+	 * order. Within the reorder window a read behind the end of the
+	 * run is already part of it, and one ahead extends it over the
+	 * gap, which the other readers are about to fill.
+	 */
+	next = curr->start + (sector_t)curr->count * (sector_t)dmc->block_size;
+	if (sector >= curr->start && sector < next &&
+			(dmc->sysctl_pfd_stream_key != PFD_STAT_KEY_PID ||
+			 sector + dmc->block_size == next)) {
+		if (((sector - curr->start) >> dmc->block_shift) + blocks >
+				curr->count)
+			curr->count = ((sector - curr->start) >>
+					dmc->block_shift) + blocks;
+		goto end;
+	}
+	if (dmc->sysctl_pfd_stream_key != PFD_STAT_KEY_PID &&
+			sector >= next &&
+			sector - next <
+			((sector_t)PFD_STAT_REORDER_BLOCKS << dmc->block_shift)) {
+		curr->count = ((sector - curr->start) >>
+				dmc->block_shift) + blocks;
+		goto end;
+	}
+
+	if (is_bio_fit_seq_stat(dmc, curr, sector)) {
+		curr->count += blocks;
 		if (prev->count == 0 || curr->count <= prev->count)
 			goto end;
 		else {
@@ -213,12 +723,12 @@ void pfd_stat_update(
 			goto end;
 		}
 	} else {
-		new_stride_abs = (long)bio->bi_iter.bi_sector - (long)curr->start;
+		new_stride_abs = (long)sector - (long)curr->start;
 		new_stride_abs = new_stride_abs < 0 ? -new_stride_abs : new_stride_abs;
 		if (prev->count == 0) {
 			if ((new_stride_abs >> dmc->block_shift) < curr->count) {
-				curr->start = bio->bi_iter.bi_sector;
-				curr->count = 1;
+				curr->start = sector;
+				curr->count = blocks;
 				pfd_stat->stride = 0;
 				pfd_stat->stride_count = 0;
 				goto end;
@@ -226,22 +736,22 @@ void pfd_stat_update(
 			swap_pfd_stat_curr_prev(pfd_stat);
 			curr = pfd_stat->curr_seq_stat;
 			prev = pfd_stat->prev_seq_stat;
-			curr->start = bio->bi_iter.bi_sector;
-			curr->count = 1;
+			curr->start = sector;
+			curr->count = blocks;
 			pfd_stat->stride =
-				(long)bio->bi_iter.bi_sector -
+				(long)sector -
 				(long)prev->start;
 			pfd_stat->stride_count = 1;
 			goto end;
 		} else if (
 				prev->count == curr->count &&
-				(long)bio->bi_iter.bi_sector -
+				(long)sector -
 				(long)curr->start == pfd_stat->stride) {
 			swap_pfd_stat_curr_prev(pfd_stat);
 			curr = pfd_stat->curr_seq_stat;
 			prev = pfd_stat->prev_seq_stat;
-			curr->start = bio->bi_iter.bi_sector;
-			curr->count = 1;
+			curr->start = sector;
+			curr->count = blocks;
 			pfd_stat->stride_count += 1;
 			goto end;
 		} else {
@@ -249,8 +759,8 @@ void pfd_stat_update(
 			curr = pfd_stat->curr_seq_stat;
 			prev = pfd_stat->prev_seq_stat;
 			reset_pfd_seq_stat(prev);
-			curr->start = bio->bi_iter.bi_sector;
-			curr->count = 1;
+			curr->start = sector;
+			curr->count = blocks;
 			pfd_stat->stride = 0;
 			pfd_stat->stride_count = 0;
 			goto end;
@@ -258,13 +768,42 @@ void pfd_stat_update(
 	}
 
 end:
-	result->last_sect = bio->bi_iter.bi_sector;
+	pfd_stat->pid = current->pid;
+	/* The furthest block of the run, reads may come out of order */
+	result->last_sect = curr->start +
+		(sector_t)(curr->count - 1) * (sector_t)dmc->block_size;
 	result->seq_count = curr->count;
+	/* A lone read is not a stream yet, however many blocks it spans */
+	if (curr->start == sector && curr->count == blocks && prev->count == 0)
+		result->seq_count = 1;
 	result->seq_total_count = prev->count;
 	result->stride_distance_sect = pfd_stat->stride;
 	result->stride_count = pfd_stat->stride_count;
+	result->stream = pfd_stat_stream_id(table, shard, elm);
+	result->stream_gen = elm->gen;
+	result->depth = pfd_stat->depth;
+	if (dmc->sysctl_pfd_delta)
+		update_pfd_stat_delta(dmc, pfd_stat, sector, result);
+	else
+		result->delta_len = 0;
 
-	spin_unlock(&global_lock);
+	prefetching = result->seq_total_count * result->stride_count +
+		result->seq_count >= PFD_CACHE_THRESHOLD_STEP ||
+		result->delta_len > 0;
+	result->cancel = pfd_stat->prefetching &&
+		(!prefetching || pfd_stat->prefetch_stride != pfd_stat->stride);
+	pfd_stat->prefetching = prefetching;
+	pfd_stat->prefetch_stride = pfd_stat->stride;
+
+	/* Useful streams get a larger share, idle ones none */
+	weight = prefetching ? 1 + pfd_stat->useful_pct : 0;
+	total = atomic_add_return(weight - pfd_stat->weight,
+			&table->weight_total);
+	pfd_stat->weight = weight;
+	result->share = total > 0 ?
+		weight * PFD_STAT_SHARE_ONE / total : PFD_STAT_SHARE_ONE;
+
+	spin_unlock(&shard->lock);
 
 #ifdef PFD_STAT_SEQ_FOR_ONLY
 	if (result->stride_distance_sect != 0) {
@@ -276,8 +815,8 @@ end:
 #endif
 
 	DPPRINTK("pfd_stat updated");
-	DPPRINTK("\tpid: %d",
-			pid);
+	DPPRINTK("\tkey: %llx",
+			(unsigned long long)key);
 	DPPRINTK("\treq: %lu",
 			result->last_sect);
 	DPPRINTK("\tseq: %ld / %ld",
@@ -287,11 +826,158 @@ end:
 			result->stride_distance_sect);
 	DPPRINTK("\tstride_count: %ld",
 			result->stride_count);
+	DPPRINTK("\tdepth: %ld",
+			result->depth);
+}
+
+/*
+ * Report the outcome of a block prefetched for a stream. Lock free, so
+ * it may be called from any context.
+ */
+void pfd_stat_feedback(
+		struct cache_c *dmc,
+		unsigned int stream,
+		unsigned int stream_gen,
+		enum pfd_stat_event event) {
+
+	struct pfd_stat_table *table = dmc->pfd_stat_table;
+	struct pfd_stat_shard *shard;
+	struct pfd_stat_elm *elm;
+
+	if (table == NULL || stream == PFD_STAT_NO_STREAM)
+		return;
+
+	shard = &table->shards[stream / table->shards[0].nr_elms];
+	elm = &shard->elms[stream % shard->nr_elms];
+	if (ACCESS_ONCE(elm->gen) != stream_gen)
+		return;
+
+	switch (event) {
+	case PFD_STAT_CONSUMED:
+		atomic_inc(&elm->consumed);
+		break;
+	case PFD_STAT_WASTED:
+		atomic_inc(&elm->wasted);
+		break;
+	case PFD_STAT_CONGESTED:
+		atomic_inc(&elm->congested);
+		break;
+	}
+}
+
+static const char *
+pfd_stat_pattern(struct pfd_stat *stat) {
+	if (stat->stride != 0)
+		return "stride";
+	if (stat->curr_seq_stat->count > 1)
+		return "seq";
+	if (stat->delta_hits >= PFD_STAT_DELTA_CONFIDENCE)
+		return "delta";
+	return "random";
+}
+
+void pfd_stat_count_streams(
+		struct cache_c *dmc,
+		int *seq,
+		int *stride,
+		int *delta,
+		int *random) {
+
+	struct pfd_stat_table *table = dmc->pfd_stat_table;
+	struct pfd_stat_shard *shard;
+	struct pfd_stat *stat;
+	int i, j;
+
+	*seq = 0;
+	*stride = 0;
+	*delta = 0;
+	*random = 0;
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < table->nr_shards; i++) {
+		shard = &table->shards[i];
+		spin_lock(&shard->lock);
+		for (j = 0; j < shard->nr_elms; j++) {
+			stat = &shard->elms[j].stat;
+			if (stat->pid < 0)
+				continue;
+			if (stat->stride != 0)
+				*stride += 1;
+			else if (stat->curr_seq_stat->count > 1)
+				*seq += 1;
+			else if (stat->delta_hits >= PFD_STAT_DELTA_CONFIDENCE)
+				*delta += 1;
+			else
+				*random += 1;
+		}
+		spin_unlock(&shard->lock);
+	}
+}
+
+void pfd_stat_show_streams(
+		struct cache_c *dmc,
+		struct seq_file *seq) {
+
+	struct pfd_stat_table *table = dmc->pfd_stat_table;
+	struct pfd_stat_shard *shard;
+	struct pfd_stat_elm *elm;
+	struct pfd_stat *stat;
+	int i, j;
+	int total;
+
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < table->nr_shards; i++) {
+		shard = &table->shards[i];
+		spin_lock(&shard->lock);
+		for (j = 0; j < shard->nr_elms; j++) {
+			elm = &shard->elms[j];
+			stat = &elm->stat;
+			if (stat->pid < 0)
+				continue;
+			total = atomic_read(&table->weight_total);
+			seq_printf(seq, "pid=%d pattern=%s depth=%ld consumed=%lu wasted=%lu useful=%d%% share=%d%%\n",
+				   stat->pid, pfd_stat_pattern(stat), stat->depth,
+				   stat->consumed + atomic_read(&elm->consumed),
+				   stat->wasted + atomic_read(&elm->wasted),
+				   stat->useful_pct,
+				   total > 0 ? stat->weight * 100 / total : 0);
+		}
+		spin_unlock(&shard->lock);
+	}
+}
+
+/* Replay the delta pattern of info from its base */
+static int
+pfd_stat_get_delta_dbns(
+		struct cache_c *dmc,
+		struct pfd_stat_info *info,
+		sector_t *arr) {
+
+	long max_step = PFD_CACHE_MAX_STEP;
+	long disk_sects =
+		(long)dmc->disk_dev->bdev->bd_part->nr_sects;
+	long dbn = (long)info->delta_base;
+	long i;
+
+	if (info->depth > 0 && max_step > info->depth)
+		max_step = info->depth;
+
+	for (i = 0; i < max_step; i++) {
+		dbn += (long)info->delta_blocks[i % info->delta_len] << dmc->block_shift;
+		if (dbn < 0 || dbn >= disk_sects)
+			return (int)i;
+		arr[i] = (sector_t)dbn;
+	}
+	return (int)max_step;
 }
 
 int pfd_stat_get_prefetch_dbns(
 		struct cache_c *dmc,
 		struct pfd_stat_info *info,
+		int buf_blocks,
 		sector_t *arr) {
 
 	long max_step =
@@ -304,18 +990,24 @@ int pfd_stat_get_prefetch_dbns(
 		(long)dmc->disk_dev->bdev->bd_part->nr_sects;
 	long tmp1, tmp2;
 
-	if (max_step < PFD_CACHE_THRESHOLD_STEP)
+	if (max_step < PFD_CACHE_THRESHOLD_STEP) {
+		if (info->delta_len > 0)
+			return pfd_stat_get_delta_dbns(dmc, info, arr);
 		return 0;
+	}
+	info->delta_len = 0;
 
 	if (max_step > PFD_CACHE_MAX_STEP)
 		max_step = PFD_CACHE_MAX_STEP;
+	if (info->depth > 0 && max_step > info->depth)
+		max_step = info->depth;
 
 	if (info->stride_distance_sect != 0) {
 		tmp1 = info->stride_distance_sect;
 		if (tmp1 < 0)
 			tmp1 = -tmp1;
 
-		tmp2 = PFD_CACHE_BLOCK_COUNT / tmp1;
+		tmp2 = buf_blocks / tmp1;
 		tmp1 = tmp2 * info->seq_total_count;
 		if (max_step > tmp1)
 			max_step = tmp1;
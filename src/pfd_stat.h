@@ -1,5 +1,21 @@
 //#define PFD_STAT_SEQ_FOR_ONLY
-#define PFD_STAT_COUNT 64
+#define PFD_STAT_DEFAULT_STREAMS 64
+#define PFD_STAT_MAX_STREAMS 65536
+#define PFD_STAT_SHARD_SHIFT 4
+#define PFD_STAT_SHARD_MIN_STREAMS 16
+#define PFD_STAT_PID_STREAMS 4
+#define PFD_STAT_MATCH_BLOCKS 32
+#define PFD_STAT_REORDER_BLOCKS 16
+/* Regions of the region stream key, 1GB of disk */
+#define PFD_STAT_REGION_SHIFT 21
+#define PFD_STAT_DELTA_HISTORY 16
+#define PFD_STAT_DELTA_CONFIDENCE 2
+#define PFD_STAT_DEPTH_INIT 64
+#define PFD_STAT_DEPTH_INC 8
+#define PFD_STAT_WASTE_SHIFT 3
+#define PFD_STAT_USEFUL_INIT 50
+#define PFD_STAT_SHARE_ONE 1000
+#define PFD_STAT_NO_STREAM (~0U)
 
 #include <linux/types.h>
 
@@ -11,16 +27,72 @@ struct pfd_stat_info {
 	long seq_total_count;
 	long stride_distance_sect;
 	long stride_count;
+
+	/* Identifies the stream for pfd_stat_feedback() */
+	unsigned int stream;
+	unsigned int stream_gen;
+	long depth;
+
+	/*
+	 * Block deltas that repeat from delta_base, see the prefetch_delta
+	 * sysctl. Only used when the stream is neither sequential nor
+	 * strided enough; pfd_stat_get_prefetch_dbns() clears delta_len
+	 * when it did not use them.
+	 */
+	sector_t delta_base;
+	int delta_len;
+	int delta_blocks[PFD_STAT_DELTA_HISTORY];
+
+	/* The stream stopped following the pattern it was prefetched for */
+	int cancel;
+
+	/* Share of the device prefetch budget, out of PFD_STAT_SHARE_ONE */
+	int share;
+};
+
+/* What streams are keyed by, see the prefetch_stream_key sysctl */
+enum pfd_stat_key {
+	PFD_STAT_KEY_PID = 0,
+	PFD_STAT_KEY_TGID,
+	PFD_STAT_KEY_REGION,
+	PFD_STAT_KEY_MAX = PFD_STAT_KEY_REGION,
+};
+
+enum pfd_stat_event {
+	PFD_STAT_CONSUMED = 1,
+	PFD_STAT_WASTED,
+	PFD_STAT_CONGESTED,
 };
 #endif
 
+struct seq_file;
+
 void pfd_stat_init(void);
+int pfd_stat_add(struct cache_c *dmc);
+void pfd_stat_remove(struct cache_c *dmc);
+void pfd_stat_reset(void);
 void pfd_stat_update(
 		struct cache_c *dmc,
 		struct bio *bio,
 		struct pfd_stat_info *result);
 
+void pfd_stat_feedback(
+		struct cache_c *dmc,
+		unsigned int stream,
+		unsigned int stream_gen,
+		enum pfd_stat_event event);
+void pfd_stat_count_streams(
+		struct cache_c *dmc,
+		int *seq,
+		int *stride,
+		int *delta,
+		int *random);
+void pfd_stat_show_streams(
+		struct cache_c *dmc,
+		struct seq_file *seq);
+
 int pfd_stat_get_prefetch_dbns(
 		struct cache_c *dmc,
 		struct pfd_stat_info *info,
+		int buf_blocks,
 		sector_t *arr);
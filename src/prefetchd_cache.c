@@ -589,7 +589,7 @@ mem_miss:
 			cacheblk = &dmc->cache[lookup_index];
 			if ((cacheblk->cache_state & VALID) && 
 					(cacheblk->dbn == tmp_bio.bi_iter.bi_sector)) {
-				if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (cacheblk->nr_queued == 0)) {
+				if (!(cacheblk->cache_state & BLOCK_IO_INPROG) && (FLASHCACHE_NR_QUEUED(cacheblk) == 0)) {
 					cacheblk->cache_state |= CACHEREADINPROG;
 					ex_flashcache_setlocks_multidrop(dmc, &tmp_bio);
 					alloc_prefetch(
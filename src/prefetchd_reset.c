@@ -24,7 +24,7 @@ proc_write_fn(struct file *file, const char __user *buffer, size_t count, loff_t
 	int ret;
 
 	MPPRINTK("\033[1;33mreseting prefetchd...");
-	pfd_stat_init();
+	pfd_stat_reset();
 	if (pfd_cache_reset() == 0)
 		MPPRINTK("\033[0;32;32mprefetchd reseted.");
 	else
@@ -1,2 +1,2 @@
 #define PREFETCHD_ON
-#define PREFETCHD_DEBUG
+//#define PREFETCHD_DEBUG
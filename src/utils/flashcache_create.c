@@ -336,9 +336,11 @@ main(int argc, char **argv)
  	 * If it's > 25% of RAM, warn.
          */
 	if (cache_size == 0)
-		ram_needed = (cache_devsize / block_size) * sizeof(struct cacheblock);	/* Whole device */
+		ram_needed = (cache_devsize / block_size) * 
+			(sizeof(struct cacheblock) + sizeof(struct cacheblock_cold));	/* Whole device */
 	else 
-		ram_needed = (cache_size    / block_size) * sizeof(struct cacheblock);
+		ram_needed = (cache_size    / block_size) * 
+			(sizeof(struct cacheblock) + sizeof(struct cacheblock_cold));
 
 	sysinfo(&i);
 	printf("Flashcache metadata will use %luMB of your %luMB main memory\n",